@@ -130,7 +130,7 @@ public:
 
     InternetDatagram dgram = move( _interface.datagrams_received().front() );
     _interface.datagrams_received().pop();
-    return unwrap_tcp_in_ip( dgram );
+    return unwrap_tcp_in_ip( move( dgram ) );
   }
   void write( const TCPMessage& msg ) { _interface.send_datagram( wrap_tcp_in_ip( msg ), _next_hop ); }
   void tick( const size_t ms_since_last_tick ) { _interface.tick( ms_since_last_tick ); }
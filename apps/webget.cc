@@ -14,8 +14,7 @@ void get_URL( const string& host, const string& path )
   CS144TCPSocket http_tcp {};
   const string input( "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n" );
 
-  http_tcp.connect( addr );
-  http_tcp.write( input );
+  http_tcp.connect_with_data( addr, input );
 
   http_tcp.shutdown( SHUT_WR );
 
@@ -58,6 +58,26 @@ ttest(net_interface)
 
 ttest(router)
 
+ttest(peer_window_scale)
+ttest(peer_timestamps)
+ttest(peer_delayed_ack)
+ttest(peer_stats)
+ttest(peer_autotune)
+ttest(peer_gro)
+ttest(payload_copies)
+ttest(tcp_stack)
+ttest(tcp_stack_listen)
+ttest(tcp_stack_fast_open)
+ttest(eventloop)
+ttest(peer_next_deadline)
+ttest(tcp_over_udp)
+ttest(link_emulator)
+ttest(sharded_tcp_stack)
+ttest(coroutine)
+ttest(zero_copy)
+ttest(wire_bytes)
+ttest(checksum)
+
 add_custom_target (check0 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 12 -R 'webget|^byte_stream_')
 
 add_custom_target (check_webget COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --timeout 12 -R 'webget')
@@ -90,3 +110,5 @@ set_tests_properties(${compile_name_opt} PROPERTIES FIXTURES_SETUP compile_opt)
 
 stest(byte_stream_speed_test)
 stest(reassembler_speed_test)
+stest(tcp_latency_speed_test)
+stest(checksum_speed_test)
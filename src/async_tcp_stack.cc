@@ -0,0 +1,134 @@
+#include "async_tcp_stack.hh"
+
+#include "byte_stream.hh"
+#include "parser.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+AsyncTCPStack::AsyncTCPStack( Scheduler& scheduler, const TCPConfig& config, FileDescriptor& fd )
+  : scheduler_( scheduler )
+  , stack_( config )
+  , transmit_( [&fd]( const InternetDatagram& dgram ) { fd.write( serialize( dgram ) ); } )
+{
+  stack_.install( scheduler_.loop(), fd, [this]( const optional<FourTuple>& id ) { updated( id ); } );
+}
+
+void AsyncTCPStack::Change::await_suspend( const coroutine_handle<> awaiting )
+{
+  if ( id_.has_value() ) {
+    owner_.waiting_[id_.value()].push_back( awaiting );
+  } else {
+    owner_.accepting_.push_back( awaiting );
+  }
+}
+
+void AsyncTCPStack::updated( const optional<FourTuple>& id )
+{
+  const auto resume_all = [this]( vector<coroutine_handle<>>& parked ) {
+    for ( const auto handle : parked ) {
+      scheduler_.schedule( handle );
+    }
+    parked.clear();
+  };
+
+  if ( id.has_value() ) {
+    const auto it = waiting_.find( id.value() );
+    if ( it != waiting_.end() ) {
+      resume_all( it->second );
+      waiting_.erase( it );
+    }
+    if ( stack_.acceptable_count() > 0 ) {
+      resume_all( accepting_ );
+    }
+    return;
+  }
+
+  // a tick only changes things for its waiters when a connection dies (e.g. its retransmissions gave up)
+  for ( auto it = waiting_.begin(); it != waiting_.end(); ) {
+    if ( gone( it->first ) ) {
+      resume_all( it->second );
+      it = waiting_.erase( it );
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool AsyncTCPStack::gone( const FourTuple& id ) const
+{
+  return not stack_.has_connection( id ) or not stack_.connection( id ).active();
+}
+
+Task<FourTuple> AsyncTCPStack::accept()
+{
+  while ( true ) {
+    if ( const auto id = stack_.accept() ) {
+      co_return id.value();
+    }
+    co_await Change { *this, nullopt };
+  }
+}
+
+Task<FourTuple> AsyncTCPStack::connect( const Address& local, const Address& remote )
+{
+  const FourTuple id = stack_.connect( local, remote, transmit_ );
+  while ( not gone( id ) ) {
+    if ( stack_.connection( id ).has_ackno() ) {
+      co_return id;
+    }
+    co_await Change { *this, id };
+  }
+  throw runtime_error( "AsyncTCPStack: could not connect to " + remote.to_string() );
+}
+
+Task<string> AsyncTCPStack::read( const FourTuple id, const size_t max_size )
+{
+  if ( max_size == 0 ) {
+    throw runtime_error( "AsyncTCPStack::read: max_size must be positive" );
+  }
+  while ( stack_.has_connection( id ) ) {
+    TCPPeer& peer = stack_.connection( id );
+    Reader& reader = peer.inbound_reader();
+    if ( reader.bytes_buffered() > 0 ) {
+      string data;
+      ::read( reader, max_size, data );
+      stack_.push( id, transmit_ ); // (the window opened)
+      co_return data;
+    }
+    if ( reader.is_finished() or not peer.active() ) {
+      break;
+    }
+    co_await Change { *this, id };
+  }
+  co_return string {};
+}
+
+Task<void> AsyncTCPStack::write( const FourTuple id, string_view data )
+{
+  while ( not data.empty() ) {
+    if ( gone( id ) ) {
+      throw runtime_error( "AsyncTCPStack: connection closed" );
+    }
+    Writer& writer = stack_.connection( id ).outbound_writer();
+    const size_t len = min( data.size(), writer.available_capacity() );
+    if ( len == 0 ) {
+      co_await Change { *this, id };
+      continue;
+    }
+    writer.push( string { data.substr( 0, len ) } );
+    data.remove_prefix( len );
+    stack_.push( id, transmit_ );
+  }
+}
+
+void AsyncTCPStack::close( const FourTuple& id )
+{
+  if ( stack_.has_connection( id ) ) {
+    stack_.connection( id ).outbound_writer().close();
+    stack_.push( id, transmit_ );
+  }
+}
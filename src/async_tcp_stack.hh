@@ -0,0 +1,85 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "address.hh"
+#include "coroutine.hh"
+#include "file_descriptor.hh"
+#include "tcp_config.hh"
+#include "tcp_stack.hh"
+
+// \brief A TCPStack whose connections are used from coroutines, all on one Scheduler's thread.
+//
+// The stack is driven by the Scheduler's EventLoop (see TCPStack::install), so every connection shares one fd
+// and one thread, with no thread or socket pair per connection. A coroutine that waits for a connection is
+// parked on it, and resumed only when the stack has handled a datagram for that connection (or the connection
+// has died): a connection's coroutine costs nothing while other connections are busy.
+//
+// The Scheduler and the fd must outlive the AsyncTCPStack, and the Scheduler must not run once it is gone (the
+// stack's rules stay in the loop).
+class AsyncTCPStack
+{
+public:
+  AsyncTCPStack( Scheduler& scheduler, const TCPConfig& config, FileDescriptor& fd );
+
+  TCPStack& stack() { return stack_; }
+
+  // Next connection spawned by a listening port (see TCPStack::listen), once there is one
+  Task<FourTuple> accept();
+
+  // Open a connection from `local` to `remote`, once the handshake is done (throws if it fails)
+  Task<FourTuple> connect( const Address& local, const Address& remote );
+
+  // Read what is available on a connection, once something is (at most `max_size` bytes, which must be
+  // positive; empty at the end of the stream, or once the connection is gone)
+  Task<std::string> read( FourTuple id, size_t max_size = 65536 );
+
+  // Write all of `data` on a connection, as its send buffer makes room (throws if the connection dies first)
+  // (`data` must stay valid until the task finishes, as it does in `co_await stack.write( id, data )`)
+  Task<void> write( FourTuple id, std::string_view data );
+
+  // End the outbound stream of a connection
+  void close( const FourTuple& id );
+
+  // The tasks refer to the stack
+  AsyncTCPStack( const AsyncTCPStack& other ) = delete;
+  AsyncTCPStack& operator=( const AsyncTCPStack& other ) = delete;
+  AsyncTCPStack( AsyncTCPStack&& other ) = delete;
+  AsyncTCPStack& operator=( AsyncTCPStack&& other ) = delete;
+
+private:
+  Scheduler& scheduler_;
+  TCPStack stack_;
+  TCPStack::TransmitFunction transmit_;
+
+  // Parks the awaiting coroutine until something happens on connection `id` (or, with no `id`, until a
+  // connection is ready to be accepted)
+  class Change
+  {
+  public:
+    Change( AsyncTCPStack& owner, std::optional<FourTuple> id ) : owner_( owner ), id_( id ) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend( std::coroutine_handle<> awaiting );
+    void await_resume() const {}
+
+  private:
+    AsyncTCPStack& owner_;
+    std::optional<FourTuple> id_;
+  };
+
+  std::unordered_map<FourTuple, std::vector<std::coroutine_handle<>>, FourTupleHash> waiting_ {};
+  std::vector<std::coroutine_handle<>> accepting_ {};
+
+  // Resume the coroutines parked on what the stack has just changed
+  void updated( const std::optional<FourTuple>& id );
+
+  // Is the connection dead (or forgotten)?
+  bool gone( const FourTuple& id ) const;
+};
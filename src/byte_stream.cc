@@ -1,5 +1,7 @@
 #include "byte_stream.hh"
 
+#include <utility>
+
 using namespace std;
 
 ByteStream::ByteStream( uint64_t capacity ) : capacity_( capacity ) {}
@@ -24,7 +26,32 @@ void Writer::push( string data )
 
   _buffered_bytes += data_length;
   _written_cnt += data_length;
-  _buffer += data.substr( 0, data_length );
+  if ( !_pieces.empty() ) {
+    // behind an adopted buffer
+    if ( _pieces.back().shared ) {
+      _pieces.emplace_back();
+    }
+    _pieces.back().owned.append( data, 0, data_length );
+  } else if ( _buffer.empty() && _buffer.capacity() < data_length && data.capacity() <= capacity_ ) {
+    // adopt the caller's allocation rather than growing ours and copying into it (unless it is bigger than
+    // the stream could ever fill, like a read buffer sized for the largest datagram)
+    data.resize( data_length );
+    _buffer = std::move( data );
+  } else {
+    _buffer.append( data, 0, data_length );
+  }
+}
+
+void Writer::push_shared( std::shared_ptr<const std::string> data )
+{
+  if ( is_closed() || !data || data->empty() ) {
+    return;
+  }
+
+  _buffered_bytes += data->size();
+  _written_cnt += data->size();
+  _shared_bytes += data->size();
+  _pieces.push_back( Piece { .shared = std::move( data ) } );
 }
 
 void Writer::close()
@@ -36,7 +63,7 @@ void Writer::close()
 uint64_t Writer::available_capacity() const
 {
   // Your code here.
-  return capacity_ - _buffered_bytes;
+  return capacity_ - ( _buffered_bytes - _shared_bytes );
 }
 
 uint64_t Writer::bytes_pushed() const
@@ -60,6 +87,9 @@ uint64_t Reader::bytes_popped() const
 string_view Reader::peek() const
 {
   // Your code here.
+  if ( _buffer.empty() && !_pieces.empty() ) {
+    return _pieces.front().view();
+  }
   return _buffer;
 }
 
@@ -69,10 +99,37 @@ void Reader::pop( uint64_t len )
   if ( len == 0 ) {
     return;
   }
-  len = min( len, _buffer.length() );
-  _buffer.erase( 0, len );
+  len = min( len, _buffered_bytes );
   _buffered_bytes -= len;
   _read_cnt += len;
+
+  const uint64_t from_buffer = min( len, static_cast<uint64_t>( _buffer.length() ) );
+  _buffer.erase( 0, from_buffer );
+  len -= from_buffer;
+  while ( len > 0 ) {
+    Piece& front = _pieces.front();
+    const uint64_t from_piece = min( len, static_cast<uint64_t>( front.view().size() ) );
+    front.offset += from_piece;
+    len -= from_piece;
+    if ( front.shared ) {
+      _shared_bytes -= from_piece;
+    }
+    if ( front.view().empty() ) {
+      _pieces.pop_front();
+    }
+  }
+
+  // bytes owned by the stream at the front become the buffer again
+  if ( _buffer.empty() && !_pieces.empty() && !_pieces.front().shared ) {
+    _buffer = std::move( _pieces.front().owned );
+    _buffer.erase( 0, _pieces.front().offset );
+    _pieces.pop_front();
+  }
+}
+
+string_view ByteStream::Piece::view() const
+{
+  return string_view { shared ? *shared : owned }.substr( offset );
 }
 
 uint64_t Reader::bytes_buffered() const
@@ -81,6 +138,14 @@ uint64_t Reader::bytes_buffered() const
   return _buffered_bytes;
 }
 
+void ByteStream::set_capacity( uint64_t capacity )
+{
+  capacity_ = max( capacity, _buffered_bytes - _shared_bytes );
+  if ( _buffer.capacity() > capacity_ ) {
+    _buffer.shrink_to_fit(); // give back memory held for a larger window
+  }
+}
+
 void ByteStream::set_error()
 {
   _error = true;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -20,6 +22,7 @@ public:
   const Writer& writer() const;
 
   const uint64_t& capacity() const { return capacity_; }
+  void set_capacity( uint64_t capacity );    // Resize the stream (never below the bytes currently buffered).
   void set_error();                          // Signal that the stream suffered an error.
   bool has_error() const { return _error; }; // Has the stream had an error?
 
@@ -32,12 +35,29 @@ protected:
   uint64_t _read_cnt = 0;         // The number of bytes read
   bool _input_ended_flag = false; // Flag indicating that the input has ended
   bool _error = false;            // Flag indicating that the stream suffered an error
+
+  // Zero-copy: the buffers adopted by Writer::push_shared(), and the bytes pushed after them, in stream
+  // order, behind those in _buffer
+  struct Piece
+  {
+    std::shared_ptr<const std::string> shared {}; // an adopted buffer (or null, for bytes owned in `owned`)
+    std::string owned {};
+    uint64_t offset = 0; // bytes of the piece already popped
+
+    std::string_view view() const;
+  };
+  std::deque<Piece> _pieces {};
+  uint64_t _shared_bytes = 0; // bytes buffered in adopted buffers (which don't count against the capacity)
 };
 
 class Writer : public ByteStream
 {
 public:
   void push( std::string data ); // Push data to stream, but only as much as available capacity allows.
+
+  // Push a buffer by reference, without copying it (or limiting it to the available capacity). The buffer
+  // must not change until it has been popped.
+  void push_shared( std::shared_ptr<const std::string> data );
   void close();                  // Signal that the stream has reached its ending. Nothing more will be written.
 
   bool is_closed() const;              // Has the stream been closed?
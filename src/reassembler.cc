@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <iostream>
 #include <set>
+#include <utility>
 
 using namespace std;
 
@@ -11,33 +12,49 @@ void Reassembler::_buffer_erase( const std::set<Segment>::iterator& iter )
   _buffer.erase( iter );
 }
 
-void Reassembler::_buffer_insert( const Segment& seg )
+void Reassembler::_buffer_insert( Segment&& seg )
 {
   _unassembled_bytes += seg.length();
-  _buffer.insert( seg );
+  if ( seg._data.capacity() > 2 * seg.length() ) {
+    // a payload moved out of a read buffer brings that buffer's spare room along: don't hold on to it
+    seg._data.shrink_to_fit();
+  }
+  _buffer.insert( std::move( seg ) );
+}
+
+string Reassembler::_buffer_extract_front()
+{
+  auto node = _buffer.extract( _buffer.begin() );
+  _unassembled_bytes -= node.value().length();
+  return std::move( node.value()._data );
 }
 
 void Reassembler::insert( uint64_t first_index, string data, bool is_last_substring )
 {
   // Your code here.
 
-  // process the input segment
+  const uint64_t last_index = first_index + data.length();
+
+  // process the input segment: the payload is moved (never copied) on its way to the ByteStream
   if ( !data.empty() ) {
-    Segment seg { first_index, data };
-    _handle_substring( seg );
+    if ( first_index == _1st_unassembled_idx() && _buffer.empty() ) {
+      // in-order data with nothing cached goes straight to the stream (which truncates it to the capacity)
+      output_.writer().push( std::move( data ) );
+    } else {
+      Segment seg { first_index, std::move( data ) };
+      _handle_substring( seg );
+    }
   }
 
   // write to 'ByteStream'
   while ( !_buffer.empty() && _buffer.begin()->_idx == _1st_unassembled_idx() ) {
-    const auto& iter = _buffer.begin();
-    output_.writer().push( iter->_data );
-    _buffer_erase( iter );
+    output_.writer().push( _buffer_extract_front() );
   }
 
   // EOF
   if ( is_last_substring ) {
     _is_eof = is_last_substring;
-    _eof_idx = first_index + data.length();
+    _eof_idx = last_index;
   }
   if ( _is_eof && _1st_unassembled_idx() == _eof_idx ) {
     output_.writer().close();
@@ -71,7 +88,7 @@ void Reassembler::_handle_substring( Segment& seg )
    *           unacceptable
    */
   if ( seg._idx < _1st_unacceptable_idx() && seg._idx + seg.length() - 1 >= _1st_unacceptable_idx() ) {
-    seg._data = seg._data.substr( 0, _1st_unacceptable_idx() - seg._idx );
+    seg._data.resize( _1st_unacceptable_idx() - seg._idx );
   }
 
   /**
@@ -99,12 +116,12 @@ void Reassembler::_handle_substring( Segment& seg )
    *        unassembled
    */
   if ( seg._idx < _1st_unassembled_idx() && seg._idx + seg.length() - 1 >= _1st_unassembled_idx() ) {
-    seg._data = seg._data.substr( _1st_unassembled_idx() - seg._idx );
+    seg._data.erase( 0, _1st_unassembled_idx() - seg._idx );
     seg._idx = _1st_unassembled_idx();
   }
 
   if ( _buffer.empty() ) {
-    _buffer_insert( seg );
+    _buffer_insert( std::move( seg ) );
     return;
   }
 
@@ -133,7 +150,7 @@ void Reassembler::_handle_overlapping( Segment& seg )
    *     ┌─────┐  ├─────────┤   ┌────────┐
    *   ──┴─────┴──┴─────────┴───┴────────┴────►
    */
-  _buffer_insert( seg );
+  _buffer_insert( std::move( seg ) );
 }
 
 void Reassembler::_merge_seg( Segment& seg, const Segment& cache )
@@ -155,7 +172,8 @@ void Reassembler::_merge_seg( Segment& seg, const Segment& cache )
    *    segment index   segment tail
    */
   if ( seg._idx < cache._idx && seg_tail <= cache_tail ) {
-    seg._data = seg._data.substr( 0, cache._idx - seg._idx ) + cache._data;
+    seg._data.resize( cache._idx - seg._idx );
+    seg._data += cache._data;
   }
 
   /**
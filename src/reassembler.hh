@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <set>
 #include <string>
+#include <utility>
 
 class Reassembler
 {
@@ -36,6 +37,9 @@ public:
   // How many bytes are stored in the Reassembler itself?
   uint64_t bytes_pending() const;
 
+  // Change the capacity of the output stream (and so the range of acceptable indices)
+  void set_capacity( uint64_t capacity ) { output_.set_capacity( capacity ); }
+
   // Access output stream reader
   Reader& reader() { return output_.reader(); }
   const Reader& reader() const { return output_.reader(); }
@@ -50,7 +54,7 @@ private:
     std::string _data;
 
     Segment() : _idx( 0 ), _data() {}
-    Segment( uint64_t index, const std::string& data ) : _idx( index ), _data( data ) {}
+    Segment( uint64_t index, std::string data ) : _idx( index ), _data( std::move( data ) ) {}
 
     uint64_t length() const { return _data.length(); }
 
@@ -67,8 +71,7 @@ private:
     bool operator<( const Segment& seg ) const { return this->_idx < seg._idx; }
   };
 
-  ByteStream output_;                      // the Reassembler writes to this ByteStream
-  uint64_t _capacity = output_.capacity(); // the capacity of the Reassembler
+  ByteStream output_; // the Reassembler writes to this ByteStream
 
   uint64_t _unassembled_bytes = 0; // unassembled but stored bytes
   bool _is_eof = false;
@@ -76,7 +79,8 @@ private:
 
   std::set<Segment> _buffer {};
   void _buffer_erase( const std::set<Segment>::iterator& iter );
-  void _buffer_insert( const Segment& seg );
+  void _buffer_insert( Segment&& seg );
+  std::string _buffer_extract_front(); // remove the first cached segment, handing back its data
 
   // handle out-of-order and overlapping substrings, try to put them in the cache
   void _handle_substring( Segment& seg );
@@ -87,6 +91,6 @@ private:
   uint64_t _1st_unassembled_idx() const { return output_.writer().bytes_pushed(); } // initial value is 0
   uint64_t _1st_unacceptable_idx() const
   {
-    return _1st_unread_idx() + _capacity;
+    return _1st_unread_idx() + output_.capacity();
   } // inital value is the full capacity of output_
 };
@@ -49,8 +49,8 @@ void Router::route_one_dgram( InternetDatagram& dgram )
     }
   }
 
-  if ( max_matched_entry != _router_table.end() && dgram.header.ttl-- > 1 ) {
-    dgram.header.compute_checksum(); // 大坑
+  if ( max_matched_entry != _router_table.end() && dgram.header.ttl > 1 ) {
+    dgram.header.decrement_ttl(); // 大坑: the checksum has to follow the TTL
     const optional<Address> next_hop = max_matched_entry->next_hop;
     auto& next_interface = _interfaces.at( max_matched_entry->interface_num );
 
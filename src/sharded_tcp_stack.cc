@@ -0,0 +1,252 @@
+#include "sharded_tcp_stack.hh"
+
+#include "exception.hh"
+#include "ipv4_header.hh"
+#include "parser.hh"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace std;
+
+namespace {
+constexpr uint64_t TICK_MS = 10;
+
+uint64_t now_ms()
+{
+  return chrono::duration_cast<chrono::milliseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+} // namespace
+
+ShardedTCPStack::Shard::Shard( ShardedTCPStack& owner, const size_t index, const TCPConfig& config )
+  : owner_( owner )
+  , index_( index )
+  , stack_( config, owner.cookie_secret_ )
+  , wakeup_( CheckSystemCall( "eventfd", ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
+{}
+
+ShardedTCPStack::ShardedTCPStack( const TCPConfig& config, const size_t shard_count )
+{
+  if ( shard_count == 0 ) {
+    throw runtime_error( "ShardedTCPStack: need at least one shard" );
+  }
+  for ( size_t i = 0; i < shard_count; ++i ) {
+    shards_.push_back( make_unique<Shard>( *this, i, config ) );
+  }
+}
+
+ShardedTCPStack::~ShardedTCPStack()
+{
+  try {
+    stop();
+  } catch ( const exception& e ) {
+    cerr << "Exception in ShardedTCPStack shard: " << e.what() << "\n";
+  }
+}
+
+void ShardedTCPStack::listen( const uint16_t port, const size_t backlog, const bool fast_open )
+{
+  if ( running_ ) {
+    throw runtime_error( "ShardedTCPStack: listen() after start()" );
+  }
+  for ( auto& shard : shards_ ) {
+    shard->stack_.listen( port, backlog, fast_open );
+  }
+}
+
+void ShardedTCPStack::start( vector<FileDescriptor> fds, Handler handler )
+{
+  if ( running_ ) {
+    throw runtime_error( "ShardedTCPStack: already started" );
+  }
+  if ( fds.size() != 1 and fds.size() != shards_.size() ) {
+    throw runtime_error( "ShardedTCPStack: need one fd, or one per shard" );
+  }
+
+  for ( auto& shard : shards_ ) {
+    if ( fds.size() == shards_.size() ) {
+      shard->fd_.emplace( std::move( fds.at( shard->index_ ) ) );
+      shard->reads_fd_ = true;
+    } else {
+      // every shard writes to its own descriptor of the shared fd (so that none shares its counters)
+      shard->fd_.emplace( CheckSystemCall( "dup", ::dup( fds.front().fd_num() ) ) );
+      shard->reads_fd_ = shard->index_ == 0;
+    }
+    shard->install();
+  }
+
+  running_ = true;
+  for ( auto& shard : shards_ ) {
+    shard->thread_ = thread( [&shard = *shard, handler] { shard.run( handler ); } );
+  }
+}
+
+void ShardedTCPStack::stop()
+{
+  if ( not running_ ) {
+    return;
+  }
+  stopping_ = true;
+  for ( auto& shard : shards_ ) {
+    shard->wake();
+  }
+  for ( auto& shard : shards_ ) {
+    shard->thread_.join();
+  }
+  running_ = false;
+
+  const lock_guard lock { error_mutex_ };
+  if ( error_ ) {
+    rethrow_exception( exchange( error_, nullptr ) );
+  }
+}
+
+future<FourTuple> ShardedTCPStack::connect( const Address& local, const Address& remote )
+{
+  const FourTuple id { local.ipv4_numeric(), local.port(), remote.ipv4_numeric(), remote.port() };
+
+  // (a failure is the caller's to handle: it must not escape into the shard's loop and stop the shard)
+  auto opened = make_shared<promise<FourTuple>>();
+  post( shard_of( id ), [local, remote, opened]( Shard& shard ) {
+    try {
+      opened->set_value( shard.stack_.connect( local, remote, shard.transmit_ ) );
+    } catch ( ... ) {
+      opened->set_exception( current_exception() );
+    }
+  } );
+  return opened->get_future();
+}
+
+void ShardedTCPStack::post( const size_t shard, Work work )
+{
+  Shard& target = *shards_.at( shard );
+  {
+    const lock_guard lock { target.mailbox_mutex_ };
+    target.mailbox_work_.push_back( std::move( work ) );
+  }
+  target.wake();
+}
+
+vector<ShardedTCPStack::ShardStats> ShardedTCPStack::stats() const
+{
+  vector<ShardStats> ret;
+  for ( const auto& shard : shards_ ) {
+    ret.push_back( { .connections = shard->connections_.load( memory_order_relaxed ),
+                     .datagrams_received = shard->datagrams_received_.load( memory_order_relaxed ),
+                     .datagrams_handed_off = shard->datagrams_handed_off_.load( memory_order_relaxed ),
+                     .wakeups = shard->wakeups_.load( memory_order_relaxed ) } );
+  }
+  return ret;
+}
+
+void ShardedTCPStack::Shard::wake()
+{
+  // (any thread may call this, so bypass the FileDescriptor's unsynchronized write count)
+  const uint64_t one = 1;
+  CheckSystemCall( "write", static_cast<int>( ::write( wakeup_.fd_num(), &one, sizeof( one ) ) ) );
+}
+
+void ShardedTCPStack::Shard::deliver( InternetDatagram dgram )
+{
+  // a datagram that belongs to another shard goes to its mailbox
+  const auto id = TCPStack::four_tuple_of( dgram );
+  if ( not id.has_value() ) {
+    return;
+  }
+  const size_t home = owner_.shard_of( id.value() );
+  if ( home != index_ ) {
+    datagrams_handed_off_.fetch_add( 1, memory_order_relaxed );
+    Shard& target = *owner_.shards_.at( home );
+    {
+      const lock_guard lock { target.mailbox_mutex_ };
+      target.mailbox_datagrams_.push_back( std::move( dgram ) );
+    }
+    target.wake();
+    return;
+  }
+
+  datagrams_received_.fetch_add( 1, memory_order_relaxed );
+  stack_.receive( std::move( dgram ), transmit_ );
+}
+
+void ShardedTCPStack::Shard::receive_mail()
+{
+  vector<InternetDatagram> datagrams;
+  vector<Work> work;
+  {
+    const lock_guard lock { mailbox_mutex_ };
+    swap( datagrams, mailbox_datagrams_ );
+    swap( work, mailbox_work_ );
+  }
+
+  for ( auto& dgram : datagrams ) {
+    datagrams_received_.fetch_add( 1, memory_order_relaxed );
+    stack_.receive( std::move( dgram ), transmit_ );
+  }
+  for ( const auto& item : work ) {
+    item( *this );
+  }
+}
+
+void ShardedTCPStack::Shard::install()
+{
+  FileDescriptor& fd = fd_.value();
+  transmit_ = [&fd]( const InternetDatagram& dgram ) { fd.write( serialize( dgram ) ); };
+
+  loop_.set_dispatch( EventLoop::Dispatch::AllReady );
+
+  loop_.add_rule( "shard mailbox", wakeup_, Direction::In, [this] {
+    string count( sizeof( uint64_t ), 0 );
+    wakeup_.read( count );
+    receive_mail();
+  } );
+
+  if ( reads_fd_ ) {
+    loop_.add_rule( "receive datagram for the shard", fd, Direction::In, [this, &fd] {
+      vector<string> strs( 2 );
+      strs.front().resize( IPv4Header::LENGTH );
+      fd.read( strs );
+
+      InternetDatagram dgram;
+      if ( parse( dgram, std::move( strs ) ) ) {
+        deliver( std::move( dgram ) );
+      }
+    } );
+  }
+
+  auto last_tick = make_shared<uint64_t>( now_ms() );
+  loop_.add_timer(
+    "tick shard",
+    chrono::milliseconds( TICK_MS ),
+    [this, last_tick] {
+      const uint64_t now = now_ms();
+      stack_.tick( now - *last_tick, transmit_ );
+      *last_tick = now;
+    },
+    chrono::milliseconds( TICK_MS ) );
+}
+
+void ShardedTCPStack::Shard::run( const Handler& handler )
+{
+  try {
+    while ( not owner_.stopping_ ) {
+      loop_.wait_next_event( -1 );
+      handler( *this );
+      connections_.store( stack_.connection_count(), memory_order_relaxed );
+      wakeups_.fetch_add( 1, memory_order_relaxed );
+    }
+  } catch ( ... ) {
+    {
+      const lock_guard lock { owner_.error_mutex_ };
+      if ( not owner_.error_ ) {
+        owner_.error_ = current_exception();
+      }
+    }
+    // (the others carry on until stop())
+  }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "ipv4_datagram.hh"
+#include "tcp_config.hh"
+#include "tcp_stack.hh"
+
+// \brief A TCP stack spread over N worker threads ("shards"), one per core.
+//
+// Each shard owns an EventLoop, a TCPStack holding its share of the connections, and a datagram fd. A
+// connection belongs to the shard its four-tuple hashes to, so the shards share nothing while they
+// process segments. Given one fd per shard (e.g. the queues of a multi-queue TUN device, steered by flow),
+// each shard reads its own; a datagram that arrives at the wrong shard is handed to the right one
+// through that shard's mailbox. Given a single fd, shard 0 reads it and hands every datagram on. (The
+// only state the shards' TCPStacks have in common is the cookie secret, written once before they start:
+// a client's next connection usually lands on another shard, and its Fast Open cookie must still work.)
+//
+// The application runs on the shards too: the Handler is called on a shard's thread after each batch
+// of events, to accept its connections and read and write on them.
+class ShardedTCPStack
+{
+public:
+  class Shard;
+
+  // Called on a shard's thread after each batch of events
+  using Handler = std::function<void( Shard& shard )>;
+
+  // Work posted to a shard's thread
+  using Work = std::function<void( Shard& shard )>;
+
+  // Load of one shard
+  struct ShardStats
+  {
+    size_t connections {};            // connections the shard holds
+    uint64_t datagrams_received {};   // datagrams given to the shard's TCPStack
+    uint64_t datagrams_handed_off {}; // datagrams read by this shard but belonging to another
+    uint64_t wakeups {};              // batches of events the shard has served
+  };
+
+  // One worker thread and its connections. Only used on its own thread (through the Handler or post()).
+  class Shard
+  {
+  public:
+    TCPStack& stack() { return stack_; }
+    size_t index() const { return index_; }
+
+    // Send what the application has written to a connection
+    void push( const FourTuple& id ) { stack_.push( id, transmit_ ); }
+
+    Shard( ShardedTCPStack& owner, size_t index, const TCPConfig& config );
+
+  private:
+    friend class ShardedTCPStack;
+
+    ShardedTCPStack& owner_;
+    size_t index_;
+    TCPStack stack_;
+    EventLoop loop_ { EventLoop::Backend::Epoll };
+
+    std::optional<FileDescriptor> fd_ {}; // where the shard writes (and reads, if reads_fd_)
+    bool reads_fd_ {};
+    TCPStack::TransmitFunction transmit_ {};
+    FileDescriptor wakeup_; // eventfd: the mailbox has mail, or the shard should stop
+
+    // The mailbox: datagrams and work from other threads
+    std::mutex mailbox_mutex_ {};
+    std::vector<InternetDatagram> mailbox_datagrams_ {};
+    std::vector<Work> mailbox_work_ {};
+
+    std::atomic<size_t> connections_ {};
+    std::atomic<uint64_t> datagrams_received_ {};
+    std::atomic<uint64_t> datagrams_handed_off_ {};
+    std::atomic<uint64_t> wakeups_ {};
+
+    std::thread thread_ {};
+
+    void wake();
+    void deliver( InternetDatagram dgram );
+    void receive_mail();
+    void install();
+    void run( const Handler& handler );
+  };
+
+  ShardedTCPStack( const TCPConfig& config, size_t shard_count );
+
+  // Stops the shards (if running)
+  ~ShardedTCPStack();
+
+  // Accept connections to `port` on every shard (before start())
+  void listen( uint16_t port, size_t backlog = TCPStack::DEFAULT_BACKLOG, bool fast_open = false );
+
+  // Start the shards, reading and writing IPv4 datagrams (one per read or write) on `fds`: either one fd
+  // per shard, or a single fd for all of them
+  void start( std::vector<FileDescriptor> fds, Handler handler );
+
+  // Stop the shards and wait for them to finish (rethrows an exception from a shard)
+  void stop();
+
+  // Open a connection from `local` to `remote`, on the shard it belongs to (the future holds its id once the
+  // SYN is sent, or the exception if the connection can't be opened, e.g. because it already exists)
+  std::future<FourTuple> connect( const Address& local, const Address& remote );
+
+  // Run `work` on a shard's thread
+  void post( size_t shard, Work work );
+
+  size_t shard_count() const { return shards_.size(); }
+  size_t shard_of( const FourTuple& id ) const { return FourTupleHash {}( id ) % shards_.size(); }
+
+  // Snapshot of each shard's load (safe to call while the shards run)
+  std::vector<ShardStats> stats() const;
+
+  // The shards refer to the stack
+  ShardedTCPStack( const ShardedTCPStack& other ) = delete;
+  ShardedTCPStack& operator=( const ShardedTCPStack& other ) = delete;
+  ShardedTCPStack( ShardedTCPStack&& other ) = delete;
+  ShardedTCPStack& operator=( ShardedTCPStack&& other ) = delete;
+
+private:
+  TCPStack::Key cookie_secret_ { TCPStack::random_key() }; // shared by every shard's TCPStack
+  std::vector<std::unique_ptr<Shard>> shards_ {};
+  std::atomic<bool> stopping_ {};
+  bool running_ {};
+
+  std::mutex error_mutex_ {};
+  std::exception_ptr error_ {}; // first exception thrown on a shard
+};
@@ -1,5 +1,6 @@
 #include "tcp_minnow_socket_impl.hh"
 
-//! Specializations of TCPMinnowSocket for TCPOverIPv4OverTunFdAdapter and its lossy version
+//! Specializations of TCPMinnowSocket for TCPOverIPv4OverTunFdAdapter and its lossy version, and TCPOverUDPAdapter
 template class TCPMinnowSocket<TCPOverIPv4OverTunFdAdapter>;
 template class TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
+template class TCPMinnowSocket<TCPOverUDPAdapter>;
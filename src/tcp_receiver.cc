@@ -4,6 +4,9 @@
 #include "wrapping_integers.hh"
 #include <cstdint>
 #include <optional>
+#include <span>
+#include <string>
+#include <utility>
 
 using namespace std;
 
@@ -16,7 +19,7 @@ using namespace std;
  *        3) FIN_RECV, FIN packet has arrived, determined by the _set_fin_flag
  * @param message TCP packet
  */
-void TCPReceiver::receive( TCPSenderMessage message )
+void TCPReceiver::receive( TCPSenderMessage message, span<string> more_payloads )
 {
   // process the RST flag within the message
   if ( message.RST ) {
@@ -38,8 +41,35 @@ void TCPReceiver::receive( TCPSenderMessage message )
   uint64_t checkpoint = reassembler_.writer().bytes_pushed() + 1; // the index of the first unassembled byte
   uint64_t curr_abs_seqno = message.seqno.unwrap( _isn, checkpoint );
 
+  // PAWS: a segment carrying an older timestamp than TS.Recent is an old duplicate, even if its
+  // (wrapped) sequence number looks acceptable
+  if ( message.TSval.has_value() ) {
+    if ( _ts_recent.has_value() and not message.SYN
+         and static_cast<int32_t>( message.TSval.value() - _ts_recent.value() ) < 0 ) {
+      ++_paws_rejected;
+      return;
+    }
+    // remember the timestamp of a segment that starts at or before the last ackno sent (RFC 7323 4.3)
+    if ( message.SYN
+         or ( _last_ack_sent.has_value() and curr_abs_seqno <= _last_ack_sent->unwrap( _isn, checkpoint ) ) ) {
+      _ts_recent = message.TSval;
+    }
+  }
+
   uint64_t stream_idx = curr_abs_seqno - 1 + message.SYN;
-  reassembler_.insert( stream_idx, message.payload, message.FIN );
+  if ( more_payloads.empty() ) {
+    reassembler_.insert( stream_idx, std::move( message.payload ), message.FIN );
+    return;
+  }
+
+  // a merged segment: its payloads follow each other, and only the last one can end the stream
+  uint64_t next_idx = stream_idx + message.payload.size();
+  reassembler_.insert( stream_idx, std::move( message.payload ), false );
+  for ( size_t i = 0; i < more_payloads.size(); ++i ) {
+    const uint64_t first_index = next_idx;
+    next_idx += more_payloads[i].size();
+    reassembler_.insert( first_index, std::move( more_payloads[i] ), message.FIN and i + 1 == more_payloads.size() );
+  }
 }
 
 optional<Wrap32> TCPReceiver::ackno() const
@@ -62,13 +92,17 @@ TCPReceiverMessage TCPReceiver::send() const
 {
   TCPReceiverMessage RECVMessage {};
 
-  RECVMessage.window_size = reassembler_.writer().available_capacity() >= UINT16_MAX
-                              ? UINT16_MAX
+  // the window field is 16 bits on the wire, scaled by the negotiated shift count
+  const uint64_t max_window = static_cast<uint64_t>( UINT16_MAX ) << _window_shift;
+  RECVMessage.window_size = reassembler_.writer().available_capacity() >= max_window
+                              ? max_window
                               : reassembler_.writer().available_capacity();
 
   RECVMessage.RST = reassembler_.writer().has_error() ? true : false;
 
   RECVMessage.ackno = ackno();
 
+  RECVMessage.TSecr = _ts_recent;
+
   return RECVMessage;
 }
@@ -4,7 +4,10 @@
 #include "tcp_receiver_message.hh"
 #include "tcp_sender_message.hh"
 #include "wrapping_integers.hh"
+#include <cstdint>
 #include <optional>
+#include <span>
+#include <string>
 
 class TCPReceiver
 {
@@ -15,12 +18,27 @@ public:
   /*
    * The TCPReceiver receives TCPSenderMessages, inserting their payload into the Reassembler
    * at the correct stream index.
+   *
+   * A message merged from consecutive segments carries the payloads of the later ones in
+   * `more_payloads` (which are moved into the Reassembler in turn, each at its own index).
    */
-  void receive( TCPSenderMessage message );
+  void receive( TCPSenderMessage message, std::span<std::string> more_payloads = {} );
 
   // The TCPReceiver sends TCPReceiverMessages to the peer's TCPSender.
   TCPReceiverMessage send() const;
 
+  // Allow advertising windows up to UINT16_MAX << shift (once window scaling has been negotiated)
+  void set_window_shift( uint8_t shift ) { _window_shift = shift; }
+
+  // The ackno the receiver would send now has been sent to the peer (Last.ACK.sent of RFC 7323)
+  void ack_sent() { _last_ack_sent = ackno(); }
+
+  // How many segments has PAWS discarded? (each one should be answered with an ACK)
+  uint64_t paws_rejected() const { return _paws_rejected; }
+
+  // Resize the receive buffer (and so the window that is advertised)
+  void set_capacity( uint64_t capacity ) { reassembler_.set_capacity( capacity ); }
+
   // Access the output (only Reader is accessible non-const)
   const Reassembler& reassembler() const { return reassembler_; }
   Reader& reader() { return reassembler_.reader(); }
@@ -31,6 +49,12 @@ private:
   Reassembler reassembler_;
   Wrap32 _isn { 0 };
   bool _set_syn_flag = false;
+  uint8_t _window_shift = 0;
+
+  // TS.Recent (RFC 7323): the timestamp to echo back, also used to reject old duplicates (PAWS)
+  std::optional<uint32_t> _ts_recent {};
+  std::optional<Wrap32> _last_ack_sent {};
+  uint64_t _paws_rejected {};
   // bool _rst = false;
 
   std::optional<Wrap32> ackno() const;
@@ -10,6 +10,9 @@
 #include <cstddef>
 #include <cstdint>
 #include <ctime>
+#include <memory>
+#include <string>
+#include <utility>
 
 using namespace std;
 
@@ -27,10 +30,75 @@ uint64_t TCPSender::consecutive_retransmissions() const
   return _consecutive_retxs;
 }
 
+optional<uint64_t> TCPSender::smoothed_rtt() const
+{
+  return _srtt_ms;
+}
+
+uint64_t TCPSender::current_RTO() const
+{
+  return _RTO_ms;
+}
+
+uint64_t TCPSender::peer_window() const
+{
+  return _primitive_window_size;
+}
+
+uint64_t TCPSender::bytes_acked() const
+{
+  return _bytes_acked;
+}
+
+uint64_t TCPSender::retransmissions() const
+{
+  return _total_retxs;
+}
+
+optional<uint64_t> TCPSender::next_deadline() const
+{
+  if ( !_isStartTimer ) {
+    return {};
+  }
+  return max( _cur_RTO_ms, 0 );
+}
+
+// RFC 6298, section 2: SRTT <- 7/8 SRTT + 1/8 R', RTTVAR <- 3/4 RTTVAR + 1/4 |SRTT - R'|, RTO <- SRTT + 4 RTTVAR
+void TCPSender::_update_rtt( uint64_t sample_ms )
+{
+  if ( !_srtt_ms.has_value() ) {
+    _srtt_ms = sample_ms;
+    _rttvar_ms = sample_ms / 2;
+  } else {
+    const uint64_t srtt = _srtt_ms.value();
+    const uint64_t delta = srtt > sample_ms ? srtt - sample_ms : sample_ms - srtt;
+    _rttvar_ms = ( 3 * _rttvar_ms + delta ) / 4;
+    _srtt_ms = ( 7 * srtt + sample_ms ) / 8;
+  }
+
+  _RTO_ms = max( TCPConfig::MIN_RTO_MS, _srtt_ms.value() + max( uint64_t { 1 }, 4 * _rttvar_ms ) );
+}
+
+uint64_t TCPSender::_send_window() const
+{
+  if ( !_is_syned && _fast_open ) {
+    return 1 + TCPConfig::MAX_PAYLOAD_SIZE;
+  }
+  return _receiverMsg.window_size;
+}
+
 void TCPSender::push( const TransmitFunction& transmit )
 {
+  // the peer acknowledged our SYN but not the data it carried: send that data again right away
+  if ( _resend_syn_data ) {
+    _resend_syn_data = false;
+    transmit( _outstanding_segments.front() );
+    _total_retxs++;
+  }
+
   // fill the window
-  while ( _outstanding_bytes < _receiverMsg.window_size ) {
+  while ( _outstanding_bytes < _send_window() ) {
+    const uint64_t window = _send_window();
     TCPSenderMessage msg;
 
     if ( input_.has_error() ) {
@@ -46,7 +114,7 @@ void TCPSender::push( const TransmitFunction& transmit )
     msg.seqno = Wrap32::wrap( _abs_seqno, isn_ );
 
     // 2.set the length of bytestream that can be read
-    size_t len = min( min( static_cast<size_t>( _receiverMsg.window_size - _outstanding_bytes - msg.SYN ),
+    size_t len = min( min( static_cast<size_t>( window - _outstanding_bytes - msg.SYN ),
                            TCPConfig::MAX_PAYLOAD_SIZE ),
                       static_cast<size_t>( reader().bytes_buffered() ) );
 
@@ -54,7 +122,7 @@ void TCPSender::push( const TransmitFunction& transmit )
     read( input_.reader(), len, msg.payload );
 
     // 4.check if eof of the input ByteStream, and is there still extra window size for adding the FIN flag
-    if ( reader().is_finished() && msg.sequence_length() + _outstanding_bytes < _receiverMsg.window_size ) {
+    if ( reader().is_finished() && msg.sequence_length() + _outstanding_bytes < window ) {
       if ( !_is_fin ) {
         _is_fin = true;
         msg.FIN = true;
@@ -81,6 +149,14 @@ void TCPSender::push( const TransmitFunction& transmit )
   }
 }
 
+void TCPSender::send_zero_copy( shared_ptr<const string> data, function<void()> on_acked )
+{
+  input_.writer().push_shared( std::move( data ) );
+  if ( on_acked ) {
+    _zero_copy_completions.emplace_back( input_.writer().bytes_pushed(), std::move( on_acked ) );
+  }
+}
+
 // send_empty_message函数意思是发一个消息，告诉接收器，发送者这边的abs_seqno到哪里了。
 TCPSenderMessage TCPSender::make_empty_message() const
 {
@@ -118,6 +194,7 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
     if ( msg.ackno.value().unwrap( isn_, _abs_seqno ) > _abs_seqno ) {
       return;
     }
+    bool acked_new_data = false;
     // 删除任何现在已经完全确认的段
     while ( _outstanding_bytes != 0
             && _outstanding_segments.front().seqno.unwrap( isn_, _abs_seqno )
@@ -126,6 +203,7 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
 
       // 当ackno越过“已发送但未确认”队列中某个元素的右边界时，删除这个元素
       _outstanding_bytes -= _outstanding_segments.front().sequence_length();
+      _bytes_acked += _outstanding_segments.front().payload.size();
       _outstanding_segments.pop_front();
 
       // 有未完成的段被确认时，(即outstanding集合发生pop)才会设置RTO
@@ -136,8 +214,35 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
         _isStartTimer = true;
       }
       _consecutive_retxs = 0;
+      acked_new_data = true;
+    }
+
+    // TCP Fast Open: a server that didn't accept the data on our SYN acknowledges the SYN alone.
+    // Turn the rest of that segment into ordinary data, and let push() send it again without waiting.
+    if ( _outstanding_bytes != 0 && _outstanding_segments.front().SYN && msg.ackno.value() == isn_ + 1 ) {
+      TCPSenderMessage& front = _outstanding_segments.front();
+      front.SYN = false;
+      front.seqno = isn_ + 1;
+      _outstanding_bytes -= 1;
+      _resend_syn_data = true;
+      _consecutive_retxs = 0;
+      acked_new_data = true;
+    }
 
-      _cur_RTO_ms = initial_RTO_ms_;
+    // The echoed timestamp tells exactly when the acknowledged (re)transmission left, so every
+    // acknowledgment of new data is a valid RTT sample, even after a retransmission.
+    if ( acked_new_data && msg.TSecr.has_value() ) {
+      _update_rtt( static_cast<uint32_t>( _time_ms ) - msg.TSecr.value() );
+    }
+    if ( acked_new_data ) {
+      _cur_RTO_ms = _RTO_ms;
+    }
+
+    // the zero-copy buffers that have been acknowledged in full are the application's again
+    while ( !_zero_copy_completions.empty() && _zero_copy_completions.front().first <= _bytes_acked ) {
+      const auto on_acked = std::move( _zero_copy_completions.front().second );
+      _zero_copy_completions.pop_front();
+      on_acked();
     }
   }
 }
@@ -145,6 +250,8 @@ void TCPSender::receive( const TCPReceiverMessage& msg )
 void TCPSender::tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit )
 {
   // Your code here.
+  _time_ms += ms_since_last_tick;
+
   if ( _isStartTimer ) {
     _cur_RTO_ms -= ms_since_last_tick;
   }
@@ -154,11 +261,12 @@ void TCPSender::tick( uint64_t ms_since_last_tick, const TransmitFunction& trans
     _segment_out.push_front( _outstanding_segments.front() );
     transmit( _segment_out.front() );
     _consecutive_retxs++;
+    _total_retxs++;
 
     if ( _primitive_window_size > 0 ) {
-      _cur_RTO_ms = pow( 2, _consecutive_retxs ) * initial_RTO_ms_;
+      _cur_RTO_ms = pow( 2, _consecutive_retxs ) * _RTO_ms;
     } else {
-      _cur_RTO_ms = initial_RTO_ms_;
+      _cur_RTO_ms = _RTO_ms;
     }
   }
 }
@@ -7,7 +7,9 @@
 #include <cstdint>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <string>
 #include <utility>
 
 class TCPSender
@@ -36,9 +38,22 @@ public:
   /* Time has passed by the given # of milliseconds since the last time the tick() method was called */
   void tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit );
 
+  /* Zero-copy send: queue `data` on the outbound stream by reference (see Writer::push_shared), to be cut into
+     segments directly, and call `on_acked` once the receiver has acknowledged its last byte */
+  void send_zero_copy( std::shared_ptr<const std::string> data, std::function<void()> on_acked );
+
+  /* TCP Fast Open (RFC 7413): let the SYN carry up to one segment of data, before the peer's window is known */
+  void enable_fast_open() { _fast_open = true; }
+
   // Accessors
-  uint64_t sequence_numbers_in_flight() const;  // How many sequence numbers are outstanding?
-  uint64_t consecutive_retransmissions() const; // How many consecutive *re*transmissions have happened?
+  uint64_t sequence_numbers_in_flight() const;   // How many sequence numbers are outstanding?
+  uint64_t consecutive_retransmissions() const;  // How many consecutive *re*transmissions have happened?
+  std::optional<uint64_t> smoothed_rtt() const;  // SRTT in milliseconds, once an RTT sample has been taken
+  uint64_t current_RTO() const;                  // Retransmission timeout in milliseconds (before backoff)
+  uint64_t peer_window() const;                  // Window most recently advertised by the receiver
+  uint64_t bytes_acked() const;                  // Payload bytes cumulatively acknowledged
+  uint64_t retransmissions() const;              // Total number of retransmitted segments
+  std::optional<uint64_t> next_deadline() const; // Milliseconds until the retransmission timer expires, if running
   Writer& writer() { return input_.writer(); }
   const Writer& writer() const { return input_.writer(); }
 
@@ -53,6 +68,17 @@ private:
 
   int _cur_RTO_ms = initial_RTO_ms_;
 
+  // RTT estimation (RFC 6298), fed by the echoed timestamps of acknowledgments (RFC 7323)
+  uint64_t _RTO_ms = initial_RTO_ms_;
+  std::optional<uint64_t> _srtt_ms {};
+  uint64_t _rttvar_ms { 0 };
+  uint64_t _time_ms { 0 }; // time since the sender was constructed; the clock of the timestamps option
+
+  void _update_rtt( uint64_t sample_ms );
+
+  // How many sequence numbers may be outstanding right now?
+  uint64_t _send_window() const;
+
   bool _isStartTimer { false };
 
   // 记录现在接收器返回给发送器的最新消息
@@ -66,6 +92,13 @@ private:
 
   // 重传次数
   uint32_t _consecutive_retxs { 0 };
+  uint64_t _total_retxs { 0 };
+
+  // 已被确认的负载字节数
+  uint64_t _bytes_acked { 0 };
+
+  // Completions of zero-copy sends, in stream order: the stream offset just past each buffer, and its callback
+  std::deque<std::pair<uint64_t, std::function<void()>>> _zero_copy_completions {};
 
   // 已发送但未被确认的字节流的长度
   uint64_t _outstanding_bytes { 0 };
@@ -73,11 +106,15 @@ private:
   // 记录push时，每一段的绝对序列号
   uint64_t _abs_seqno { 0 };
 
-  uint16_t _primitive_window_size { 1 };
+  uint32_t _primitive_window_size { 1 };
 
   // whether syned
   bool _is_syned { false };
 
   // whether finish
   bool _is_fin { false };
+
+  // TCP Fast Open: may the SYN carry data, and must data the peer didn't accept on the SYN go out again?
+  bool _fast_open { false };
+  bool _resend_syn_data { false };
 };
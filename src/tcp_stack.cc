@@ -0,0 +1,514 @@
+#include "tcp_stack.hh"
+
+#include "exception.hh"
+#include "ipv4_header.hh"
+#include "parser.hh"
+#include "tcp_segment.hh"
+
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/random.h>
+
+using namespace std;
+
+namespace {
+constexpr uint64_t TICK_MS = 10;
+
+// The window scales a SYN cookie can remember (rounded down, which only makes us underestimate the
+// peer's window); code 0 means the peer didn't offer the option
+constexpr array<uint8_t, 8> COOKIE_WSCALES { 0, 0, 2, 4, 6, 7, 8, 14 };
+
+uint64_t now_ms()
+{
+  return chrono::duration_cast<chrono::milliseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// Access to the raw value of a sequence number (as TCPSegment does when serializing)
+class Wrap32Raw : public Wrap32
+{
+public:
+  explicit Wrap32Raw( Wrap32 w ) : Wrap32( w ) {}
+  uint32_t raw_value() const { return raw_value_; }
+};
+
+// splitmix64 finalizer
+uint64_t mix( uint64_t x )
+{
+  x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+  return x ^ ( x >> 31 );
+}
+
+// SipHash-2-4 (Aumasson and Bernstein) of a message of 64-bit words, the keyed PRF behind cookies and ISNs
+uint64_t siphash( const TCPStack::Key& key, initializer_list<uint64_t> words )
+{
+  uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+  const auto round = [&] {
+    v0 += v1;
+    v1 = rotl( v1, 13 ) ^ v0;
+    v0 = rotl( v0, 32 );
+    v2 += v3;
+    v3 = rotl( v3, 16 ) ^ v2;
+    v0 += v3;
+    v3 = rotl( v3, 21 ) ^ v0;
+    v2 += v1;
+    v1 = rotl( v1, 17 ) ^ v2;
+    v2 = rotl( v2, 32 );
+  };
+  const auto compress = [&]( uint64_t m ) {
+    v3 ^= m;
+    round();
+    round();
+    v0 ^= m;
+  };
+
+  for ( const uint64_t m : words ) {
+    compress( m );
+  }
+  compress( static_cast<uint64_t>( 8 * words.size() ) << 56 );
+  v2 ^= 0xff;
+  for ( int i = 0; i < 4; ++i ) {
+    round();
+  }
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// The four-tuple as two words of hash input
+uint64_t addresses_of( const FourTuple& id )
+{
+  return static_cast<uint64_t>( id.local_ip ) << 32 | id.remote_ip;
+}
+
+uint64_t ports_of( const FourTuple& id )
+{
+  return static_cast<uint64_t>( id.local_port ) << 16 | id.remote_port;
+}
+} // namespace
+
+TCPStack::Key TCPStack::random_key()
+{
+  Key key {};
+  auto* const bytes = reinterpret_cast<char*>( key.data() ); // NOLINT(*-reinterpret-cast)
+  size_t filled = 0;
+  while ( filled < sizeof( key ) ) {
+    const ssize_t n = ::getrandom( bytes + filled, sizeof( key ) - filled, 0 );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      throw unix_error { "getrandom" };
+    }
+    filled += n;
+  }
+  return key;
+}
+
+size_t FourTupleHash::operator()( const FourTuple& id ) const
+{
+  // mix the 96 bits of the tuple into one word
+  const uint64_t x = ( static_cast<uint64_t>( id.local_ip ) << 32 ) | id.remote_ip;
+  return mix( x ^ ( static_cast<uint64_t>( id.local_port ) << 16 | id.remote_port ) * 0x9e3779b97f4a7c15ULL );
+}
+
+void TCPStack::listen( uint16_t port, size_t backlog, bool fast_open )
+{
+  listeners_[port].backlog = backlog;
+  listeners_[port].fast_open = fast_open;
+}
+
+FourTuple TCPStack::connect( const Address& local, const Address& remote, const TransmitFunction& transmit )
+{
+  const FourTuple id { local.ipv4_numeric(), local.port(), remote.ipv4_numeric(), remote.port() };
+  if ( connections_.contains( id ) ) {
+    throw runtime_error( "TCPStack::connect: connection already exists to " + remote.to_string() );
+  }
+
+  add_connection( id, isn_for( id ) ).push( transmit_for( id, transmit ) );
+  return id;
+}
+
+FourTuple TCPStack::connect_with_data( const Address& local,
+                                       const Address& remote,
+                                       string_view data,
+                                       const TransmitFunction& transmit )
+{
+  const FourTuple id { local.ipv4_numeric(), local.port(), remote.ipv4_numeric(), remote.port() };
+  if ( connections_.contains( id ) ) {
+    throw runtime_error( "TCPStack::connect_with_data: connection already exists to " + remote.to_string() );
+  }
+
+  const auto cached = fast_open_cookies_.find( id.remote_ip );
+  TCPPeer& peer
+    = add_connection( id, isn_for( id ), cached != fast_open_cookies_.end() ? cached->second : string {} );
+  peer.outbound_writer().push( string { data } );
+  peer.push( transmit_for( id, transmit ) );
+  return id;
+}
+
+optional<FourTuple> TCPStack::accept()
+{
+  if ( accept_queue_.empty() ) {
+    return {};
+  }
+  const FourTuple id = accept_queue_.front();
+  accept_queue_.pop();
+  unaccepted_.erase( id );
+
+  auto listener = listeners_.find( id.local_port );
+  if ( listener != listeners_.end() and listener->second.accept_pending > 0 ) {
+    --listener->second.accept_pending;
+  }
+  return id;
+}
+
+void TCPStack::receive( InternetDatagram dgram, const TransmitFunction& transmit )
+{
+  if ( dgram.header.proto != IPv4Header::PROTO_TCP ) {
+    return;
+  }
+
+  TCPSegment seg;
+  if ( not parse( seg, std::move( dgram.payload ), dgram.header.pseudo_checksum() ) ) {
+    return;
+  }
+
+  const FourTuple id { dgram.header.dst, seg.udinfo.dst_port, dgram.header.src, seg.udinfo.src_port };
+  auto it = connections_.find( id );
+  if ( it != connections_.end() ) {
+    const bool syn = seg.message.sender.SYN;
+    it->second.receive( std::move( seg.message ), transmit_for( id, transmit ) );
+
+    // remember a Fast Open cookie that a server granted us
+    if ( syn and it->second.fast_open_cookie().has_value() ) {
+      fast_open_cookies_[id.remote_ip] = it->second.fast_open_cookie().value();
+    }
+    return;
+  }
+
+  // otherwise, the segment must be part of a handshake with a listening port
+  auto listener = listeners_.find( id.local_port );
+  const TCPMessage& msg = seg.message;
+  if ( listener == listeners_.end() or msg.sender.RST or msg.receiver.RST ) {
+    return;
+  }
+  if ( msg.sender.SYN and not msg.receiver.ackno.has_value() ) {
+    receive_syn( id, std::move( seg.message ), listener->second, transmit );
+  } else if ( not msg.sender.SYN and msg.receiver.ackno.has_value() ) {
+    receive_handshake_ack( id, std::move( seg.message ), listener->second, transmit );
+  }
+}
+
+optional<FourTuple> TCPStack::four_tuple_of( const InternetDatagram& dgram )
+{
+  if ( dgram.header.proto != IPv4Header::PROTO_TCP ) {
+    return {};
+  }
+
+  // the ports are the first four bytes of the segment (which may span buffers)
+  array<uint8_t, 4> ports {};
+  size_t filled = 0;
+  for ( const auto& buffer : dgram.payload ) {
+    for ( size_t i = 0; i < buffer.size() and filled < ports.size(); ++i ) {
+      ports.at( filled++ ) = static_cast<uint8_t>( buffer[i] );
+    }
+  }
+  if ( filled < ports.size() ) {
+    return {};
+  }
+
+  return FourTuple { .local_ip = dgram.header.dst,
+                     .local_port = static_cast<uint16_t>( ports[2] << 8 | ports[3] ),
+                     .remote_ip = dgram.header.src,
+                     .remote_port = static_cast<uint16_t>( ports[0] << 8 | ports[1] ) };
+}
+
+void TCPStack::receive_syn( const FourTuple& id,
+                            TCPMessage syn,
+                            Listener& listener,
+                            const TransmitFunction& transmit )
+{
+  // a retransmitted SYN gets the same SYN-ACK again
+  if ( auto it = syn_queue_.find( id ); it != syn_queue_.end() ) {
+    send_syn_ack( id, it->second, transmit );
+    return;
+  }
+
+  // Fast Open: a valid cookie skips the SYN queue, and the new peer takes the data on the SYN
+  const bool fast_open = listener.fast_open and syn.sender.fast_open_cookie.has_value();
+  if ( fast_open and syn.sender.fast_open_cookie.value() == fast_open_cookie_for( id.remote_ip )
+       and listener.accept_pending < listener.backlog ) {
+    add_connection( id, isn_for( id ) ).receive( std::move( syn ), transmit_for( id, transmit ) );
+    queue_for_accept( id, listener );
+    ++fast_open_accepted_;
+    return;
+  }
+
+  // (otherwise, a cookie request or a stale cookie is answered with a fresh cookie, and any data ignored)
+  HalfOpen entry { .peer_isn = syn.sender.seqno,
+                   .isn = Wrap32 { 0 },
+                   .peer_window_scale = syn.receiver.window_scale,
+                   .peer_timestamp = syn.sender.TSval,
+                   .expires_ms = time_ms_ + SYN_RCVD_TIMEOUT_MS,
+                   .grant_fast_open_cookie = fast_open };
+
+  if ( listener.half_open < listener.backlog ) {
+    entry.isn = isn_for( id );
+    syn_queue_.emplace( id, entry );
+    ++listener.half_open;
+  } else {
+    // SYN queue overflow: remember nothing, and let the ISN carry the state instead
+    entry.isn = make_cookie( id, entry );
+    ++syn_cookies_sent_;
+  }
+  send_syn_ack( id, entry, transmit );
+}
+
+void TCPStack::receive_handshake_ack( const FourTuple& id,
+                                      TCPMessage ack,
+                                      Listener& listener,
+                                      const TransmitFunction& transmit )
+{
+  auto it = syn_queue_.find( id );
+  optional<HalfOpen> entry;
+  if ( it != syn_queue_.end() ) {
+    if ( ack.receiver.ackno != it->second.isn + 1 ) {
+      return;
+    }
+    entry = it->second;
+  } else {
+    entry = check_cookie( id, ack );
+    if ( not entry.has_value() ) {
+      return;
+    }
+  }
+
+  // accept queue overflow: ignore the ACK (the peer will retransmit, and may find room then)
+  if ( listener.accept_pending >= listener.backlog ) {
+    return;
+  }
+
+  if ( it != syn_queue_.end() ) {
+    syn_queue_.erase( it );
+    --listener.half_open;
+  } else {
+    ++syn_cookies_accepted_;
+  }
+
+  // Bring a new TCPPeer up to date by replaying the SYN it would have seen (it regenerates the same
+  // SYN-ACK, which was already sent), then give it the ACK.
+  TCPPeer& peer = add_connection( id, entry->isn );
+  TCPMessage syn;
+  syn.sender.SYN = true;
+  syn.sender.seqno = entry->peer_isn;
+  syn.sender.TSval = ack.sender.TSval;
+  syn.receiver.window_scale = entry->peer_window_scale;
+  peer.receive( std::move( syn ), []( const TCPMessage& ) {} );
+
+  // our SYN-ACK was stamped by the stack rather than by the new peer's clock, so its echo is no RTT sample
+  ack.receiver.TSecr.reset();
+  peer.receive( std::move( ack ), transmit_for( id, transmit ) );
+
+  queue_for_accept( id, listener );
+}
+
+void TCPStack::queue_for_accept( const FourTuple& id, Listener& listener )
+{
+  accept_queue_.push( id );
+  unaccepted_.insert( id );
+  ++listener.accept_pending;
+}
+
+void TCPStack::send_syn_ack( const FourTuple& id, const HalfOpen& entry, const TransmitFunction& transmit ) const
+{
+  // the same SYN-ACK that a TCPPeer with our configuration would send
+  TCPMessage syn_ack;
+  syn_ack.sender.SYN = true;
+  syn_ack.sender.seqno = entry.isn;
+  syn_ack.receiver.ackno = entry.peer_isn + 1;
+  syn_ack.receiver.window_size = min<uint64_t>( config_.recv_capacity, UINT16_MAX );
+  if ( entry.peer_window_scale.has_value() ) {
+    syn_ack.receiver.window_scale = TCPPeer::receive_window_shift( config_ );
+  }
+  if ( entry.peer_timestamp.has_value() ) {
+    syn_ack.sender.TSval = 0;
+    syn_ack.receiver.TSecr = entry.peer_timestamp;
+  }
+  if ( entry.grant_fast_open_cookie ) {
+    syn_ack.sender.fast_open_cookie = fast_open_cookie_for( id.remote_ip );
+  }
+  transmit_for( id, transmit )( std::move( syn_ack ) );
+}
+
+// Cookie layout: 5 bits of time period, 3 bits of window scale code, and 24 bits of keyed hash
+Wrap32 TCPStack::make_cookie( const FourTuple& id, const HalfOpen& entry ) const
+{
+  uint32_t wscale_code = 0;
+  if ( entry.peer_window_scale.has_value() ) {
+    wscale_code = 1;
+    while ( wscale_code + 1 < COOKIE_WSCALES.size()
+            and COOKIE_WSCALES.at( wscale_code + 1 ) <= entry.peer_window_scale.value() ) {
+      ++wscale_code;
+    }
+  }
+
+  const auto period = static_cast<uint32_t>( time_ms_ / COOKIE_PERIOD_MS ) % 32;
+  return Wrap32 { period << 27 | wscale_code << 24 | cookie_hash( id, entry.peer_isn, period, wscale_code ) };
+}
+
+optional<TCPStack::HalfOpen> TCPStack::check_cookie( const FourTuple& id, const TCPMessage& ack ) const
+{
+  const Wrap32 peer_isn = ack.sender.seqno + static_cast<uint32_t>( -1 );
+  const uint32_t cookie = Wrap32Raw { ack.receiver.ackno.value() + static_cast<uint32_t>( -1 ) }.raw_value();
+  const uint32_t period = cookie >> 27;
+  const uint32_t wscale_code = ( cookie >> 24 ) & 7;
+
+  // only cookies from this period or the previous one are accepted
+  const auto now_period = static_cast<uint32_t>( time_ms_ / COOKIE_PERIOD_MS ) % 32;
+  if ( ( ( now_period - period ) % 32 ) > 1 ) {
+    return {};
+  }
+  if ( ( cookie & 0xffffff ) != cookie_hash( id, peer_isn, period, wscale_code ) ) {
+    return {};
+  }
+
+  HalfOpen entry;
+  entry.peer_isn = peer_isn;
+  entry.isn = Wrap32 { cookie };
+  if ( wscale_code > 0 ) {
+    entry.peer_window_scale = COOKIE_WSCALES.at( wscale_code );
+  }
+  return entry;
+}
+
+uint32_t TCPStack::cookie_hash( const FourTuple& id, Wrap32 peer_isn, uint32_t period, uint32_t wscale_code ) const
+{
+  const uint64_t rest = static_cast<uint64_t>( Wrap32Raw { peer_isn }.raw_value() ) << 32 | period << 3 | wscale_code;
+  return static_cast<uint32_t>( siphash( cookie_secret_, { addresses_of( id ), ports_of( id ), rest } ) ) & 0xffffff;
+}
+
+string TCPStack::fast_open_cookie_for( uint32_t remote_ip ) const
+{
+  // 8 bytes, keyed by the same secret as SYN cookies (but domain-separated from them)
+  uint64_t h = siphash( cookie_secret_, { 0x46'4f'43'4bULL << 32 | remote_ip } );
+  string cookie;
+  for ( int i = 0; i < 8; ++i, h >>= 8 ) {
+    cookie.push_back( static_cast<char>( h ) );
+  }
+  return cookie;
+}
+
+Wrap32 TCPStack::isn_for( const FourTuple& id ) const
+{
+  const uint64_t hash = siphash( isn_secret_, { addresses_of( id ), ports_of( id ) } );
+  return Wrap32 { static_cast<uint32_t>( hash + time_ms_ * 250 ) };
+}
+
+void TCPStack::push( const FourTuple& id, const TransmitFunction& transmit )
+{
+  connection( id ).push( transmit_for( id, transmit ) );
+}
+
+void TCPStack::tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit )
+{
+  time_ms_ += ms_since_last_tick;
+
+  // forget half-open connections whose final ACK never came
+  for ( auto it = syn_queue_.begin(); it != syn_queue_.end(); ) {
+    if ( time_ms_ >= it->second.expires_ms ) {
+      --listeners_.at( it->first.local_port ).half_open;
+      it = syn_queue_.erase( it );
+    } else {
+      ++it;
+    }
+  }
+
+  for ( auto it = connections_.begin(); it != connections_.end(); ) {
+    TCPPeer& peer = it->second;
+    const auto peer_transmit = transmit_for( it->first, transmit );
+    if ( peer.active() ) {
+      peer.push( peer_transmit );
+      peer.tick( ms_since_last_tick, peer_transmit );
+    }
+
+    // a finished connection is forgotten once the application has accepted it and read everything it received
+    if ( not peer.active() and peer.inbound_reader().bytes_buffered() == 0
+         and not unaccepted_.contains( it->first ) ) {
+      it = connections_.erase( it );
+    } else {
+      ++it;
+    }
+  }
+}
+
+void TCPStack::install( EventLoop& loop, FileDescriptor& fd, const UpdateFunction& updated )
+{
+  const TransmitFunction transmit = [&fd]( const InternetDatagram& dgram ) { fd.write( serialize( dgram ) ); };
+
+  loop.add_rule( "receive datagram for the TCP stack", fd, Direction::In, [this, &fd, transmit, updated] {
+    vector<string> strs( 2 );
+    strs.front().resize( IPv4Header::LENGTH );
+    fd.read( strs );
+
+    InternetDatagram dgram;
+    if ( parse( dgram, std::move( strs ) ) ) {
+      const auto id = four_tuple_of( dgram );
+      receive( std::move( dgram ), transmit );
+      if ( updated and id.has_value() ) {
+        updated( id );
+      }
+    }
+  } );
+
+  auto last_tick = make_shared<uint64_t>( now_ms() );
+  loop.add_timer(
+    "tick TCP stack",
+    chrono::milliseconds( TICK_MS ),
+    [this, last_tick, transmit, updated] {
+      const uint64_t now = now_ms();
+      tick( now - *last_tick, transmit );
+      *last_tick = now;
+      if ( updated ) {
+        updated( {} );
+      }
+    },
+    chrono::milliseconds( TICK_MS ) );
+}
+
+TCPPeer& TCPStack::add_connection( const FourTuple& id, Wrap32 isn, optional<string> fast_open_cookie )
+{
+  TCPConfig config = config_;
+  config.isn = isn;
+  config.fast_open_cookie = std::move( fast_open_cookie );
+  return connections_.try_emplace( id, config ).first->second;
+}
+
+TCPPeer::TransmitFunction TCPStack::transmit_for( const FourTuple& id, const TransmitFunction& transmit )
+{
+  return [id, &transmit]( TCPMessage msg ) {
+    TCPSegment seg { .message = std::move( msg ) };
+    seg.udinfo.src_port = id.local_port;
+    seg.udinfo.dst_port = id.remote_port;
+
+    InternetDatagram dgram;
+    dgram.header.src = id.local_ip;
+    dgram.header.dst = id.remote_ip;
+    dgram.header.len = dgram.header.hlen * 4 + seg.header_length() + seg.message.sender.payload.size();
+
+    seg.compute_checksum( dgram.header.pseudo_checksum() );
+    dgram.header.compute_checksum();
+    dgram.payload = serialize( seg );
+    transmit( std::move( dgram ) );
+  };
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "ipv4_datagram.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+
+// The addresses of one TCP connection, from this host's point of view
+struct FourTuple
+{
+  uint32_t local_ip {};
+  uint16_t local_port {};
+  uint32_t remote_ip {};
+  uint16_t remote_port {};
+
+  bool operator==( const FourTuple& other ) const = default;
+};
+
+struct FourTupleHash
+{
+  size_t operator()( const FourTuple& id ) const;
+};
+
+// \brief Many TCP connections sharing one source of IPv4 datagrams.
+//
+// Each incoming segment is dispatched to its TCPPeer by a hash-table lookup on the connection's
+// four-tuple. A SYN for a listening port only creates a small half-open entry (or, once the port's
+// SYN queue is full, nothing at all: the state is encoded in a SYN cookie). The TCPPeer is created
+// when the final ACK of the handshake validates, and is then queued for accept().
+//
+// TCP Fast Open (RFC 7413): a port that listens with `fast_open` grants a cookie (a keyed hash of the
+// client's address) to any SYN that asks for one. A later SYN that presents the cookie creates its
+// TCPPeer at once, so the request on the SYN reaches the application one round trip earlier.
+//
+// Cookies and initial sequence numbers (RFC 6528: a keyed hash of the four-tuple plus a clock) are keyed
+// by two independent secrets drawn from the kernel's CSPRNG.
+class TCPStack
+{
+public:
+  // Type of the function the stack uses to send datagrams
+  using TransmitFunction = std::function<void( InternetDatagram )>;
+
+  // Type of the function an installed stack calls after handling a datagram for connection `id` (the
+  // connection may be new, or gone), or after a tick (with no `id`)
+  using UpdateFunction = std::function<void( const std::optional<FourTuple>& id )>;
+
+  // A 128-bit key for SipHash
+  using Key = std::array<uint64_t, 2>;
+
+  // A fresh key from getrandom(2)
+  static Key random_key();
+
+  static constexpr size_t DEFAULT_BACKLOG = 128;       // default size of a port's SYN and accept queues
+  static constexpr uint64_t SYN_RCVD_TIMEOUT_MS = 8000; // how long a half-open entry waits for the final ACK
+  static constexpr uint64_t COOKIE_PERIOD_MS = 64000;   // a SYN cookie is valid for one to two periods
+
+  explicit TCPStack( const TCPConfig& config ) : config_( config ) {}
+
+  // A stack whose SYN and Fast Open cookies are keyed by `cookie_secret`, so that stacks serving the same
+  // addresses (like the shards of a ShardedTCPStack) accept each other's cookies
+  TCPStack( const TCPConfig& config, const Key& cookie_secret ) : config_( config ), cookie_secret_( cookie_secret )
+  {}
+
+  // Accept connections to `port` (on any local address), with at most `backlog` half-open
+  // connections and at most `backlog` established connections waiting to be accepted
+  void listen( uint16_t port, size_t backlog = DEFAULT_BACKLOG, bool fast_open = false );
+
+  // Open a connection from `local` to `remote` (sends the SYN)
+  FourTuple connect( const Address& local, const Address& remote, const TransmitFunction& transmit );
+
+  // Open a connection and send `data` on it, on the SYN itself if `remote` gave us a Fast Open cookie
+  // before (otherwise, the SYN asks for a cookie and the data follows the handshake)
+  FourTuple connect_with_data( const Address& local,
+                               const Address& remote,
+                               std::string_view data,
+                               const TransmitFunction& transmit );
+
+  // Next connection spawned by a listening port, if any
+  std::optional<FourTuple> accept();
+
+  // Hand an incoming datagram to the connection it belongs to
+  void receive( InternetDatagram dgram, const TransmitFunction& transmit );
+
+  // The connection an incoming datagram belongs to, from its addresses and ports alone (the segment
+  // isn't parsed or checked); empty if it doesn't carry TCP
+  static std::optional<FourTuple> four_tuple_of( const InternetDatagram& dgram );
+
+  // Send whatever the application has written to a connection
+  void push( const FourTuple& id, const TransmitFunction& transmit );
+
+  // Advance time on every connection (sending any pending data), and forget finished connections
+  void tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit );
+
+  // Register the rules that drive every connection from `loop`, reading and writing IPv4 datagrams
+  // (one per read or write, as with a TUN device) on `fd`, and telling `updated` what changed
+  void install( EventLoop& loop, FileDescriptor& fd, const UpdateFunction& updated = {} );
+
+  // Access a connection (throws if there is no such connection)
+  TCPPeer& connection( const FourTuple& id ) { return connections_.at( id ); }
+  const TCPPeer& connection( const FourTuple& id ) const { return connections_.at( id ); }
+
+  bool has_connection( const FourTuple& id ) const { return connections_.contains( id ); }
+  size_t connection_count() const { return connections_.size(); }
+
+  size_t half_open_count() const { return syn_queue_.size(); } // connections waiting for the final ACK
+  size_t acceptable_count() const { return accept_queue_.size(); } // connections waiting for accept()
+  uint64_t syn_cookies_sent() const { return syn_cookies_sent_; }
+  uint64_t syn_cookies_accepted() const { return syn_cookies_accepted_; }
+  uint64_t fast_open_accepted() const { return fast_open_accepted_; } // connections opened by a valid cookie
+
+private:
+  TCPConfig config_;
+  Key cookie_secret_ { random_key() }; // keys SYN cookies and Fast Open cookies
+  Key isn_secret_ { random_key() };    // keys initial sequence numbers
+  uint64_t time_ms_ {};
+
+  struct Listener
+  {
+    size_t backlog {};
+    size_t half_open {};      // entries in the SYN queue
+    size_t accept_pending {}; // established connections not yet accepted
+    bool fast_open {};
+  };
+
+  // What we need to remember about a SYN until the handshake completes
+  struct HalfOpen
+  {
+    Wrap32 peer_isn { 0 };
+    Wrap32 isn { 0 };
+    std::optional<uint8_t> peer_window_scale {};
+    std::optional<uint32_t> peer_timestamp {};
+    uint64_t expires_ms {};
+    bool grant_fast_open_cookie {};
+  };
+
+  std::unordered_map<FourTuple, TCPPeer, FourTupleHash> connections_ {};
+  std::unordered_map<uint16_t, Listener> listeners_ {};
+  std::unordered_map<FourTuple, HalfOpen, FourTupleHash> syn_queue_ {};
+  std::queue<FourTuple> accept_queue_ {};
+  std::unordered_set<FourTuple, FourTupleHash> unaccepted_ {}; // the connections in accept_queue_, kept alive
+  uint64_t syn_cookies_sent_ {};
+  uint64_t syn_cookies_accepted_ {};
+  uint64_t fast_open_accepted_ {};
+
+  // Fast Open cookies granted to us, by server address
+  std::unordered_map<uint32_t, std::string> fast_open_cookies_ {};
+
+  void receive_syn( const FourTuple& id, TCPMessage syn, Listener& listener, const TransmitFunction& transmit );
+  void receive_handshake_ack( const FourTuple& id,
+                              TCPMessage ack,
+                              Listener& listener,
+                              const TransmitFunction& transmit );
+  void send_syn_ack( const FourTuple& id, const HalfOpen& entry, const TransmitFunction& transmit ) const;
+
+  // Queue a new connection for accept() (it isn't forgotten before then, even if it finishes first)
+  void queue_for_accept( const FourTuple& id, Listener& listener );
+
+  // SYN cookies: the ISN carries a coarse timestamp, the peer's window scale and a keyed hash of the rest
+  Wrap32 make_cookie( const FourTuple& id, const HalfOpen& entry ) const;
+  std::optional<HalfOpen> check_cookie( const FourTuple& id, const TCPMessage& ack ) const;
+  uint32_t cookie_hash( const FourTuple& id, Wrap32 peer_isn, uint32_t period, uint32_t wscale_code ) const;
+
+  // The Fast Open cookie for clients at `remote_ip`
+  std::string fast_open_cookie_for( uint32_t remote_ip ) const;
+
+  // Create the peer for a new connection
+  TCPPeer& add_connection( const FourTuple& id,
+                           Wrap32 isn,
+                           std::optional<std::string> fast_open_cookie = std::nullopt );
+
+  // The ISN for a new connection: a keyed hash of its four-tuple, advanced by a 4-microsecond clock (RFC 6528)
+  Wrap32 isn_for( const FourTuple& id ) const;
+
+  // Wrap the TCPPeer's messages for connection `id` in IPv4 datagrams
+  static TCPPeer::TransmitFunction transmit_for( const FourTuple& id, const TransmitFunction& transmit );
+};
@@ -0,0 +1,138 @@
+#include "checksum.hh"
+#include "ipv4_header.hh"
+#include "parser.hh"
+#include "test_should_be.hh"
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace {
+using Kernel = InternetChecksum::Kernel;
+constexpr Kernel kernels[] = { Kernel::Bytewise, Kernel::Word64, Kernel::SSE2, Kernel::AVX2 };
+
+string random_bytes( default_random_engine& rng, size_t size )
+{
+  uniform_int_distribution<int> byte { 0, 255 };
+  string ret( size, 0 );
+  for ( auto& c : ret ) {
+    c = static_cast<char>( byte( rng ) );
+  }
+  return ret;
+}
+} // namespace
+
+int main()
+{
+  try {
+    default_random_engine rng { 1071 };
+
+    {
+      // the example of RFC 1071, section 3
+      const string data { "\x00\x01\xf2\x03\xf4\xf5\xf6\xf7", 8 };
+      for ( const auto kernel : kernels ) {
+        if ( InternetChecksum::supported( kernel ) ) {
+          expect( InternetChecksum::partial_sum( data, kernel ) == 0xddf2, "RFC 1071 sum" );
+        }
+      }
+      InternetChecksum check;
+      check.add( data );
+      expect( check.value() == 0x220d, "RFC 1071 checksum" );
+    }
+
+    {
+      // every kernel agrees with the byte-at-a-time sum, for any length and alignment
+      // (including lengths that need more than one pass of a vector kernel)
+      const string data = random_bytes( rng, 1'200'000 );
+      vector<size_t> sizes;
+      for ( size_t size = 0; size <= 300; ++size ) {
+        sizes.push_back( size );
+      }
+      sizes.insert( sizes.end(), { 1500, 65535, 65536, 1'199'993 } );
+
+      for ( const size_t size : sizes ) {
+        for ( size_t offset = 0; offset < 8 and offset + size <= data.size(); ++offset ) {
+          const string_view span = string_view { data }.substr( offset, size );
+          const uint16_t expected = InternetChecksum::partial_sum( span, Kernel::Bytewise );
+          for ( const auto kernel : kernels ) {
+            if ( InternetChecksum::supported( kernel ) ) {
+              expect( InternetChecksum::partial_sum( span, kernel ) == expected,
+                      "kernel " + to_string( static_cast<int>( kernel ) ) + " on " + to_string( size ) + " bytes at "
+                        + to_string( offset ) );
+            }
+          }
+        }
+      }
+    }
+
+    {
+      // a datagram split into buffers of any (odd) lengths has the same checksum as the whole
+      uniform_int_distribution<size_t> piece { 0, 40 };
+      for ( unsigned round = 0; round < 1000; ++round ) {
+        const string data = random_bytes( rng, piece( rng ) * 17 );
+        InternetChecksum whole { 0x1234 };
+        whole.add( data );
+
+        vector<string> buffers;
+        for ( size_t i = 0; i < data.size(); ) {
+          buffers.push_back( data.substr( i, piece( rng ) ) );
+          i += buffers.back().size();
+        }
+        InternetChecksum split { 0x1234 };
+        split.add( buffers );
+        expect( split.value() == whole.value(), "split into " + to_string( buffers.size() ) + " buffers" );
+      }
+    }
+
+    {
+      // sums of many buffers don't overflow
+      const string ones( 1500, '\xff' );
+      InternetChecksum check { 0xffff'ffff };
+      for ( unsigned i = 0; i < 1000; ++i ) {
+        check.add( ones );
+      }
+      expect( check.value() == 0, "all ones" );
+    }
+
+    {
+      // incremental updates agree with summing the header again
+      uniform_int_distribution<uint32_t> field;
+      for ( unsigned round = 0; round < 1000; ++round ) {
+        IPv4Header header;
+        header.len = static_cast<uint16_t>( field( rng ) );
+        header.id = static_cast<uint16_t>( field( rng ) );
+        header.ttl = static_cast<uint8_t>( 1 + field( rng ) % 255 );
+        header.src = field( rng );
+        header.dst = field( rng );
+        header.compute_checksum();
+
+        header.decrement_ttl();
+        const uint16_t decremented = header.cksum;
+        header.compute_checksum();
+        expect( decremented == header.cksum, "TTL decremented to " + to_string( header.ttl ) );
+
+        const uint32_t new_src = field( rng );
+        const uint16_t translated = InternetChecksum::replace_u32( header.cksum, header.src, new_src );
+        header.src = new_src;
+        header.compute_checksum();
+        expect( translated == header.cksum, "source address rewritten" );
+
+        // and the result still verifies
+        IPv4Header parsed;
+        expect( parse( parsed, serialize( header ) ) and parsed.ttl == header.ttl, "header parses" );
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+#include "checksum.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+using Kernel = InternetChecksum::Kernel;
+constexpr size_t BYTES_PER_RUN = 1 << 26;
+
+const char* name( Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Bytewise:
+      return "byte at a time";
+    case Kernel::Word64:
+      return "64-bit words";
+    case Kernel::SSE2:
+      return "SSE2";
+    case Kernel::AVX2:
+      return "AVX2";
+  }
+  return "?";
+}
+
+// Throughput (in GB/s) of summing buffers of `size` bytes with `kernel` (and the total of the sums, to compare)
+double gigabytes_per_second( const string& data, size_t size, Kernel kernel, uint64_t& total )
+{
+  const string_view buffer = string_view { data }.substr( 0, size );
+  total = 0;
+  const auto start = steady_clock::now();
+  for ( size_t done = 0; done < BYTES_PER_RUN; done += size ) {
+    total += InternetChecksum::partial_sum( buffer, kernel );
+  }
+  const auto elapsed = duration_cast<duration<double>>( steady_clock::now() - start );
+  return static_cast<double>( BYTES_PER_RUN ) / elapsed.count() / 1e9;
+}
+
+void program_body()
+{
+  default_random_engine rng { 1624 };
+  uniform_int_distribution<int> byte { 0, 255 };
+  string data( 65536, 0 );
+  for ( auto& c : data ) {
+    c = static_cast<char>( byte( rng ) );
+  }
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << fixed << setprecision( 2 );
+  debug_output << fixed << setprecision( 2 );
+  for ( const size_t size : { size_t { 20 }, size_t { 1460 }, size_t { 65536 } } ) {
+    cout << "InternetChecksum of " << size << "-byte buffers:\n";
+    uint64_t expected = 0;
+    const double before = gigabytes_per_second( data, size, Kernel::Bytewise, expected );
+    double after = before;
+    for ( const auto kernel : { Kernel::Bytewise, Kernel::Word64, Kernel::SSE2, Kernel::AVX2 } ) {
+      if ( not InternetChecksum::supported( kernel ) ) {
+        continue;
+      }
+      uint64_t result = 0;
+      const double speed = gigabytes_per_second( data, size, kernel, result );
+      if ( result != expected ) {
+        throw runtime_error( string { name( kernel ) } + " disagrees with the byte-at-a-time sum" );
+      }
+      cout << "  " << setw( 16 ) << left << name( kernel ) << right << setw( 8 ) << speed << " GB/s"
+           << ( kernel == InternetChecksum::fastest_kernel() ? " (used)" : "" ) << "\n";
+      if ( kernel == InternetChecksum::fastest_kernel() ) {
+        after = speed;
+      }
+    }
+    debug_output << "             checksum of " << setw( 5 ) << size << " bytes: " << before << " -> " << after
+                 << " GB/s\n";
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
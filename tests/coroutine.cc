@@ -0,0 +1,317 @@
+#include "async_tcp_stack.hh"
+#include "coroutine.hh"
+#include "exception.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+pair<FileDescriptor, FileDescriptor> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+Task<int> add( Scheduler& scheduler, int a, int b )
+{
+  co_await scheduler.sleep_for( chrono::milliseconds( 1 ) );
+  co_return a + b;
+}
+
+Task<void> fail()
+{
+  throw runtime_error( "task failed" );
+  co_return;
+}
+
+Task<void> sleep_then_record( Scheduler& scheduler, vector<int>& order )
+{
+  co_await scheduler.sleep_for( chrono::milliseconds( 20 ) );
+  order.push_back( 2 );
+}
+
+Task<void> add_then_catch( Scheduler& scheduler, vector<int>& order )
+{
+  order.push_back( co_await add( scheduler, 0, 1 ) );
+  try {
+    co_await fail();
+  } catch ( const runtime_error& ) {
+    order.push_back( 10 );
+  }
+}
+
+// Read from `fd` until `count` bytes arrived
+Task<void> read_bytes( Scheduler& scheduler, FileDescriptor& fd, size_t count, string& received )
+{
+  while ( received.size() < count ) {
+    received += co_await async_read( scheduler, fd );
+  }
+}
+
+// One read from `fd`
+Task<void> read_once( Scheduler& scheduler, FileDescriptor& fd, string& received )
+{
+  received = co_await async_read( scheduler, fd );
+}
+
+// Write `data` to `fd` after a while
+Task<void> write_later( Scheduler& scheduler, FileDescriptor& fd, string data )
+{
+  co_await scheduler.sleep_for( chrono::milliseconds( 20 ) );
+  fd.write( data );
+}
+
+// Try to read zero bytes from `fd`
+Task<void> read_nothing( Scheduler& scheduler, FileDescriptor& fd, bool& refused )
+{
+  try {
+    co_await async_read( scheduler, fd, 0 );
+  } catch ( const runtime_error& ) {
+    refused = true;
+  }
+}
+
+// Wait for `fd` to be readable, once
+Task<void> wait_readable( Scheduler& scheduler, FileDescriptor& fd )
+{
+  co_await scheduler.readable( fd );
+}
+
+// Echo what a connection sends until it closes
+Task<void> echo( Scheduler& scheduler, TCPSocket connection )
+{
+  connection.set_blocking( false );
+  while ( true ) {
+    const string data = co_await async_read( scheduler, connection );
+    if ( data.empty() ) {
+      break;
+    }
+    co_await async_write( scheduler, connection, data );
+  }
+}
+
+Task<void> echo_server( Scheduler& scheduler, TCPSocket& listener, size_t connections )
+{
+  for ( size_t i = 0; i < connections; ++i ) {
+    scheduler.spawn( echo( scheduler, co_await async_accept( scheduler, listener ) ) );
+  }
+}
+
+Task<void> echo_client( Scheduler& scheduler, Address server, string message, size_t& echoed )
+{
+  TCPSocket socket;
+  socket.set_blocking( false );
+  co_await async_connect( scheduler, socket, server );
+  co_await async_write( scheduler, socket, message );
+
+  string reply;
+  while ( reply.size() < message.size() ) {
+    const string data = co_await async_read( scheduler, socket );
+    if ( data.empty() ) {
+      break;
+    }
+    reply += data;
+  }
+  echoed += reply == message;
+}
+
+// Echo what a connection of the stack sends until it closes
+Task<void> stack_echo( AsyncTCPStack& stack, FourTuple id )
+{
+  while ( true ) {
+    const string data = co_await stack.read( id );
+    if ( data.empty() ) {
+      break;
+    }
+    co_await stack.write( id, data );
+  }
+  stack.close( id );
+}
+
+Task<void> stack_echo_server( Scheduler& scheduler, AsyncTCPStack& stack, size_t connections )
+{
+  for ( size_t i = 0; i < connections; ++i ) {
+    scheduler.spawn( stack_echo( stack, co_await stack.accept() ) );
+  }
+}
+
+Task<void> stack_echo_client( AsyncTCPStack& stack, Address local, Address server, string message, size_t& echoed )
+{
+  const FourTuple id = co_await stack.connect( local, server );
+  co_await stack.write( id, message );
+
+  string reply;
+  while ( reply.size() < message.size() ) {
+    const string data = co_await stack.read( id );
+    if ( data.empty() ) {
+      break;
+    }
+    reply += data;
+  }
+  stack.close( id );
+  echoed += reply == message;
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // tasks run concurrently, and pass on their values and exceptions
+      Scheduler scheduler;
+      vector<int> order;
+      scheduler.spawn( sleep_then_record( scheduler, order ) );
+      scheduler.spawn( add_then_catch( scheduler, order ) );
+      scheduler.run();
+      expect( order == vector<int> { 1, 10, 2 }, "the shorter sleep finished first" );
+
+      scheduler.spawn( fail() );
+      bool thrown = false;
+      try {
+        scheduler.run();
+      } catch ( const runtime_error& e ) {
+        thrown = string { e.what() } == "task failed";
+      }
+      expect( thrown and scheduler.task_count() == 0, "run() rethrows the exception that escapes a task" );
+    }
+
+    {
+      // a reader and a writer can park on the same fd
+      auto [a, b] = socket_pair();
+      a.set_blocking( false );
+      b.set_blocking( false );
+      Scheduler scheduler;
+      const string message( 100000, 'x' );
+      string from_a;
+      string from_b;
+      scheduler.spawn( read_bytes( scheduler, a, message.size(), from_b ) );
+      scheduler.spawn( async_write( scheduler, a, message ) );
+      scheduler.spawn( read_bytes( scheduler, b, message.size(), from_a ) );
+      scheduler.spawn( async_write( scheduler, b, message ) );
+      scheduler.run();
+      expect( from_a == message and from_b == message, "read while writing on the same fd" );
+
+      // but not two readers
+      scheduler.spawn( wait_readable( scheduler, a ) );
+      scheduler.spawn( wait_readable( scheduler, a ) );
+      bool thrown = false;
+      try {
+        scheduler.run();
+      } catch ( const runtime_error& e ) {
+        thrown = string { e.what() }.find( "two tasks" ) != string::npos;
+      }
+      expect( thrown, "second reader refused" );
+    }
+
+    {
+      // a read that finds the fd drained by someone else waits for the next data, rather than returning EOF
+      auto [a, b] = socket_pair();
+      a.set_blocking( false );
+      FileDescriptor other_reader { CheckSystemCall( "dup", ::dup( a.fd_num() ) ) };
+      Scheduler scheduler;
+      bool drained = false;
+      scheduler.loop().add_rule(
+        "drain", other_reader, Direction::In, [&] {
+          string stolen;
+          other_reader.read( stolen );
+          drained = true;
+        },
+        [&] { return not drained; } );
+
+      b.write( "first" );
+      string received;
+      scheduler.spawn( read_once( scheduler, a, received ) );
+      scheduler.spawn( write_later( scheduler, b, "second" ) );
+      scheduler.run();
+      expect( drained and received == "second", "spurious readiness ignored" );
+
+      // and a read of nothing at all is refused
+      bool refused = false;
+      scheduler.spawn( read_nothing( scheduler, a, refused ) );
+      scheduler.run();
+      expect( refused, "empty read refused" );
+    }
+
+    {
+      // once no task waits for an fd, the scheduler lets go of it
+      Scheduler scheduler;
+      auto [c, d] = socket_pair();
+      d.set_blocking( false );
+      {
+        FileDescriptor waited = std::move( c );
+        d.write( "x" );
+        scheduler.spawn( wait_readable( scheduler, waited ) );
+        scheduler.run();
+        string x;
+        waited.read( x );
+      }
+      scheduler.loop().wait_next_event( 0 );
+      string rest;
+      d.read( rest );
+      expect( d.eof(), "fd closed once nobody waits for it" );
+    }
+
+    using enum EventLoop::Backend;
+    for ( const auto backend : { Poll, Epoll } ) {
+      // many connections served by one thread
+      constexpr size_t connections = 200;
+      Scheduler scheduler { backend };
+      TCPSocket listener;
+      listener.set_reuseaddr();
+      listener.bind( Address { "127.0.0.1", 0 } );
+      listener.listen( connections );
+      const Address server = listener.local_address();
+
+      size_t echoed = 0;
+      scheduler.spawn( echo_server( scheduler, listener, connections ) );
+      for ( size_t i = 0; i < connections; ++i ) {
+        const string message = "message " + to_string( i ) + string( i * 100, 'x' );
+        scheduler.spawn( echo_client( scheduler, server, message, echoed ) );
+      }
+      scheduler.run();
+      expect( echoed == connections, "every client got its echo" );
+    }
+
+    {
+      // many connections of two TCPStacks, served by one thread with no thread per connection
+      array<int, 2> fds {};
+      CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+      FileDescriptor server_fd { fds[0] };
+      FileDescriptor client_fd { fds[1] };
+
+      constexpr size_t connections = 20;
+      const Address server_address { "10.0.0.1", 1234 };
+      Scheduler scheduler;
+      AsyncTCPStack server { scheduler, TCPConfig {}, server_fd };
+      AsyncTCPStack client { scheduler, TCPConfig {}, client_fd };
+      server.stack().listen( server_address.port() );
+
+      size_t echoed = 0;
+      scheduler.spawn( stack_echo_server( scheduler, server, connections ) );
+      for ( uint16_t i = 0; i < connections; ++i ) {
+        const string message = "message " + to_string( i ) + string( i * 50, 'x' );
+        const Address local { "10.0.0.2", static_cast<uint16_t>( 5000 + i ) };
+        scheduler.spawn( stack_echo_client( client, local, server_address, message, echoed ) );
+      }
+      scheduler.run();
+      expect( echoed == connections, "every connection echoed (" + to_string( echoed ) + ")" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,236 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "test_should_be.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+pair<FileDescriptor, FileDescriptor> socket_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+void test_backend( EventLoop::Backend backend, const string& name )
+{
+  {
+    // a read rule fires only when its fd is readable and it is interested
+    auto [a, b] = socket_pair();
+    EventLoop loop { backend };
+    string received;
+    bool want_read = true;
+    loop.add_rule(
+      "read", a, Direction::In, [&] { a.read( received ); }, [&] { return want_read; } );
+
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, name + ": nothing to read yet" );
+    b.write( "hello" );
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, name + ": readable" );
+    expect( received == "hello", name + ": callback read the data" );
+
+    b.write( "again" );
+    want_read = false;
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, name + ": no interest left" );
+    want_read = true;
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, name + ": interest restored" );
+    expect( received == "again", name + ": data read after interest changed" );
+  }
+
+  {
+    // a reading rule and a writing rule can share an fd
+    auto [a, b] = socket_pair();
+    EventLoop loop { backend };
+    string received;
+    size_t writes = 0;
+    loop.add_rule( "read", a, Direction::In, [&] { a.read( received ); } );
+    loop.add_rule(
+      "write", a, Direction::Out, [&] { a.write( "x" ), ++writes; }, [&] { return writes == 0; } );
+
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, name + ": writable" );
+    expect( writes == 1, name + ": write rule fired" );
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, name + ": nothing more to do" );
+    b.write( "y" );
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, name + ": readable" );
+    expect( received == "y", name + ": read rule fired" );
+  }
+
+  {
+    // cancelled rules and rules whose fd reached EOF are removed; their fds may be reused
+    EventLoop loop { backend };
+    for ( int round = 0; round < 3; ++round ) {
+      auto [a, b] = socket_pair();
+      string received;
+      bool cancelled = false;
+      auto handle = loop.add_rule(
+        "read", a, Direction::In, [&] { a.read( received ); }, [] { return true; }, [&] { cancelled = true; } );
+
+      b.write( "data" );
+      expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, name + ": readable" );
+      if ( round == 0 ) {
+        handle.cancel();
+      } else {
+        b.close();
+        expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, name + ": EOF read" );
+        expect( a.eof(), name + ": fd at EOF" );
+      }
+      expect( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, name + ": rule removed" );
+      expect( cancelled == ( round > 0 ), name + ": cancel callback only runs at EOF" );
+    }
+  }
+
+  {
+    // a non-fd rule runs while it is interested
+    EventLoop loop { backend };
+    int count = 0;
+    loop.add_rule( "count", [&] { ++count; }, [&] { return count < 3; } );
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, name + ": non-fd rule ran" );
+    expect( count == 3, name + ": until it lost interest" );
+  }
+
+  {
+    // by default, each call serves one ready rule; in AllReady mode, one call serves them all
+    for ( const auto mode : { EventLoop::Dispatch::OneRule, EventLoop::Dispatch::AllReady } ) {
+      EventLoop loop { backend };
+      loop.set_dispatch( mode );
+      vector<pair<FileDescriptor, FileDescriptor>> pairs;
+      pairs.reserve( 3 ); // (the rules capture references to the elements)
+      size_t served = 0;
+      for ( int i = 0; i < 3; ++i ) {
+        pairs.push_back( socket_pair() );
+        auto& fd = pairs.back().first;
+        loop.add_rule( "read " + to_string( i ), fd, Direction::In, [&] {
+          string buf;
+          fd.read( buf );
+          ++served;
+        } );
+        pairs.back().second.write( "x" );
+      }
+
+      size_t calls = 0;
+      while ( served < 3 ) {
+        expect( loop.wait_next_event( 0 ) == EventLoop::Result::Success, name + ": ready rules served" );
+        ++calls;
+      }
+      expect( calls == ( mode == EventLoop::Dispatch::AllReady ? 1 : 3 ),
+              name + ": one wakeup per ready rule unless batching (" + to_string( calls ) + " calls)" );
+    }
+  }
+
+  {
+    // in AllReady mode, a non-fd rule gets a bounded share of each call, and the fd rules still run
+    EventLoop loop { backend };
+    loop.set_dispatch( EventLoop::Dispatch::AllReady, 4 );
+    auto [a, b] = socket_pair();
+    int count = 0;
+    string received;
+    loop.add_rule( "count", [&] { ++count; }, [&] { return count < 10; } );
+    loop.add_rule( "read", a, Direction::In, [&] { a.read( received ); } );
+    b.write( "data" );
+
+    expect( loop.wait_next_event( -1 ) == EventLoop::Result::Success, name + ": first share" );
+    expect( count == 4, name + ": non-fd rule capped" );
+    expect( received == "data", name + ": fd rule served in the same call" );
+    loop.wait_next_event( -1 );
+    loop.wait_next_event( -1 );
+    expect( count == 10, name + ": non-fd rule finished over later calls" );
+  }
+
+  {
+    // one-shot and periodic timers; the loop sleeps until the next one is due
+    EventLoop loop { backend };
+    int one_shot = 0;
+    int periodic = 0;
+    const auto start = EventLoop::Clock::now();
+    loop.add_timer( "one-shot", chrono::milliseconds( 5 ), [&] { ++one_shot; } );
+    auto handle = loop.add_timer(
+      "periodic", chrono::milliseconds( 2 ), [&] { ++periodic; }, chrono::milliseconds( 2 ) );
+
+    while ( one_shot == 0 or periodic < 3 ) {
+      expect( loop.wait_next_event( -1 ) == EventLoop::Result::Success, name + ": woken by a timer" );
+    }
+    expect( EventLoop::Clock::now() - start >= chrono::milliseconds( 5 ), name + ": timers not early" );
+
+    handle.cancel();
+    expect( loop.wait_next_event( -1 ) == EventLoop::Result::Exit, name + ": no timers left" );
+    expect( one_shot == 1, name + ": one-shot timer fired once" );
+  }
+
+  {
+    // a timer due before the caller's timeout cuts the wait short
+    EventLoop loop { backend };
+    auto [a, b] = socket_pair();
+    string received;
+    bool fired = false;
+    loop.add_rule( "read", a, Direction::In, [&] { a.read( received ); } );
+    loop.add_timer( "timer", chrono::microseconds( 500 ), [&] { fired = true; } );
+
+    const auto start = EventLoop::Clock::now();
+    expect( loop.wait_next_event( 10'000 ) == EventLoop::Result::Success, name + ": timer fired" );
+    expect( fired, name + ": timer callback ran" );
+    expect( EventLoop::Clock::now() - start < chrono::seconds( 5 ), name + ": didn't wait for the timeout" );
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Timeout, name + ": only the fd rule is left" );
+  }
+
+  if ( backend != EventLoop::Backend::Epoll ) {
+    // an fd number closed behind the rule's back is an error on the fd (epoll just forgets it)
+    auto [a, b] = socket_pair();
+    EventLoop loop { backend };
+    string received;
+    bool failed = false;
+    bool cancelled = false;
+    loop.add_rule(
+      "read", a, Direction::In, [&] { a.read( received ); }, [] { return true; }, [&] { cancelled = true; }, [&] {
+        failed = true;
+      } );
+    const int fd_num = a.fd_num();
+    CheckSystemCall( "close", ::close( fd_num ) );
+    loop.wait_next_event( 1000 );
+    expect( failed and cancelled, name + ": error reported" );
+    expect( loop.wait_next_event( 0 ) == EventLoop::Result::Exit, name + ": rule removed" );
+    CheckSystemCall( "dup2", ::dup2( b.fd_num(), fd_num ) ); // (for `a` to close)
+  }
+
+  {
+    // a rule that never loses interest is still reported as a busy wait
+    for ( const auto mode : { EventLoop::Dispatch::OneRule, EventLoop::Dispatch::AllReady } ) {
+      EventLoop loop { backend };
+      loop.set_dispatch( mode );
+      loop.add_rule( "spin", [] {} );
+      bool detected = false;
+      try {
+        for ( int i = 0; i < 200; ++i ) {
+          loop.wait_next_event( 0 );
+        }
+      } catch ( const runtime_error& ) {
+        detected = true;
+      }
+      expect( detected, name + ": busy wait detected" );
+    }
+  }
+}
+} // namespace
+
+int main()
+{
+  try {
+    test_backend( EventLoop::Backend::Poll, "poll" );
+    test_backend( EventLoop::Backend::Epoll, "epoll" );
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
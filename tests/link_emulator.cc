@@ -0,0 +1,208 @@
+#include "link_emulator.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+TCPMessage segment( uint32_t seqno, size_t payload_size = 0 )
+{
+  TCPMessage msg;
+  msg.sender.seqno = Wrap32 { seqno };
+  msg.sender.payload = string( payload_size, 'x' );
+  return msg;
+}
+
+// Send `count` numbered segments from a to b at once, and read out what arrives within `wait_us`
+vector<uint32_t> send_numbered( EmulatedLink& link, uint32_t count, uint64_t wait_us = 1'000'000 )
+{
+  EmulatedLink::Endpoint a = link.a();
+  EmulatedLink::Endpoint b = link.b();
+  for ( uint32_t i = 0; i < count; ++i ) {
+    a.write( segment( i ) );
+  }
+  link.tick_us( wait_us );
+  vector<uint32_t> received;
+  while ( auto msg = b.read() ) {
+    received.push_back( static_cast<uint32_t>( msg->sender.seqno.unwrap( Wrap32 { 0 }, 0 ) ) );
+  }
+  return received;
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // serialization at the bottleneck rate, then the propagation delay
+      LinkConfig config;
+      config.rate_bps = 10'000'000;
+      config.delay_us = 5'000;
+      EmulatedLink link { config, LinkConfig {} };
+      EmulatedLink::Endpoint a = link.a();
+      EmulatedLink::Endpoint b = link.b();
+
+      for ( uint32_t i = 0; i < 3; ++i ) {
+        a.write( segment( i, 1000 ) ); // 1040 bytes as IPv4: 832 us at 10 Mbit/s
+      }
+      link.tick_us( 5'831 );
+      expect( not b.read().has_value(), "nothing before the first datagram is serialized and propagated" );
+      link.tick_us( 1 );
+      expect( b.read().has_value(), "first datagram arrives" );
+      expect( not b.read().has_value(), "second still being serialized" );
+      link.tick_us( 832 );
+      expect( b.read().has_value(), "second arrives one serialization time later" );
+      link.tick_us( 832 );
+      expect( b.read().has_value(), "third arrives" );
+      expect( not a.read().has_value(), "nothing in the other direction" );
+    }
+
+    {
+      // serialization times that aren't whole microseconds add up exactly
+      LinkConfig config;
+      config.rate_bps = 1'000'000'000;
+      EmulatedLink link { config, LinkConfig {} };
+      EmulatedLink::Endpoint a = link.a();
+      EmulatedLink::Endpoint b = link.b();
+      for ( uint32_t i = 0; i < 100; ++i ) {
+        a.write( segment( i, 1000 ) ); // 8.32 us each at 1 Gbit/s
+      }
+      link.tick_us( 831 );
+      size_t arrived = 0;
+      while ( b.read().has_value() ) {
+        ++arrived;
+      }
+      expect( arrived == 99, "the last datagram is still being serialized after 831 us" );
+      link.tick_us( 1 );
+      expect( b.read().has_value(), "and arrives at 832 us" );
+    }
+
+    {
+      // a full bottleneck queue drops at the tail
+      LinkConfig config;
+      config.rate_bps = 1'000'000;
+      config.queue_limit = 3000;
+      EmulatedLink link { config, LinkConfig {} };
+      EmulatedLink::Endpoint a = link.a();
+      for ( uint32_t i = 0; i < 10; ++i ) {
+        a.write( segment( i, 1000 ) );
+      }
+      expect( link.a_to_b().stats().tail_dropped == 8, "only two datagrams fit in the queue" );
+      link.tick( 100 );
+      a.write( segment( 10, 1000 ) );
+      expect( link.a_to_b().stats().tail_dropped == 8, "queue drained" );
+    }
+
+    {
+      // Gilbert-Elliott loss comes in bursts, at the chain's stationary rate
+      LinkConfig config;
+      config.good_to_bad = 0.01;
+      config.bad_to_good = 0.25;
+      config.loss_bad = 1;
+      EmulatedLink link { config, LinkConfig {} };
+      const uint32_t count = 100'000;
+      const vector<uint32_t> received = send_numbered( link, count );
+
+      const double loss = 1 - static_cast<double>( received.size() ) / count;
+      expect( loss > 0.03 and loss < 0.047, "loss rate near 0.01 / 0.26 (got " + to_string( loss ) + ")" );
+      uint64_t bursts = 0;
+      for ( size_t i = 1; i < received.size(); ++i ) {
+        bursts += received[i] != received[i - 1] + 1;
+      }
+      const double mean_burst = static_cast<double>( count - received.size() ) / static_cast<double>( bursts );
+      expect( mean_burst > 3 and mean_burst < 5, "mean burst near 4 (got " + to_string( mean_burst ) + ")" );
+    }
+
+    {
+      // duplication, and reordering by holding datagrams back
+      LinkConfig config;
+      config.rate_bps = 100'000'000;
+      config.duplicate_rate = 0.1;
+      config.reorder_rate = 0.1;
+      config.reorder_delay_us = 1'000;
+      EmulatedLink link { config, LinkConfig {} };
+      const vector<uint32_t> received = send_numbered( link, 10'000 );
+
+      const auto& stats = link.a_to_b().stats();
+      expect( received.size() == 10'000 + stats.duplicated, "every datagram delivered, some twice" );
+      expect( stats.duplicated > 800 and stats.duplicated < 1200, "about 10% duplicated" );
+      uint64_t out_of_order = 0;
+      for ( size_t i = 1; i < received.size(); ++i ) {
+        out_of_order += received[i] < received[i - 1];
+      }
+      expect( out_of_order > 500, "reordered (" + to_string( out_of_order ) + " out of order)" );
+    }
+
+    {
+      // the same seed gives the same run
+      LinkConfig config;
+      config.jitter_us = 10'000;
+      config.good_to_bad = 0.05;
+      config.loss_bad = 0.5;
+      config.seed = 144;
+      EmulatedLink first { config, LinkConfig {} };
+      EmulatedLink second { config, LinkConfig {} };
+      expect( send_numbered( first, 1000 ) == send_numbered( second, 1000 ), "reproducible" );
+    }
+
+    {
+      // a transfer between two TCPPeers across a 10 Mbit/s, 20 ms RTT link, on the link's clock
+      LinkConfig config;
+      config.rate_bps = 10'000'000;
+      config.delay_us = 10'000;
+      config.queue_limit = 64'000;
+      EmulatedLink link { config, config };
+      EmulatedLink::Endpoint client_end = link.a();
+      EmulatedLink::Endpoint server_end = link.b();
+      TCPPeer client { TCPConfig {} };
+      TCPPeer server { TCPConfig {} };
+      const auto to_server = [&]( const TCPMessage& msg ) { client_end.write( msg ); };
+      const auto to_client = [&]( const TCPMessage& msg ) { server_end.write( msg ); };
+
+      const uint64_t total = 200'000;
+      uint64_t written = 0;
+      uint64_t received = 0;
+      uint64_t elapsed_ms = 0;
+      client.push( to_server );
+      while ( received < total and elapsed_ms < 10'000 ) {
+        link.tick( 1 );
+        ++elapsed_ms;
+        while ( auto msg = server_end.read() ) {
+          server.receive( std::move( msg.value() ), to_client );
+        }
+        while ( auto msg = client_end.read() ) {
+          client.receive( std::move( msg.value() ), to_server );
+        }
+        client.tick( 1, to_server );
+        server.tick( 1, to_client );
+
+        const uint64_t chunk = min( total - written, client.outbound_writer().available_capacity() );
+        if ( client.has_ackno() and chunk > 0 ) {
+          client.outbound_writer().push( string( chunk, 'x' ) );
+          written += chunk;
+          client.push( to_server );
+        }
+        Reader& inbound = server.inbound_reader();
+        received += inbound.bytes_buffered();
+        inbound.pop( inbound.bytes_buffered() );
+      }
+
+      expect( received == total, "transfer finished (" + to_string( received ) + " bytes)" );
+      expect( elapsed_ms >= total * 8 / 10'000, "no faster than the bottleneck" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+#include "ipv4_datagram.hh"
+#include "ipv4_header.hh"
+#include "parser.hh"
+#include "tcp_config.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_peer.hh"
+#include "test_should_be.hh"
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Count every allocation big enough to hold a payload: copying a payload into a fresh std::string shows up here.
+namespace {
+size_t large_allocations = 0;
+} // namespace
+
+void* operator new( size_t size )
+{
+  if ( size >= TCPConfig::MAX_PAYLOAD_SIZE ) {
+    ++large_allocations;
+  }
+  if ( void* ptr = malloc( size ? size : 1 ) ) { // NOLINT(*-no-malloc, *-owning-memory)
+    return ptr;
+  }
+  throw bad_alloc {};
+}
+
+void operator delete( void* ptr ) noexcept
+{
+  free( ptr ); // NOLINT(*-no-malloc, *-owning-memory)
+}
+
+void operator delete( void* ptr, size_t /* size */ ) noexcept
+{
+  free( ptr ); // NOLINT(*-no-malloc, *-owning-memory)
+}
+
+namespace {
+const Address server_address { "10.0.0.1", 1234 };
+const Address client_address { "10.0.0.2", 5678 };
+
+// The client's side of the link: turns a TCPMessage into the two buffers a TUN read would produce
+struct Wire : public TCPOverIPv4Adapter
+{
+  Wire()
+  {
+    config_mut().source = client_address;
+    config_mut().destination = server_address;
+  }
+
+  vector<string> carry( const TCPMessage& msg )
+  {
+    string bytes;
+    for ( const auto& buf : serialize( wrap_tcp_in_ip( msg ) ) ) {
+      bytes.append( buf );
+    }
+    vector<string> ret( 2 );
+    ret.front() = bytes.substr( 0, IPv4Header::LENGTH );
+    ret.back() = bytes.substr( IPv4Header::LENGTH );
+    return ret;
+  }
+};
+
+// The server's side of the link: the same steps as TCPOverIPv4OverTunFdAdapter::read
+struct Endpoint : public TCPOverIPv4Adapter
+{
+  Endpoint()
+  {
+    config_mut().source = server_address;
+    config_mut().destination = client_address;
+  }
+
+  optional<TCPMessage> read( vector<string>&& strs )
+  {
+    InternetDatagram ip_dgram;
+    if ( parse( ip_dgram, std::move( strs ) ) ) {
+      return unwrap_tcp_in_ip( std::move( ip_dgram ) );
+    }
+    return {};
+  }
+};
+
+// A client segment with `len` bytes of payload
+TCPMessage next_segment( TCPPeer& client, size_t len )
+{
+  TCPMessage ret;
+  client.outbound_writer().push( string( len, 'x' ) );
+  client.push( [&]( TCPMessage msg ) { ret = std::move( msg ); } );
+  return ret;
+}
+} // namespace
+
+int main()
+{
+  try {
+    constexpr size_t len = TCPConfig::MAX_PAYLOAD_SIZE;
+    Wire wire;
+    Endpoint endpoint;
+    TCPPeer client { TCPConfig {} };
+    TCPPeer server { TCPConfig {} };
+    const auto ignore = []( const TCPMessage& ) {};
+    const auto to_client = [&]( TCPMessage msg ) { client.receive( std::move( msg ), ignore ); };
+
+    // handshake
+    server.receive( next_segment( client, 0 ), to_client );
+    expect( client.has_ackno() and server.has_ackno(), "connection established" );
+
+    {
+      // into an empty stream, the buffer read from the "fd" becomes the stream's buffer: no copies at all
+      vector<string> strs = wire.carry( next_segment( client, len ) );
+      const char* const read_buffer = strs.back().data();
+      auto msg = endpoint.read( std::move( strs ) );
+      expect( msg.has_value(), "segment accepted" );
+      server.receive( std::move( msg.value() ), to_client );
+      expect( server.inbound_reader().bytes_buffered() == len, "payload delivered" );
+      expect( server.inbound_reader().peek().data() == read_buffer, "payload moved, not copied" );
+      server.inbound_reader().pop( len );
+    }
+
+    // steady state: two segments at a time, then the application reads both
+    for ( unsigned round = 0; round < 50; ++round ) {
+      vector<vector<string>> reads;
+      reads.push_back( wire.carry( next_segment( client, len ) ) );
+      reads.push_back( wire.carry( next_segment( client, len ) ) );
+
+      large_allocations = 0;
+      for ( auto& strs : reads ) {
+        auto msg = endpoint.read( std::move( strs ) );
+        expect( msg.has_value(), "segment accepted" );
+        server.receive( std::move( msg.value() ), to_client );
+      }
+      server.inbound_reader().pop( server.inbound_reader().bytes_buffered() );
+      const size_t allocations = large_allocations;
+
+      // the first rounds may still grow the stream's buffer; after that, the only copy is into it
+      if ( round >= 2 ) {
+        expect( allocations == 0,
+                "no payload copies on the receive path (round " + to_string( round ) + ": "
+                  + to_string( allocations ) + " allocations)" );
+      }
+      server.tick( TCPConfig::ACK_DELAY_DFLT, to_client );
+    }
+
+    // the same through receive_batch, which merges each pair of segments into one before the receiver sees it
+    for ( unsigned round = 0; round < 50; ++round ) {
+      vector<vector<string>> reads;
+      reads.push_back( wire.carry( next_segment( client, len ) ) );
+      reads.push_back( wire.carry( next_segment( client, len ) ) );
+
+      large_allocations = 0;
+      vector<TCPMessage> batch;
+      for ( auto& strs : reads ) {
+        auto msg = endpoint.read( std::move( strs ) );
+        expect( msg.has_value(), "segment accepted" );
+        batch.push_back( std::move( msg.value() ) );
+      }
+      server.receive_batch( std::move( batch ), to_client );
+      server.inbound_reader().pop( server.inbound_reader().bytes_buffered() );
+      const size_t allocations = large_allocations;
+
+      if ( round >= 2 ) {
+        expect( allocations == 0,
+                "no payload copies when coalescing (round " + to_string( round ) + ": " + to_string( allocations )
+                  + " allocations)" );
+      }
+      server.tick( TCPConfig::ACK_DELAY_DFLT, to_client );
+    }
+    expect( server.stats().segments_coalesced == 50, "every pair coalesced" );
+    expect( server.stats().bytes_received == 201 * len, "everything delivered" );
+
+    {
+      // payloads left in a read buffer sized for the largest datagram don't keep all that room once cached
+      constexpr size_t read_buffer_size = 16384;
+      const auto read_buffer = [&]( char c ) {
+        string ret( len, c );
+        ret.reserve( read_buffer_size );
+        return ret;
+      };
+      string early = read_buffer( 'b' );
+      string in_order = read_buffer( 'a' );
+      const char* const in_order_buffer = in_order.data();
+
+      Reassembler reassembler { ByteStream { 4 * len } };
+      large_allocations = 0;
+      reassembler.insert( len, std::move( early ), false );
+      expect( large_allocations == 1, "out-of-order segment trimmed to its size when cached" );
+
+      reassembler.insert( 0, std::move( in_order ), false );
+      expect( reassembler.reader().bytes_buffered() == 2 * len, "both segments delivered" );
+      expect( reassembler.reader().peek().data() != in_order_buffer, "oversized buffer not adopted by the stream" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+#include "peer_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+constexpr uint64_t initial_capacity = 4000;
+constexpr uint64_t max_capacity = 1024 * 1024;
+
+// One round trip over a link with a 50 ms RTT: the client sends what it can, and the server's
+// application reads everything that arrived.
+void round_trip( PeerPair& peers )
+{
+  Writer& writer = peers.client.outbound_writer();
+  writer.push( string( writer.available_capacity(), 'x' ) );
+  peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+
+  peers.tick( 25 );
+  peers.deliver_to_server();
+  peers.server.inbound_reader().pop( peers.server.inbound_reader().bytes_buffered() );
+  peers.tick( 25 );
+  peers.deliver_to_client();
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // a fast reader grows the buffer, and it shrinks back once the connection goes idle
+      TCPConfig client_cfg;
+      client_cfg.send_capacity = max_capacity;
+      TCPConfig server_cfg;
+      server_cfg.recv_capacity = initial_capacity;
+      server_cfg.recv_capacity_max = max_capacity;
+      PeerPair peers { client_cfg, server_cfg };
+      peers.connect();
+      expect( peers.server.stats().receive_buffer == initial_capacity, "buffer starts small" );
+
+      for ( int i = 0; i < 24; ++i ) {
+        round_trip( peers );
+      }
+      const TCPStats grown = peers.server.stats();
+      expect( grown.receive_buffer > 16 * initial_capacity,
+              "buffer grew (to " + to_string( grown.receive_buffer ) + ")" );
+      expect( grown.receive_buffer <= max_capacity, "buffer stays within the maximum" );
+
+      const uint64_t before = peers.server.stats().bytes_received;
+      round_trip( peers );
+      const uint64_t per_rtt = peers.server.stats().bytes_received - before;
+      expect( per_rtt > 16 * initial_capacity, "throughput grew with the window" );
+
+      // stop sending, drain, and let the connection idle
+      peers.deliver();
+      peers.server.inbound_reader().pop( peers.server.inbound_reader().bytes_buffered() );
+      peers.tick( TCPConfig::ACK_DELAY_DFLT );
+      peers.deliver();
+      peers.server.inbound_reader().pop( peers.server.inbound_reader().bytes_buffered() );
+      peers.tick( TCPConfig::RECV_IDLE_MS );
+      expect( peers.server.stats().receive_buffer == grown.receive_buffer, "advertised window not taken back" );
+
+      // the buffer shrinks as the client uses up the window it was given, whose right edge never moves back
+      const auto right_edge = [&] { return peers.client.stats().bytes_acked + peers.client.stats().peer_window; };
+      uint64_t edge = right_edge();
+      uint64_t previous_buffer = grown.receive_buffer;
+      for ( int i = 0; i < 2000 and peers.server.stats().receive_buffer > initial_capacity; ++i ) {
+        peers.client.outbound_writer().push( string( 1000, 'x' ) );
+        peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+        peers.tick( 25 );
+        peers.deliver_to_server();
+        peers.server.inbound_reader().pop( peers.server.inbound_reader().bytes_buffered() );
+        peers.tick( 25 );
+        peers.deliver_to_client();
+        expect( right_edge() >= edge, "right edge kept" );
+        expect( peers.server.stats().receive_buffer <= previous_buffer, "buffer only shrinks" );
+        edge = right_edge();
+        previous_buffer = peers.server.stats().receive_buffer;
+      }
+      expect( peers.server.stats().receive_buffer == initial_capacity, "buffer shrank back" );
+    }
+
+    {
+      // a slow reader does not grow the buffer
+      TCPConfig server_cfg;
+      server_cfg.recv_capacity = initial_capacity;
+      server_cfg.recv_capacity_max = max_capacity;
+      PeerPair peers { TCPConfig {}, server_cfg };
+      peers.connect();
+
+      for ( int i = 0; i < 20; ++i ) {
+        Writer& writer = peers.client.outbound_writer();
+        writer.push( string( writer.available_capacity(), 'x' ) );
+        peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+        peers.tick( 25 );
+        peers.deliver_to_server();
+        peers.tick( 25 );
+        peers.deliver_to_client();
+      }
+      expect( peers.server.stats().receive_buffer == initial_capacity, "buffer unchanged" );
+    }
+
+    {
+      // without a maximum, the buffer is fixed
+      TCPConfig server_cfg;
+      server_cfg.recv_capacity = initial_capacity;
+      PeerPair peers { TCPConfig {}, server_cfg };
+      peers.connect();
+      for ( int i = 0; i < 10; ++i ) {
+        round_trip( peers );
+      }
+      expect( peers.server.stats().receive_buffer == initial_capacity, "auto-tuning disabled" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
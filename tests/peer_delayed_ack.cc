@@ -0,0 +1,137 @@
+#include "peer_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+// Connect a pair of peers and queue `len` bytes from client to server (without delivering them)
+void queue_data( PeerPair& peers, size_t len, bool close = false )
+{
+  peers.client.outbound_writer().push( string( len, 'x' ) );
+  if ( close ) {
+    peers.client.outbound_writer().close();
+  }
+  peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+}
+
+// Hand one queued segment to the server; returns how many segments the server sent in reply
+size_t deliver_one( PeerPair& peers, size_t index = 0 )
+{
+  deque<TCPMessage> replies;
+  TCPMessage msg = peers.to_server.at( index );
+  peers.to_server.erase( peers.to_server.begin() + static_cast<ptrdiff_t>( index ) );
+  peers.server.receive( std::move( msg ), PeerPair::transmit_into( replies ) );
+  return replies.size();
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // bulk data: every second segment is acknowledged
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.connect();
+      queue_data( peers, 10 * TCPConfig::MAX_PAYLOAD_SIZE );
+      expect( peers.to_server.size() == 10, "ten segments sent" );
+
+      size_t acks = 0;
+      while ( not peers.to_server.empty() ) {
+        acks += deliver_one( peers );
+      }
+      expect( acks == 5, "one ACK per two segments (got " + to_string( acks ) + ")" );
+      expect( peers.server.acks_coalesced() == 5, "five ACKs coalesced" );
+    }
+
+    {
+      // a lone segment is acknowledged when the delay expires
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.connect();
+      queue_data( peers, 100 );
+      expect( deliver_one( peers ) == 0, "ACK delayed" );
+
+      deque<TCPMessage> replies;
+      peers.server.tick( TCPConfig::ACK_DELAY_DFLT - 1, PeerPair::transmit_into( replies ) );
+      expect( replies.empty(), "ACK still delayed" );
+      peers.server.tick( 1, PeerPair::transmit_into( replies ) );
+      expect( replies.size() == 1, "ACK sent after the delay" );
+      expect( replies.front().receiver.ackno == peers.server.receiver().send().ackno, "ACK is current" );
+    }
+
+    {
+      // a delayed ACK is dropped once the peer is no longer active
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.connect();
+      queue_data( peers, 100 );
+      expect( deliver_one( peers ) == 0, "ACK delayed" );
+      peers.server.inbound_reader().set_error();
+
+      deque<TCPMessage> replies;
+      peers.server.tick( TCPConfig::ACK_DELAY_DFLT, PeerPair::transmit_into( replies ) );
+      expect( not peers.server.active(), "peer inactive" );
+      expect( replies.empty(), "no ACK from an inactive peer" );
+    }
+
+    {
+      // out-of-order data, and data that fills the hole, are acknowledged immediately
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.connect();
+      queue_data( peers, 3 * TCPConfig::MAX_PAYLOAD_SIZE );
+      expect( deliver_one( peers, 1 ) == 1, "out-of-order segment acknowledged" );
+      expect( deliver_one( peers, 0 ) == 1, "hole-filling segment acknowledged" );
+      expect( deliver_one( peers, 0 ) == 0, "in-order segment delayed again" );
+    }
+
+    {
+      // FIN is acknowledged immediately
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.connect();
+      queue_data( peers, 100, true );
+      expect( peers.to_server.size() == 1 and peers.to_server.front().sender.FIN, "data sent with FIN" );
+      expect( deliver_one( peers ) == 1, "FIN acknowledged" );
+    }
+
+    {
+      // a zero ack_delay_ms acknowledges every segment
+      TCPConfig cfg;
+      cfg.ack_delay_ms = 0;
+      PeerPair peers { cfg, cfg };
+      peers.connect();
+      queue_data( peers, 4 * TCPConfig::MAX_PAYLOAD_SIZE );
+      size_t acks = 0;
+      while ( not peers.to_server.empty() ) {
+        acks += deliver_one( peers );
+      }
+      expect( acks == 4, "every segment acknowledged" );
+      expect( peers.server.acks_coalesced() == 0, "nothing coalesced" );
+    }
+
+    {
+      // a window that opens up after the application reads is announced
+      TCPConfig server_cfg;
+      server_cfg.recv_capacity = 2 * TCPConfig::MAX_PAYLOAD_SIZE;
+      PeerPair peers { TCPConfig {}, server_cfg };
+      peers.connect();
+      queue_data( peers, 2 * TCPConfig::MAX_PAYLOAD_SIZE );
+      peers.deliver();
+      expect( peers.server.receiver().send().window_size == 0, "window closed" );
+
+      peers.server.inbound_reader().pop( 2 * TCPConfig::MAX_PAYLOAD_SIZE );
+      deque<TCPMessage> replies;
+      peers.server.tick( 0, PeerPair::transmit_into( replies ) );
+      expect( replies.size() == 1, "window update sent" );
+      expect( replies.front().receiver.window_size == 2 * TCPConfig::MAX_PAYLOAD_SIZE, "window reopened" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+#include "peer_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+// Connect a pair of peers and queue `len` bytes from client to server (without delivering them)
+vector<TCPMessage> queue_data( PeerPair& peers, size_t len, bool close = false )
+{
+  peers.connect();
+  peers.client.outbound_writer().push( string( len, 'x' ) );
+  if ( close ) {
+    peers.client.outbound_writer().close();
+  }
+  peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+  vector<TCPMessage> batch { peers.to_server.begin(), peers.to_server.end() };
+  peers.to_server.clear();
+  return batch;
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // a burst of in-order segments is reassembled as one, and acknowledged once
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      vector<TCPMessage> batch = queue_data( peers, 10 * TCPConfig::MAX_PAYLOAD_SIZE );
+      expect( batch.size() == 10, "ten segments sent" );
+
+      deque<TCPMessage> replies;
+      peers.server.receive_batch( std::move( batch ), PeerPair::transmit_into( replies ) );
+      expect( peers.server.segments_coalesced() == 9, "nine segments merged into the first" );
+      expect( peers.server.stats().segments_received == 12, "every segment on the wire counted" );
+      expect( peers.server.inbound_reader().bytes_buffered() == 10 * TCPConfig::MAX_PAYLOAD_SIZE,
+              "all data received" );
+      expect( replies.size() == 1, "one ACK for the batch (got " + to_string( replies.size() ) + ")" );
+      expect( replies.front().receiver.ackno == peers.server.receiver().send().ackno, "ACK covers the batch" );
+    }
+
+    {
+      // segments don't merge across a gap, but the data still arrives
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      vector<TCPMessage> batch = queue_data( peers, 4 * TCPConfig::MAX_PAYLOAD_SIZE );
+      swap( batch.at( 2 ), batch.at( 3 ) );
+
+      deque<TCPMessage> replies;
+      peers.server.receive_batch( std::move( batch ), PeerPair::transmit_into( replies ) );
+      expect( peers.server.segments_coalesced() == 1, "only the contiguous prefix merged" );
+      expect( peers.server.inbound_reader().bytes_buffered() == 4 * TCPConfig::MAX_PAYLOAD_SIZE,
+              "all data received" );
+      expect( replies.size() == 1, "one ACK for the batch" );
+    }
+
+    {
+      // a FIN on the last segment is carried by the merged segment
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      vector<TCPMessage> batch = queue_data( peers, 3 * TCPConfig::MAX_PAYLOAD_SIZE, true );
+      expect( batch.back().sender.FIN, "last segment carries FIN" );
+
+      deque<TCPMessage> replies;
+      peers.server.receive_batch( std::move( batch ), PeerPair::transmit_into( replies ) );
+      expect( peers.server.segments_coalesced() == 2, "FIN segment merged" );
+      expect( peers.server.receiver().writer().is_closed(), "inbound stream finished" );
+    }
+
+    {
+      // segments whose headers differ are not merged
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      vector<TCPMessage> batch = queue_data( peers, 2 * TCPConfig::MAX_PAYLOAD_SIZE );
+      batch.at( 1 ).receiver.window_size -= 1;
+
+      deque<TCPMessage> replies;
+      peers.server.receive_batch( std::move( batch ), PeerPair::transmit_into( replies ) );
+      expect( peers.server.segments_coalesced() == 0, "nothing merged" );
+      expect( peers.server.inbound_reader().bytes_buffered() == 2 * TCPConfig::MAX_PAYLOAD_SIZE,
+              "all data received" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
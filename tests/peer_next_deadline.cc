@@ -0,0 +1,101 @@
+#include "peer_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+string describe( optional<uint64_t> deadline )
+{
+  return deadline.has_value() ? to_string( deadline.value() ) + " ms" : "none";
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // an idle connection has nothing scheduled
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      expect( not peers.client.next_deadline().has_value(), "nothing scheduled before connecting" );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      expect( peers.client.next_deadline() == TCPConfig::TIMEOUT_DFLT, "SYN awaits its retransmission timer" );
+      peers.deliver();
+      expect( not peers.client.next_deadline().has_value(),
+              "idle client (got " + describe( peers.client.next_deadline() ) + ")" );
+      expect( not peers.server.next_deadline().has_value(),
+              "idle server (got " + describe( peers.server.next_deadline() ) + ")" );
+    }
+
+    {
+      // outstanding data and a delayed ACK each schedule a wakeup
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.connect();
+      peers.client.outbound_writer().push( "hello" );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      peers.deliver_to_server();
+      expect( peers.server.next_deadline() == TCPConfig::ACK_DELAY_DFLT,
+              "delayed ACK due (got " + describe( peers.server.next_deadline() ) + ")" );
+
+      peers.tick( 30 );
+      expect( peers.client.next_deadline() == peers.client.sender().current_RTO() - 30,
+              "retransmission timer counts down (got " + describe( peers.client.next_deadline() ) + ")" );
+      expect( peers.server.next_deadline() == TCPConfig::ACK_DELAY_DFLT - 30, "ACK timer counts down" );
+
+      peers.tick( 10 );
+      peers.deliver();
+      expect( not peers.server.next_deadline().has_value(), "ACK sent" );
+      expect( not peers.client.next_deadline().has_value(), "data acknowledged" );
+    }
+
+    {
+      // a stalled reader keeps an auto-tuned buffer from shrinking, so the idle timer isn't due
+      TCPConfig server_cfg;
+      server_cfg.recv_capacity = 4000;
+      server_cfg.recv_capacity_max = 64000;
+      PeerPair peers { TCPConfig {}, server_cfg };
+      peers.connect();
+      peers.client.outbound_writer().push( "hello" );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      peers.deliver();
+      for ( uint64_t elapsed = 0; elapsed < 3 * TCPConfig::RECV_IDLE_MS; elapsed += 100 ) {
+        peers.tick( 100 );
+        peers.deliver();
+        const auto deadline = peers.server.next_deadline();
+        expect( deadline.value_or( 1 ) > 0, "no busy wakeups while the data sits unread" );
+      }
+      expect( peers.server.inbound_reader().bytes_buffered() == 5, "data still unread" );
+    }
+
+    {
+      // a peer lingering after both streams finish wakes up when lingering ends
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.connect();
+      peers.client.outbound_writer().close();
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      peers.deliver();
+      peers.server.outbound_writer().close();
+      peers.server.push( PeerPair::transmit_into( peers.to_client ) );
+      peers.deliver();
+
+      expect( peers.client.active(), "client lingering" );
+      expect( peers.client.next_deadline() == 10UL * TCPConfig::TIMEOUT_DFLT,
+              "lingering ends on time (got " + describe( peers.client.next_deadline() ) + ")" );
+      peers.tick( 10UL * TCPConfig::TIMEOUT_DFLT - 1 );
+      expect( peers.client.active(), "client still lingering" );
+      peers.tick( 1 );
+      expect( not peers.client.active(), "client done" );
+      expect( not peers.client.next_deadline().has_value(), "inactive peer has nothing scheduled" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+#include "peer_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      TCPConfig server_cfg;
+      server_cfg.recv_capacity = 10000;
+      PeerPair peers { TCPConfig {}, server_cfg };
+      peers.connect();
+
+      const TCPStats fresh = peers.client.stats();
+      expect( fresh.segments_sent == 2, "SYN and ACK sent" );
+      expect( fresh.segments_received == 1, "SYN-ACK received" );
+      expect( fresh.peer_window == 10000, "peer window learned from SYN-ACK" );
+      expect( fresh.srtt_ms.has_value(), "RTT measured during handshake" );
+
+      peers.client.outbound_writer().push( string( 2500, 'x' ) );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      const TCPStats sending = peers.client.stats();
+      expect( sending.bytes_sent == 2500, "bytes sent" );
+      expect( sending.bytes_in_flight == 2500, "bytes in flight" );
+      expect( sending.bytes_acked == 0, "nothing acknowledged yet" );
+
+      // lose the last segment, and let it be retransmitted
+      peers.to_server.pop_back();
+      peers.deliver();
+      const TCPStats server = peers.server.stats();
+      expect( server.bytes_received == 2000, "server reassembled two segments" );
+      expect( server.inbound_buffered == 2000, "unread bytes buffered" );
+      expect( server.advertised_window == 8000, "window shrinks by unread bytes" );
+
+      peers.tick( TCPConfig::TIMEOUT_DFLT );
+      const TCPStats retx = peers.client.stats();
+      expect( retx.segments_retransmitted == 1, "one retransmission" );
+      expect( retx.consecutive_retransmissions == 1, "one consecutive retransmission" );
+
+      peers.deliver();
+      peers.tick( TCPConfig::ACK_DELAY_DFLT );
+      peers.deliver();
+      const TCPStats done = peers.client.stats();
+      expect( done.bytes_acked == 2500, "everything acknowledged" );
+      expect( done.bytes_in_flight == 0, "nothing in flight" );
+      expect( done.consecutive_retransmissions == 0, "retransmission counter reset" );
+      expect( peers.server.stats().acks_coalesced > 0, "server delayed some ACKs" );
+    }
+
+    {
+      // out-of-order bytes show up as pending in the reassembler
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.connect();
+      peers.client.outbound_writer().push( string( 2000, 'y' ) );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      peers.to_server.pop_front();
+      peers.deliver();
+      expect( peers.server.stats().reassembler_bytes_pending == 1000, "one segment held back" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "parser.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+#include "tcp_segment.hh"
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Serialize a TCPMessage into a TCP segment and parse it back, as it would look to the remote peer
+inline TCPMessage over_the_wire( const TCPMessage& msg )
+{
+  TCPSegment seg { .message = msg };
+  seg.compute_checksum( 0 );
+
+  TCPSegment parsed;
+  if ( not parse( parsed, serialize( seg ), 0 ) ) {
+    throw std::runtime_error( "TCP segment failed to parse after serialization" );
+  }
+  return parsed.message;
+}
+
+// Two TCPPeers connected back-to-back by a lossless in-memory link
+struct PeerPair
+{
+  TCPPeer client;
+  TCPPeer server;
+
+  std::deque<TCPMessage> to_server {};
+  std::deque<TCPMessage> to_client {};
+
+  PeerPair( const TCPConfig& client_cfg, const TCPConfig& server_cfg ) : client( client_cfg ), server( server_cfg )
+  {}
+
+  static TCPPeer::TransmitFunction transmit_into( std::deque<TCPMessage>& queue )
+  {
+    return [&queue]( TCPMessage msg ) { queue.push_back( over_the_wire( msg ) ); };
+  }
+
+  // Deliver every queued message (and any replies they provoke) until the link is quiet
+  void deliver()
+  {
+    while ( not to_server.empty() or not to_client.empty() ) {
+      while ( not to_server.empty() ) {
+        TCPMessage msg = std::move( to_server.front() );
+        to_server.pop_front();
+        server.receive( std::move( msg ), transmit_into( to_client ) );
+      }
+      while ( not to_client.empty() ) {
+        TCPMessage msg = std::move( to_client.front() );
+        to_client.pop_front();
+        client.receive( std::move( msg ), transmit_into( to_server ) );
+      }
+    }
+  }
+
+  // Deliver only the messages already queued in one direction (replies stay queued for later)
+  void deliver_to_server()
+  {
+    std::deque<TCPMessage> batch = std::exchange( to_server, {} );
+    for ( auto& msg : batch ) {
+      server.receive( std::move( msg ), transmit_into( to_client ) );
+    }
+  }
+
+  void deliver_to_client()
+  {
+    std::deque<TCPMessage> batch = std::exchange( to_client, {} );
+    for ( auto& msg : batch ) {
+      client.receive( std::move( msg ), transmit_into( to_server ) );
+    }
+  }
+
+  void connect()
+  {
+    client.push( transmit_into( to_server ) );
+    deliver();
+  }
+
+  void tick( uint64_t ms )
+  {
+    client.tick( ms, transmit_into( to_server ) );
+    server.tick( ms, transmit_into( to_client ) );
+  }
+};
@@ -0,0 +1,130 @@
+#include "peer_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      // TSval and TSecr survive serialization; TSecr is only meaningful with the ACK bit
+      TCPMessage msg;
+      msg.sender.SYN = true;
+      msg.sender.TSval = 0xdeadbeef;
+      msg.receiver.ackno = Wrap32 { 17 };
+      msg.receiver.TSecr = 12345;
+      msg.receiver.window_scale = 3;
+      const TCPMessage parsed = over_the_wire( msg );
+      expect( parsed.sender.TSval == 0xdeadbeef, "TSval preserved" );
+      expect( parsed.receiver.TSecr == 12345, "TSecr preserved" );
+      expect( parsed.receiver.window_scale == 3, "window scale preserved alongside timestamps" );
+
+      msg.receiver.ackno.reset();
+      expect( not over_the_wire( msg ).receiver.TSecr.has_value(), "no TSecr without ACK" );
+    }
+
+    {
+      // RTT samples from echoed timestamps drive the RTO
+      TCPSender sender { ByteStream { 1000 }, Wrap32 { 0 }, 1000 };
+      sender.push( [&]( const TCPSenderMessage& ) {} ); // SYN at t=0
+      sender.tick( 100, [&]( const TCPSenderMessage& ) {} );
+      expect( not sender.smoothed_rtt().has_value(), "no RTT before an echo arrives" );
+
+      TCPReceiverMessage ack { Wrap32 { 1 }, 1000 };
+      ack.TSecr = 0;
+      sender.receive( ack );
+      expect( sender.smoothed_rtt() == 100, "first sample initializes SRTT" );
+      expect( sender.current_RTO() == 300, "RTO = SRTT + 4 * RTTVAR" );
+
+      // a retransmission, acknowledged with the echo of the retransmitted copy
+      sender.writer().push( "abc" );
+      unsigned transmissions = 0;
+      sender.push( [&]( const TCPSenderMessage& ) { ++transmissions; } ); // sent at t=100
+      sender.tick( 300, [&]( const TCPSenderMessage& ) { ++transmissions; } ); // retransmitted at t=400
+      expect( transmissions == 2, "segment retransmitted after the measured RTO" );
+      sender.tick( 100, [&]( const TCPSenderMessage& ) {} );
+
+      ack.ackno = Wrap32 { 4 };
+      ack.TSecr = 400;
+      sender.receive( ack );
+      expect( sender.smoothed_rtt() == ( 7 * 100 + 100 ) / 8, "sample measured from the retransmission" );
+    }
+
+    {
+      // both peers stamp every segment once the option is negotiated
+      PeerPair peers { TCPConfig {}, TCPConfig {} };
+      peers.tick( 1000 );
+      peers.connect();
+
+      peers.client.outbound_writer().push( "abc" );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      expect( peers.to_server.size() == 1, "segment sent" );
+      expect( peers.to_server.front().sender.TSval == 1000, "data stamped with the sender's clock" );
+      expect( peers.to_server.front().receiver.TSecr == 1000, "peer's timestamp echoed" );
+      peers.tick( 20 );
+      peers.deliver();
+      expect( peers.client.sender().smoothed_rtt().has_value(), "client measured the RTT" );
+
+      // PAWS: a segment with an acceptable seqno but an old timestamp is an old duplicate
+      TCPMessage stale;
+      stale.sender.seqno = peers.server.receiver().send().ackno.value();
+      stale.sender.payload = "xyz";
+      stale.sender.TSval = 999;
+      stale.receiver.ackno = peers.client.receiver().send().ackno;
+      stale.receiver.window_size = 1000;
+
+      deque<TCPMessage> replies;
+      peers.server.receive( stale, PeerPair::transmit_into( replies ) );
+      expect( peers.server.inbound_reader().bytes_buffered() == 3, "stale segment discarded" );
+      expect( not replies.empty(), "stale segment acknowledged" );
+
+      // ... even one that carries no data
+      stale.sender.payload.clear();
+      replies.clear();
+      peers.server.receive( stale, PeerPair::transmit_into( replies ) );
+      expect( replies.size() == 1, "stale ACK acknowledged" );
+
+      // TS.Recent only follows segments that start at or before the last ackno sent (RFC 7323 4.3): with an
+      // ACK delayed, the timestamp echoed is that of the earlier segment
+      const Wrap32 last_ack_sent = replies.back().receiver.ackno.value();
+      TCPMessage first = stale;
+      first.sender.seqno = last_ack_sent;
+      first.sender.payload = "0123456789";
+      first.sender.TSval = 6000;
+      TCPMessage second = first;
+      second.sender.seqno = last_ack_sent + 10;
+      second.sender.TSval = 7000;
+      replies.clear();
+      peers.server.receive( first, PeerPair::transmit_into( replies ) );
+      expect( replies.empty(), "ACK delayed" );
+      peers.server.receive( second, PeerPair::transmit_into( replies ) );
+      expect( replies.size() == 1 and replies.back().receiver.TSecr == 6000, "earlier timestamp echoed" );
+    }
+
+    {
+      // no timestamps in reply to a SYN that didn't offer them
+      TCPPeer server { TCPConfig {} };
+      TCPMessage syn;
+      syn.sender.SYN = true;
+      syn.sender.seqno = Wrap32 { 1000 };
+      syn.receiver.window_size = 5000;
+
+      deque<TCPMessage> replies;
+      server.receive( syn, PeerPair::transmit_into( replies ) );
+      expect( not replies.empty() and replies.front().sender.SYN, "SYN-ACK sent" );
+      expect( not replies.front().sender.TSval.has_value(), "no TSval in reply" );
+      expect( not replies.front().receiver.TSecr.has_value(), "no TSecr in reply" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
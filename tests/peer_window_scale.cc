@@ -0,0 +1,116 @@
+#include "peer_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+TCPConfig config_with_capacity( uint64_t capacity )
+{
+  TCPConfig cfg;
+  cfg.recv_capacity = capacity;
+  cfg.send_capacity = capacity;
+  return cfg;
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // window scale option survives serialization, and is absent unless set
+      TCPMessage msg;
+      msg.sender.SYN = true;
+      msg.receiver.window_size = 12345;
+      msg.receiver.window_scale = 7;
+      const TCPMessage parsed = over_the_wire( msg );
+      expect( parsed.sender.SYN, "SYN flag preserved" );
+      expect( parsed.receiver.window_size == 12345, "window preserved" );
+      expect( parsed.receiver.window_scale == 7, "window scale option preserved" );
+
+      msg.receiver.window_scale.reset();
+      msg.sender.payload = "hello";
+      const TCPMessage plain = over_the_wire( msg );
+      expect( not plain.receiver.window_scale.has_value(), "no window scale option" );
+      expect( plain.sender.payload == "hello", "payload preserved" );
+    }
+
+    {
+      // large receive capacities are advertised once both peers agree on scaling
+      const uint64_t cap = 4 * 1024 * 1024;
+      PeerPair peers { config_with_capacity( cap ), config_with_capacity( cap ) };
+      peers.connect();
+      expect( peers.client.has_ackno() and peers.server.has_ackno(), "handshake completed" );
+
+      // the window in the SYN-ACK is unscaled; the first acknowledgment reveals the real one
+      peers.client.outbound_writer().push( "hello" );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      peers.deliver();
+      peers.tick( TCPConfig::ACK_DELAY_DFLT );
+      peers.deliver();
+
+      const string data( cap / 2, 'x' );
+      peers.client.outbound_writer().push( data );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      expect( peers.client.sender().sequence_numbers_in_flight() == data.size(),
+              "whole write in flight (got " + to_string( peers.client.sender().sequence_numbers_in_flight() )
+                + ")" );
+      for ( const auto& msg : peers.to_server ) {
+        expect( msg.receiver.window_size <= UINT16_MAX, "wire window fits in 16 bits" );
+      }
+
+      peers.deliver();
+      peers.tick( TCPConfig::ACK_DELAY_DFLT );
+      peers.deliver();
+      expect( peers.server.inbound_reader().bytes_buffered() == data.size() + 5, "server received everything" );
+      expect( peers.client.sender().sequence_numbers_in_flight() == 0, "everything acknowledged" );
+    }
+
+    {
+      // a peer with a small buffer still negotiates (with shift 0) and windows are unchanged
+      PeerPair peers { config_with_capacity( 4 * 1024 * 1024 ), config_with_capacity( 2000 ) };
+      peers.connect();
+
+      const string data( 10000, 'y' );
+      peers.client.outbound_writer().push( data );
+      peers.client.push( PeerPair::transmit_into( peers.to_server ) );
+      expect( peers.client.sender().sequence_numbers_in_flight() == 2000, "limited by peer's window" );
+    }
+
+    {
+      // a SYN without the option disables scaling in both directions
+      TCPPeer server { config_with_capacity( 4 * 1024 * 1024 ) };
+      TCPMessage syn;
+      syn.sender.SYN = true;
+      syn.sender.seqno = Wrap32 { 1000 };
+      syn.receiver.window_size = 5000;
+
+      deque<TCPMessage> replies;
+      server.receive( syn, PeerPair::transmit_into( replies ) );
+      expect( not replies.empty(), "SYN-ACK sent" );
+      expect( replies.front().sender.SYN, "reply is SYN-ACK" );
+      expect( not replies.front().receiver.window_scale.has_value(), "no option offered in reply" );
+
+      TCPMessage ack;
+      ack.sender.seqno = Wrap32 { 1001 };
+      ack.sender.payload = "abc";
+      ack.receiver.ackno = replies.front().sender.seqno + 1;
+      ack.receiver.window_size = 5000;
+      replies.clear();
+      server.receive( ack, PeerPair::transmit_into( replies ) );
+      server.tick( TCPConfig::ACK_DELAY_DFLT, PeerPair::transmit_into( replies ) );
+      expect( not replies.empty(), "data acknowledged" );
+      expect( replies.back().receiver.window_size == UINT16_MAX, "unscaled window clamped to 16 bits" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -61,11 +61,11 @@ public:
   using TestHarness<TCPReceiver>::execute;
 };
 
-struct ExpectWindow : public ExpectNumber<TCPReceiver, uint16_t>
+struct ExpectWindow : public ExpectNumber<TCPReceiver, uint32_t>
 {
   using ExpectNumber::ExpectNumber;
   std::string name() const override { return "window_size"; }
-  uint16_t value( TCPReceiver& rs ) const override { return rs.send().window_size; }
+  uint32_t value( TCPReceiver& rs ) const override { return rs.send().window_size; }
 };
 
 struct ExpectAckno : public ExpectNumber<TCPReceiver, std::optional<Wrap32>>
@@ -199,7 +199,7 @@ struct Receive : public Action<SenderAndOutput>
     return desc.str();
   }
 
-  Receive& with_win( uint16_t win )
+  Receive& with_win( uint32_t win )
   {
     msg_.window_size = win;
     return *this;
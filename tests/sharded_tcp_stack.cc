@@ -0,0 +1,250 @@
+#include "sharded_tcp_stack.hh"
+#include "stack_test_harness.hh"
+#include "test_should_be.hh"
+
+#include "exception.hh"
+#include "parser.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+pair<FileDescriptor, FileDescriptor> datagram_pair()
+{
+  array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+// Echo everything each connection receives (each shard only touches its own list of connections)
+ShardedTCPStack::Handler echo_handler( vector<vector<FourTuple>>& accepted )
+{
+  return [&accepted]( ShardedTCPStack::Shard& shard ) {
+    auto& mine = accepted.at( shard.index() );
+    while ( const auto id = shard.stack().accept() ) {
+      mine.push_back( id.value() );
+    }
+    for ( const auto& id : mine ) {
+      if ( not shard.stack().has_connection( id ) ) {
+        continue;
+      }
+      TCPPeer& peer = shard.stack().connection( id );
+      Reader& inbound = peer.inbound_reader();
+      if ( inbound.bytes_buffered() > 0 ) {
+        peer.outbound_writer().push( string { inbound.peek() } );
+        inbound.pop( inbound.bytes_buffered() );
+        shard.push( id );
+      }
+    }
+  };
+}
+
+// A TCPStack talking to the sharded server over `fds` (one, or one per shard, in which case each
+// datagram goes to the fd of the shard it belongs to), driven by its own EventLoop
+class Client
+{
+public:
+  Client( ShardedTCPStack& server, vector<FileDescriptor>& fds )
+    : transmit_( [&server, &fds]( const InternetDatagram& dgram ) {
+      const size_t shard = server.shard_of( TCPStack::four_tuple_of( dgram ).value() );
+      fds.at( fds.size() == 1 ? 0 : shard ).write( serialize( dgram ) );
+    } )
+  {
+    for ( auto& fd : fds ) {
+      loop_.add_rule( "client receive", fd, Direction::In, [this, &fd] {
+        vector<string> strs( 2 );
+        strs.front().resize( IPv4Header::LENGTH );
+        fd.read( strs );
+        InternetDatagram dgram;
+        if ( parse( dgram, std::move( strs ) ) ) {
+          stack_.receive( std::move( dgram ), transmit_ );
+        }
+      } );
+    }
+    loop_.add_timer(
+      "client tick", chrono::milliseconds( 10 ), [this] { stack_.tick( 10, transmit_ ); }, chrono::milliseconds( 10 ) );
+  }
+
+  FourTuple connect( uint16_t port, const string& data )
+  {
+    return stack_.connect_with_data( Address { "10.0.0.2", port }, server_address, data, transmit_ );
+  }
+
+  // Serve events until `done()` (for at most ten seconds)
+  template<class Predicate>
+  bool run_until( const Predicate& done )
+  {
+    const auto deadline = chrono::steady_clock::now() + chrono::seconds( 10 );
+    while ( not done() and chrono::steady_clock::now() < deadline ) {
+      loop_.wait_next_event( 10 );
+    }
+    return done();
+  }
+
+  bool echoed( const FourTuple& id, const string& data )
+  {
+    return stack_.connection( id ).inbound_reader().peek() == data;
+  }
+
+private:
+  TCPStack stack_ { TCPConfig {} };
+  TCPStack::TransmitFunction transmit_;
+  EventLoop loop_ {};
+};
+
+// Connect `count` clients to the sharded server, and check that each gets its echo
+void run_clients( ShardedTCPStack& server, vector<FileDescriptor>& client_fds, uint16_t count )
+{
+  Client client { server, client_fds };
+  vector<FourTuple> ids;
+  for ( uint16_t i = 0; i < count; ++i ) {
+    ids.push_back( client.connect( static_cast<uint16_t>( 5000 + i ), "hello " + to_string( i ) ) );
+  }
+
+  const auto all_echoed = [&] {
+    for ( uint16_t i = 0; i < count; ++i ) {
+      if ( not client.echoed( ids[i], "hello " + to_string( i ) ) ) {
+        return false;
+      }
+    }
+    return true;
+  };
+  expect( client.run_until( all_echoed ), "every connection echoed" );
+}
+} // namespace
+
+int main()
+{
+  try {
+    constexpr size_t shards = 4;
+    constexpr uint16_t clients = 32;
+
+    for ( const bool fd_per_shard : { true, false } ) {
+      const string mode = fd_per_shard ? "fd per shard" : "shared fd";
+      ShardedTCPStack server { TCPConfig {}, shards };
+      server.listen( server_address.port() );
+
+      vector<FileDescriptor> server_fds;
+      vector<FileDescriptor> client_fds;
+      for ( size_t i = 0; i < ( fd_per_shard ? shards : 1 ); ++i ) {
+        auto [server_fd, client_fd] = datagram_pair();
+        server_fds.push_back( std::move( server_fd ) );
+        client_fds.push_back( std::move( client_fd ) );
+      }
+
+      vector<vector<FourTuple>> accepted( shards );
+      server.start( std::move( server_fds ), echo_handler( accepted ) );
+      run_clients( server, client_fds, clients );
+
+      const auto stats = server.stats();
+      size_t connections = 0;
+      size_t busy_shards = 0;
+      uint64_t handed_off = 0;
+      for ( const auto& shard : stats ) {
+        connections += shard.connections;
+        busy_shards += shard.connections > 0;
+        handed_off += shard.datagrams_handed_off;
+      }
+      server.stop();
+
+      expect( connections == clients, mode + ": every connection counted once" );
+      expect( busy_shards > 1, mode + ": connections spread over the shards" );
+      for ( size_t i = 0; i < shards; ++i ) {
+        for ( const auto& id : accepted[i] ) {
+          expect( server.shard_of( id ) == i, mode + ": connection on the shard of its four-tuple" );
+        }
+      }
+      if ( fd_per_shard ) {
+        expect( handed_off == 0, mode + ": steered datagrams stay on their shard" );
+      } else {
+        expect( handed_off > 0 and stats[0].datagrams_handed_off == handed_off, mode + ": shard 0 hands them on" );
+      }
+    }
+
+    {
+      // a Fast Open cookie granted by one shard is good on the others
+      ShardedTCPStack server { TCPConfig {}, shards };
+      server.listen( server_address.port(), TCPStack::DEFAULT_BACKLOG, true );
+      auto [server_fd, client_fd] = datagram_pair();
+      vector<FileDescriptor> server_fds;
+      server_fds.push_back( std::move( server_fd ) );
+      vector<FileDescriptor> client_fds;
+      client_fds.push_back( std::move( client_fd ) );
+      vector<vector<FourTuple>> accepted( shards );
+      server.start( std::move( server_fds ), echo_handler( accepted ) );
+
+      Client client { server, client_fds };
+      const FourTuple first = client.connect( 5000, "first" );
+      expect( client.run_until( [&] { return client.echoed( first, "first" ); } ), "first connection echoed" );
+
+      uint16_t port = 5001;
+      while ( server.shard_of( reversed( FourTuple { first.local_ip, port, first.remote_ip, first.remote_port } ) )
+              == server.shard_of( reversed( first ) ) ) {
+        ++port;
+      }
+      const FourTuple second = client.connect( port, "second" );
+      expect( client.run_until( [&] { return client.echoed( second, "second" ); } ), "second connection echoed" );
+
+      atomic<int> fast_open_accepted { -1 };
+      server.post( server.shard_of( reversed( second ) ), [&]( ShardedTCPStack::Shard& shard ) {
+        fast_open_accepted = static_cast<int>( shard.stack().fast_open_accepted() );
+      } );
+      expect( client.run_until( [&] { return fast_open_accepted >= 0; } ), "shard answered" );
+      server.stop();
+      expect( fast_open_accepted == 1, "cookie from another shard accepted" );
+    }
+
+    {
+      // connect() runs on the shard the connection belongs to
+      ShardedTCPStack stack { TCPConfig {}, shards };
+      auto [fd, other_end] = datagram_pair();
+      vector<FileDescriptor> fds;
+      fds.push_back( std::move( fd ) );
+      stack.start( std::move( fds ), [&]( ShardedTCPStack::Shard& ) {} );
+      const FourTuple id = stack.connect( Address { "10.0.0.2", 6000 }, server_address ).get();
+
+      vector<string> strs( 2 );
+      strs.front().resize( IPv4Header::LENGTH );
+      other_end.read( strs );
+      InternetDatagram dgram;
+      expect( parse( dgram, std::move( strs ) ), "SYN sent" );
+      expect( TCPStack::four_tuple_of( dgram ) == reversed( id ), "from the new connection" );
+
+      // connecting the same four-tuple again fails on the caller's side, and the shard carries on
+      auto again = stack.connect( Address { "10.0.0.2", 6000 }, server_address );
+      bool refused = false;
+      try {
+        again.get();
+      } catch ( const runtime_error& ) {
+        refused = true;
+      }
+      expect( refused, "duplicate connection refused" );
+      const FourTuple next = stack.connect( Address { "10.0.0.2", 6001 }, server_address ).get();
+      bool next_sent = false;
+      for ( int i = 0; i < 4 and not next_sent; ++i ) { // (skipping any retransmission of the first SYN)
+        strs.assign( 2, {} );
+        strs.front().resize( IPv4Header::LENGTH );
+        other_end.read( strs );
+        next_sent = parse( dgram, std::move( strs ) ) and TCPStack::four_tuple_of( dgram ) == reversed( next );
+      }
+      expect( next_sent, "shard still serves connections" );
+      stack.stop();
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
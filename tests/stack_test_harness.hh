@@ -0,0 +1,91 @@
+#pragma once
+
+#include "address.hh"
+#include "ipv4_datagram.hh"
+#include "parser.hh"
+#include "tcp_config.hh"
+#include "tcp_stack.hh"
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+
+inline const Address server_address { "10.0.0.1", 80 };
+
+// The same connection, seen from the other end
+inline FourTuple reversed( const FourTuple& id )
+{
+  return { id.remote_ip, id.remote_port, id.local_ip, id.local_port };
+}
+
+// Two TCPStacks connected by a lossless in-memory link that serializes every datagram
+struct StackPair
+{
+  TCPStack client;
+  TCPStack server;
+
+  std::deque<InternetDatagram> to_server {};
+  std::deque<InternetDatagram> to_client {};
+
+  explicit StackPair( const TCPConfig& client_cfg = {}, const TCPConfig& server_cfg = {} )
+    : client( client_cfg ), server( server_cfg )
+  {}
+
+  static TCPStack::TransmitFunction transmit_into( std::deque<InternetDatagram>& queue )
+  {
+    return [&queue]( const InternetDatagram& dgram ) {
+      InternetDatagram parsed;
+      if ( not parse( parsed, serialize( dgram ) ) ) {
+        throw std::runtime_error( "datagram failed to parse after serialization" );
+      }
+      queue.push_back( std::move( parsed ) );
+    };
+  }
+
+  // Deliver only the datagrams already queued in one direction (replies stay queued for later)
+  void deliver_to_server()
+  {
+    std::deque<InternetDatagram> batch = std::exchange( to_server, {} );
+    for ( auto& dgram : batch ) {
+      server.receive( std::move( dgram ), transmit_into( to_client ) );
+    }
+  }
+
+  void deliver_to_client()
+  {
+    std::deque<InternetDatagram> batch = std::exchange( to_client, {} );
+    for ( auto& dgram : batch ) {
+      client.receive( std::move( dgram ), transmit_into( to_server ) );
+    }
+  }
+
+  // Deliver every queued datagram (and any replies they provoke) until the link is quiet
+  void deliver()
+  {
+    while ( not to_server.empty() or not to_client.empty() ) {
+      deliver_to_server();
+      deliver_to_client();
+    }
+  }
+
+  void tick( uint64_t ms )
+  {
+    client.tick( ms, transmit_into( to_server ) );
+    server.tick( ms, transmit_into( to_client ) );
+    deliver();
+  }
+
+  // Send a SYN from the client to the server's address (without delivering it)
+  FourTuple open( uint16_t client_port )
+  {
+    return client.connect( Address { "10.0.0.2", client_port }, server_address, transmit_into( to_server ) );
+  }
+
+  FourTuple connect( uint16_t client_port )
+  {
+    const FourTuple id = open( client_port );
+    deliver();
+    return id;
+  }
+};
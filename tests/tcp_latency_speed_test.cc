@@ -0,0 +1,170 @@
+#include "tcp_minnow_socket.hh"
+#include "tcp_over_udp.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+constexpr size_t ROUND_TRIPS = 2000;
+constexpr size_t MESSAGE_SIZE = 64;
+
+UDPSocket bound_socket()
+{
+  UDPSocket socket;
+  socket.bind( Address { "127.0.0.1", 0 } );
+  return socket;
+}
+
+// Read exactly `size` bytes from a non-blocking socket, sleeping in poll() until they arrive (the same way in every
+// run, so that only the TCPPeer threads' waiting differs)
+string read_exactly( FileDescriptor& fd, const size_t size )
+{
+  string ret;
+  while ( ret.size() < size ) {
+    pollfd pfd { fd.fd_num(), POLLIN, 0 };
+    CheckSystemCall( "poll", ::poll( &pfd, 1, 1000 ) );
+    string chunk( size - ret.size(), 0 );
+    fd.read( chunk );
+    if ( chunk.empty() and fd.eof() ) {
+      throw runtime_error( "connection closed" );
+    }
+    ret += chunk;
+  }
+  return ret;
+}
+
+// Round-trip times of small messages between two TCPMinnowSockets over loopback UDP
+vector<nanoseconds> ping_pong( const TCPThreadConfig& client_thread,
+                               const TCPThreadConfig& server_thread,
+                               const optional<int> client_cpu,
+                               const optional<int> server_cpu )
+{
+  UDPSocket server_udp = bound_socket();
+  UDPSocket client_udp = bound_socket();
+  FdAdapterConfig server_config;
+  server_config.source = server_udp.local_address();
+  FdAdapterConfig client_config;
+  client_config.source = client_udp.local_address();
+  client_config.destination = server_udp.local_address();
+
+  TCPOverUDPMinnowSocket server { TCPOverUDPAdapter { std::move( server_udp ) } };
+  TCPOverUDPMinnowSocket client { TCPOverUDPAdapter { std::move( client_udp ) } };
+  server.set_thread_config( server_thread );
+  client.set_thread_config( client_thread );
+
+  thread echo_thread( [&] {
+    if ( server_cpu.has_value() ) {
+      pin_thread_to_cpu( pthread_self(), server_cpu.value() );
+    }
+    server.listen_and_accept( TCPConfig {}, server_config );
+    for ( size_t i = 0; i < ROUND_TRIPS; ++i ) {
+      server.write( read_exactly( server, MESSAGE_SIZE ) );
+    }
+  } );
+
+  if ( client_cpu.has_value() ) {
+    pin_thread_to_cpu( pthread_self(), client_cpu.value() );
+  }
+  client.connect( TCPConfig {}, client_config );
+
+  const string message( MESSAGE_SIZE, 'x' );
+  vector<nanoseconds> rtts;
+  for ( size_t i = 0; i < ROUND_TRIPS; ++i ) {
+    const auto start = steady_clock::now();
+    client.write( message );
+    if ( read_exactly( client, MESSAGE_SIZE ) != message ) {
+      throw runtime_error( "echo mismatch" );
+    }
+    rtts.push_back( steady_clock::now() - start );
+  }
+  echo_thread.join();
+  return rtts;
+}
+
+// The CPUs this process may run on (which need not be the first ones, e.g. in a cpuset)
+vector<int> allowed_cpus()
+{
+  cpu_set_t mask;
+  CPU_ZERO( &mask );
+  CheckSystemCall( "sched_getaffinity", ::sched_getaffinity( 0, sizeof( mask ), &mask ) );
+  vector<int> ret;
+  for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+    if ( CPU_ISSET( cpu, &mask ) ) { // NOLINT(*-signed-bitwise)
+      ret.push_back( cpu );
+    }
+  }
+  return ret;
+}
+
+double percentile_us( vector<nanoseconds> samples, const double p )
+{
+  sort( samples.begin(), samples.end() );
+  const auto index = static_cast<size_t>( p * static_cast<double>( samples.size() - 1 ) );
+  return static_cast<double>( samples.at( index ).count() ) / 1000;
+}
+
+void program_body()
+{
+  // Pin the four threads (two owners, two TCPPeer threads) to CPUs of their own, if we may use enough of them
+  const vector<int> cpus = allowed_cpus();
+  const bool pin = cpus.size() >= 4;
+  const auto cpu = [&]( size_t n ) { return pin ? optional<int> { cpus.at( n ) } : nullopt; };
+
+  TCPThreadConfig blocking_client;
+  TCPThreadConfig blocking_server;
+  blocking_client.tcp_thread_cpu = cpu( 1 );
+  blocking_server.tcp_thread_cpu = cpu( 3 );
+  TCPThreadConfig busy_client = blocking_client;
+  TCPThreadConfig busy_server = blocking_server;
+  busy_client.busy_poll_us = busy_server.busy_poll_us = 1000;
+
+  const auto blocking = ping_pong( blocking_client, blocking_server, cpu( 0 ), cpu( 2 ) );
+  const auto busy = ping_pong( busy_client, busy_server, cpu( 0 ), cpu( 2 ) );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const double blocking_p50 = percentile_us( blocking, 0.5 );
+  const double blocking_p99 = percentile_us( blocking, 0.99 );
+  const double busy_p50 = percentile_us( busy, 0.5 );
+  const double busy_p99 = percentile_us( busy, 0.99 );
+
+  cout << fixed << setprecision( 1 ) << "TCPMinnowSocket round trips of " << MESSAGE_SIZE << " bytes over loopback ("
+       << cpus.size() << " CPUs, " << ( pin ? "pinned" : "not pinned" ) << "):\n"
+       << "  sleeping in the EventLoop: p50 " << blocking_p50 << " us, p99 " << blocking_p99 << " us\n"
+       << "  busy-polling:              p50 " << busy_p50 << " us, p99 " << busy_p99 << " us\n"
+       << "  latency added by sleeping: p50 " << blocking_p50 - busy_p50 << " us, p99 " << blocking_p99 - busy_p99
+       << " us\n";
+
+  debug_output << fixed << setprecision( 1 ) << "             TCP round trip p50/p99: " << blocking_p50 << "/"
+               << blocking_p99 << " us sleeping, " << busy_p50 << "/" << busy_p99 << " us busy-polling\n";
+}
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
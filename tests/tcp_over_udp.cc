@@ -0,0 +1,215 @@
+#include "tcp_minnow_socket.hh"
+#include "tcp_over_udp.hh"
+#include "test_should_be.hh"
+
+#include "exception.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+UDPSocket bound_socket()
+{
+  UDPSocket socket;
+  socket.bind( Address { "127.0.0.1", 0 } );
+  return socket;
+}
+
+// An adapter on a fresh loopback socket, with FdAdapterConfig::source set to its address
+TCPOverUDPAdapter make_adapter( size_t batch_size = TCPOverUDPAdapter::DEFAULT_BATCH_SIZE )
+{
+  UDPSocket socket = bound_socket();
+  const Address local = socket.local_address();
+  TCPOverUDPAdapter adapter { std::move( socket ), batch_size };
+  adapter.config_mut().source = local;
+  return adapter;
+}
+
+// Read a segment, giving the datagrams time to arrive over loopback
+optional<TCPMessage> read_soon( TCPOverUDPAdapter& adapter )
+{
+  if ( not adapter.has_buffered() ) {
+    pollfd pfd { adapter.fd().fd_num(), POLLIN, 0 };
+    CheckSystemCall( "poll", ::poll( &pfd, 1, 1000 ) );
+  }
+  return adapter.read();
+}
+
+TCPMessage segment( uint32_t seqno, bool SYN = false )
+{
+  TCPMessage msg;
+  msg.sender.seqno = Wrap32 { seqno };
+  msg.sender.SYN = SYN;
+  return msg;
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // a listening adapter takes the sender of the first SYN as its peer
+      TCPOverUDPAdapter client = make_adapter();
+      TCPOverUDPAdapter server = make_adapter();
+      client.config_mut().destination = server.config().source;
+      server.set_listening( true );
+
+      client.write( segment( 5 ) );
+      client.flush();
+      expect( not read_soon( server ).has_value(), "non-SYN ignored while listening" );
+
+      client.write( segment( 7, true ) );
+      client.flush();
+      const auto syn = read_soon( server );
+      expect( syn.has_value() and syn->sender.SYN and syn->sender.seqno == Wrap32 { 7 }, "SYN received" );
+      expect( server.config().destination == client.config().source, "server replies to the client" );
+
+      server.write( segment( 100 ) );
+      server.flush();
+      const auto reply = read_soon( client );
+      expect( reply.has_value() and reply->sender.seqno == Wrap32 { 100 }, "reply received" );
+
+      // a stranger is ignored
+      TCPOverUDPAdapter stranger = make_adapter();
+      stranger.config_mut().destination = server.config().source;
+      stranger.write( segment( 9 ) );
+      stranger.flush();
+      expect( not read_soon( server ).has_value(), "datagram from a stranger ignored" );
+    }
+
+    {
+      // writes wait for a full batch or a flush, and a batch is read with one system call
+      TCPOverUDPAdapter client = make_adapter( 4 );
+      TCPOverUDPAdapter server = make_adapter();
+      client.config_mut().destination = server.config().source;
+      server.config_mut().destination = client.config().source;
+
+      for ( uint32_t i = 0; i < 3; ++i ) {
+        client.write( segment( i ) );
+      }
+      expect( not read_soon( server ).has_value(), "segments held back" );
+      client.flush();
+      client.write( segment( 3 ) );
+      client.write( segment( 4 ) );
+      client.write( segment( 5 ) );
+      client.write( segment( 6 ) ); // fills a batch
+
+      const unsigned reads_before = server.fd().read_count();
+      for ( uint32_t i = 0; i < 7; ++i ) {
+        const auto msg = read_soon( server );
+        expect( msg.has_value() and msg->sender.seqno == Wrap32 { i }, "segment " + to_string( i ) + " in order" );
+      }
+      expect( not server.has_buffered(), "all read" );
+      expect( server.fd().read_count() - reads_before <= 2, "read in batches" );
+    }
+
+    {
+      // a batch of any size is written and read with one system call each, after what was already queued or read
+      TCPOverUDPAdapter client = make_adapter( 4 );
+      TCPOverUDPAdapter server = make_adapter( 4 );
+      client.config_mut().destination = server.config().source;
+      server.config_mut().destination = client.config().source;
+
+      client.write( segment( 0 ) );
+      vector<TCPMessage> out;
+      for ( uint32_t i = 1; i < 20; ++i ) {
+        out.push_back( segment( i ) );
+      }
+      const unsigned writes_before = client.fd().write_count();
+      client.write_batch( out );
+      expect( client.fd().write_count() - writes_before == 1, "written in one batch" );
+
+      const auto first = read_soon( server );
+      expect( first.has_value() and first->sender.seqno == Wrap32 { 0 } and server.has_buffered(), "first read" );
+      const unsigned reads_before = server.fd().read_count();
+      vector<TCPMessage> in;
+      server.read_batch( in, 32 );
+      expect( in.size() == 19 and server.fd().read_count() - reads_before == 1, "read in one batch" );
+      for ( uint32_t i = 0; i < in.size(); ++i ) {
+        expect( in[i].sender.seqno == Wrap32 { i + 1 }, "segment " + to_string( i + 1 ) + " in order" );
+      }
+
+      in.clear();
+      server.read_batch( in, 32 );
+      expect( in.empty(), "nothing more to read" );
+    }
+
+    {
+      // recv_batch keeps its slots (and message headers) from one call to the next, and refills only those that
+      // received data
+      UDPSocket sender = bound_socket();
+      UDPSocket receiver = bound_socket();
+      DatagramSocket::BatchScratch scratch;
+      const auto receive = [&]( vector<string>& payloads, size_t sent ) {
+        for ( size_t i = 0; i < sent; ++i ) {
+          sender.sendto( receiver.local_address(), "datagram " + to_string( i ) );
+        }
+        pollfd pfd { receiver.fd_num(), POLLIN, 0 };
+        CheckSystemCall( "poll", ::poll( &pfd, 1, 1000 ) );
+        vector<Address> sources;
+        return receiver.recv_batch( payloads, sources, 8, scratch );
+      };
+
+      vector<string> payloads;
+      expect( receive( payloads, 2 ) == 2 and payloads[1] == "datagram 1", "first batch" );
+      vector<const char*> buffers;
+      for ( const auto& payload : payloads ) {
+        buffers.push_back( payload.data() );
+      }
+      const mmsghdr* const headers = scratch.msgs.data();
+      string kept = std::move( payloads[0] ); // (the caller keeps one payload)
+      expect( receive( payloads, 3 ) == 3 and payloads[2] == "datagram 2", "second batch" );
+      expect( scratch.msgs.data() == headers, "message headers reused" );
+      expect( payloads.size() == 8, "slots kept" );
+      for ( size_t i = 1; i < payloads.size(); ++i ) {
+        expect( payloads[i].data() == buffers[i], "slot " + to_string( i ) + " reused" );
+      }
+      expect( kept == "datagram 0", "moved-out payload untouched" );
+    }
+
+    {
+      // a whole connection between two TCPMinnowSockets over loopback UDP
+      UDPSocket server_udp = bound_socket();
+      UDPSocket client_udp = bound_socket();
+      FdAdapterConfig server_config;
+      server_config.source = server_udp.local_address();
+      FdAdapterConfig client_config;
+      client_config.source = client_udp.local_address();
+      client_config.destination = server_udp.local_address();
+
+      TCPOverUDPMinnowSocket server { TCPOverUDPAdapter { std::move( server_udp ) } };
+      TCPOverUDPMinnowSocket client { TCPOverUDPAdapter { std::move( client_udp ) } };
+
+      thread accept_thread( [&] { server.listen_and_accept( TCPConfig {}, server_config ); } );
+      client.connect( TCPConfig {}, client_config );
+      accept_thread.join();
+
+      client.write( "hello over UDP" );
+      string received;
+      const auto deadline = chrono::steady_clock::now() + chrono::seconds( 5 );
+      while ( received.size() < 14 and chrono::steady_clock::now() < deadline ) {
+        pollfd pfd { server.fd_num(), POLLIN, 0 };
+        CheckSystemCall( "poll", ::poll( &pfd, 1, 100 ) );
+        string chunk;
+        server.read( chunk );
+        received += chunk;
+      }
+      expect( received == "hello over UDP", "data delivered (got \"" + received + "\")" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+#include "stack_test_harness.hh"
+#include "test_should_be.hh"
+
+#include "exception.hh"
+#include "parser.hh"
+#include "tcp_segment.hh"
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      // several clients, each with its own connection to the same listening port
+      StackPair stacks;
+      stacks.server.listen( server_address.port() );
+
+      vector<FourTuple> clients;
+      for ( uint16_t port = 5000; port < 5003; ++port ) {
+        clients.push_back( stacks.connect( port ) );
+      }
+
+      for ( const auto& id : clients ) {
+        const auto accepted = stacks.server.accept();
+        expect( accepted.has_value(), "connection accepted" );
+        expect( accepted.value() == reversed( id ), "accepted connections arrive in order" );
+        expect( stacks.client.connection( id ).has_ackno(), "client connected" );
+      }
+      expect( not stacks.server.accept().has_value(), "no more connections to accept" );
+      expect( stacks.server.connection_count() == 3, "one peer per connection" );
+
+      // data written on each connection arrives on the matching server-side peer
+      for ( size_t i = 0; i < clients.size(); ++i ) {
+        stacks.client.connection( clients[i] ).outbound_writer().push( "hello from " + to_string( i ) );
+        stacks.client.push( clients[i], StackPair::transmit_into( stacks.to_server ) );
+      }
+      stacks.deliver();
+      for ( size_t i = 0; i < clients.size(); ++i ) {
+        Reader& inbound = stacks.server.connection( reversed( clients[i] ) ).inbound_reader();
+        expect( inbound.peek() == "hello from " + to_string( i ),
+                "data demultiplexed to connection " + to_string( i ) );
+        inbound.pop( inbound.bytes_buffered() );
+      }
+
+      // a closed connection is forgotten; the others carry on
+      stacks.client.connection( clients[0] ).outbound_writer().close();
+      stacks.server.connection( reversed( clients[0] ) ).outbound_writer().close();
+      for ( int i = 0; i < 20; ++i ) {
+        stacks.tick( TCPConfig::TIMEOUT_DFLT );
+      }
+      expect( not stacks.server.has_connection( reversed( clients[0] ) ), "server forgot closed connection" );
+      expect( not stacks.client.has_connection( clients[0] ), "client forgot closed connection" );
+      expect( stacks.server.connection_count() == 2, "other connections remain" );
+    }
+
+    {
+      // a SYN to a port that isn't listening is ignored
+      StackPair stacks;
+      stacks.connect( 5000 );
+      expect( stacks.server.connection_count() == 0, "no connection created" );
+      expect( not stacks.server.accept().has_value(), "nothing to accept" );
+    }
+
+    {
+      // ISNs are a keyed hash of the four-tuple (RFC 6528): stacks with their own secrets don't agree
+      expect( TCPStack::random_key() != TCPStack::random_key(), "fresh keys" );
+      const auto syn_seqno = []( TCPStack& stack ) {
+        deque<InternetDatagram> sent;
+        stack.connect( Address { "10.0.0.2", 5000 }, server_address, StackPair::transmit_into( sent ) );
+        TCPSegment syn;
+        expect( sent.size() == 1 and parse( syn, sent.front().payload, sent.front().header.pseudo_checksum() ),
+                "SYN sent" );
+        return syn.message.sender.seqno;
+      };
+      TCPStack first { TCPConfig {} };
+      TCPStack second { TCPConfig {} };
+      expect( syn_seqno( first ) != syn_seqno( second ), "ISNs keyed by each stack's secret" );
+    }
+
+    {
+      // the stack can be driven by an EventLoop over a datagram file descriptor
+      array<int, 2> fds {};
+      CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_DGRAM, 0, fds.data() ) );
+      FileDescriptor server_fd { fds[0] };
+      FileDescriptor client_fd { fds[1] };
+
+      TCPStack server { TCPConfig {} };
+      server.listen( server_address.port() );
+      EventLoop loop;
+      server.install( loop, server_fd );
+
+      TCPStack client { TCPConfig {} };
+      const TCPStack::TransmitFunction to_fd
+        = [&]( const InternetDatagram& dgram ) { client_fd.write( serialize( dgram ) ); };
+      const FourTuple id = client.connect( Address { "10.0.0.2", 6000 }, server_address, to_fd );
+      for ( int i = 0; i < 10 and server.half_open_count() == 0; ++i ) {
+        loop.wait_next_event( 100 ); // (may service the tick rule instead)
+      }
+
+      vector<string> reply( 2 );
+      reply.front().resize( IPv4Header::LENGTH );
+      client_fd.read( reply );
+      InternetDatagram dgram;
+      expect( parse( dgram, std::move( reply ) ), "reply parsed" );
+      client.receive( std::move( dgram ), to_fd );
+      expect( client.connection( id ).has_ackno(), "client saw the SYN-ACK" );
+
+      for ( int i = 0; i < 10 and server.connection_count() == 0; ++i ) {
+        loop.wait_next_event( 100 );
+      }
+      expect( server.accept() == reversed( id ), "connection accepted through the event loop" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
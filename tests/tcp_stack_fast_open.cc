@@ -0,0 +1,110 @@
+#include "stack_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+string read_all( Reader& reader )
+{
+  string ret { reader.peek() };
+  reader.pop( ret.size() );
+  return ret;
+}
+} // namespace
+
+int main()
+{
+  try {
+    StackPair stacks;
+    stacks.server.listen( server_address.port(), TCPStack::DEFAULT_BACKLOG, true );
+
+    {
+      // the first connection asks for a cookie; its data waits for the handshake
+      const FourTuple id = stacks.client.connect_with_data(
+        Address { "10.0.0.2", 5000 }, server_address, "GET /", StackPair::transmit_into( stacks.to_server ) );
+      expect( stacks.to_server.size() == 1, "SYN sent alone" );
+      stacks.deliver_to_server();
+      expect( stacks.server.half_open_count() == 1, "ordinary handshake" );
+
+      stacks.deliver();
+      expect( stacks.server.accept() == reversed( id ), "connection accepted" );
+      expect( read_all( stacks.server.connection( reversed( id ) ).inbound_reader() ) == "GET /",
+              "data delivered after the handshake" );
+      expect( stacks.client.connection( id ).fast_open_cookie().has_value(), "cookie granted" );
+      expect( stacks.client.connection( id ).fast_open_cookie()->size() == 8, "cookie is 8 bytes" );
+      expect( stacks.server.fast_open_accepted() == 0, "no Fast Open yet" );
+    }
+
+    {
+      // the next connection to the same server sends its request on the SYN
+      const FourTuple id = stacks.client.connect_with_data(
+        Address { "10.0.0.2", 5001 }, server_address, "GET /again", StackPair::transmit_into( stacks.to_server ) );
+      expect( stacks.to_server.size() == 1, "one segment sent" );
+      stacks.deliver_to_server();
+      expect( stacks.server.fast_open_accepted() == 1, "cookie accepted" );
+      expect( stacks.server.accept() == reversed( id ), "connection accepted on the SYN" );
+      expect( read_all( stacks.server.connection( reversed( id ) ).inbound_reader() ) == "GET /again",
+              "data delivered with the SYN" );
+
+      stacks.deliver();
+      expect( stacks.client.connection( id ).has_ackno(), "client connected" );
+      expect( stacks.client.connection( id ).sender().sequence_numbers_in_flight() == 0, "data acknowledged" );
+      expect( stacks.client.connection( id ).sender().retransmissions() == 0, "nothing sent twice" );
+    }
+
+    {
+      // a server that doesn't know the cookie acknowledges only the SYN; the data is sent again at once
+      TCPStack other_server { TCPConfig {} };
+      other_server.listen( server_address.port(), TCPStack::DEFAULT_BACKLOG, true );
+      deque<InternetDatagram> to_other;
+      const FourTuple id = stacks.client.connect_with_data(
+        Address { "10.0.0.2", 5002 }, server_address, "GET /stale", StackPair::transmit_into( to_other ) );
+      expect( to_other.size() == 1, "data sent on the SYN" );
+
+      const auto exchange_all = [&] {
+        while ( not to_other.empty() or not stacks.to_client.empty() ) {
+          for ( auto& dgram : exchange( to_other, {} ) ) {
+            other_server.receive( std::move( dgram ), StackPair::transmit_into( stacks.to_client ) );
+          }
+          for ( auto& dgram : exchange( stacks.to_client, {} ) ) {
+            stacks.client.receive( std::move( dgram ), StackPair::transmit_into( to_other ) );
+          }
+        }
+      };
+      exchange_all();
+      other_server.tick( TCPConfig::ACK_DELAY_DFLT, StackPair::transmit_into( stacks.to_client ) );
+      exchange_all();
+      expect( other_server.fast_open_accepted() == 0, "stale cookie refused" );
+      expect( other_server.accept() == reversed( id ), "connection accepted after the handshake" );
+      expect( read_all( other_server.connection( reversed( id ) ).inbound_reader() ) == "GET /stale",
+              "data delivered after the handshake" );
+      expect( stacks.client.connection( id ).sender().retransmissions() == 1, "data resent once" );
+      expect( stacks.client.connection( id ).sender().sequence_numbers_in_flight() == 0, "data acknowledged" );
+    }
+
+    {
+      // a listener without Fast Open grants no cookie
+      StackPair plain;
+      plain.server.listen( server_address.port() );
+      const FourTuple id = plain.client.connect_with_data(
+        Address { "10.0.0.2", 5000 }, server_address, "hi", StackPair::transmit_into( plain.to_server ) );
+      plain.deliver();
+      expect( not plain.client.connection( id ).fast_open_cookie().has_value(), "no cookie granted" );
+      expect( plain.server.accept() == reversed( id ), "connection accepted" );
+      expect( read_all( plain.server.connection( reversed( id ) ).inbound_reader() ) == "hi", "data delivered" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
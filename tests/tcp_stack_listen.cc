@@ -0,0 +1,128 @@
+#include "stack_test_harness.hh"
+#include "test_should_be.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      // half-open connections cost no TCPPeer; beyond the backlog, SYN cookies take over
+      StackPair stacks;
+      stacks.server.listen( server_address.port(), 2 );
+      vector<FourTuple> clients;
+      for ( uint16_t port = 5000; port < 5003; ++port ) {
+        clients.push_back( stacks.open( port ) );
+      }
+      stacks.deliver_to_server();
+      expect( stacks.to_client.size() == 3, "every SYN answered" );
+      expect( stacks.server.half_open_count() == 2, "two SYNs queued" );
+      expect( stacks.server.syn_cookies_sent() == 1, "one SYN cookie" );
+      expect( stacks.server.connection_count() == 0, "no peers before the handshake completes" );
+
+      // the final ACKs arrive: the third finds the accept queue full, and is ignored
+      stacks.deliver_to_client();
+      stacks.deliver_to_server();
+      expect( stacks.server.connection_count() == 2, "queued connections established" );
+      expect( stacks.server.half_open_count() == 0, "SYN queue drained" );
+      expect( stacks.server.accept() == reversed( clients[0] ), "first connection accepted" );
+      expect( stacks.server.accept() == reversed( clients[1] ), "second connection accepted" );
+      expect( not stacks.server.accept().has_value(), "third connection not established yet" );
+
+      // the client's next segment carries the same ACK, and the cookie validates
+      stacks.client.connection( clients[2] ).outbound_writer().push( "hello" );
+      stacks.client.push( clients[2], StackPair::transmit_into( stacks.to_server ) );
+      stacks.deliver();
+      expect( stacks.server.syn_cookies_accepted() == 1, "cookie accepted" );
+      expect( stacks.server.accept() == reversed( clients[2] ), "cookie connection accepted" );
+      TCPPeer& server_peer = stacks.server.connection( reversed( clients[2] ) );
+      expect( server_peer.inbound_reader().peek() == "hello", "data arrived on cookie connection" );
+
+      // and the connection works in both directions, with window scaling as negotiated
+      const string reply( 100000, 'r' );
+      server_peer.outbound_writer().push( reply );
+      for ( int i = 0; i < 20 and stacks.client.connection( clients[2] ).inbound_reader().bytes_buffered() < 64000;
+            ++i ) {
+        stacks.server.push( reversed( clients[2] ), StackPair::transmit_into( stacks.to_client ) );
+        stacks.tick( TCPConfig::ACK_DELAY_DFLT );
+      }
+      expect( stacks.client.connection( clients[2] ).inbound_reader().bytes_buffered() == 64000,
+              "reply filled the client's window" );
+    }
+
+    {
+      // an ACK that doesn't match a SYN we answered is ignored
+      StackPair stacks;
+      stacks.server.listen( server_address.port(), 0 );
+      const FourTuple id = stacks.open( 5000 );
+      stacks.deliver_to_server();
+      expect( stacks.server.syn_cookies_sent() == 1, "cookie sent with an empty SYN queue" );
+
+      InternetDatagram syn_ack = stacks.to_client.front();
+      stacks.to_client.clear();
+      stacks.client.receive( std::move( syn_ack ), StackPair::transmit_into( stacks.to_server ) );
+      expect( stacks.to_server.size() == 1, "client sent the final ACK" );
+
+      // corrupt the acknowledgment number (and fix up the checksum)
+      TCPSegment seg;
+      expect( parse( seg, stacks.to_server.front().payload, stacks.to_server.front().header.pseudo_checksum() ),
+              "ACK parsed" );
+      seg.message.receiver.ackno = seg.message.receiver.ackno.value() + 1;
+      seg.compute_checksum( stacks.to_server.front().header.pseudo_checksum() );
+      InternetDatagram forged = stacks.to_server.front();
+      forged.payload = serialize( seg );
+      stacks.server.receive( std::move( forged ), StackPair::transmit_into( stacks.to_client ) );
+      expect( stacks.server.connection_count() == 0, "forged ACK rejected" );
+
+      // a genuine ACK arriving after the cookie has expired is rejected too
+      stacks.server.tick( 2 * TCPStack::COOKIE_PERIOD_MS, StackPair::transmit_into( stacks.to_client ) );
+      stacks.deliver_to_server();
+      expect( stacks.server.connection_count() == 0, "stale cookie rejected" );
+      expect( stacks.client.has_connection( id ), "client still thinks it is connected" );
+    }
+
+    {
+      // a connection that dies before it is accepted is still there to accept
+      StackPair stacks;
+      stacks.server.listen( server_address.port() );
+      const FourTuple id = stacks.connect( 5000 );
+      stacks.client.connection( id ).outbound_writer().push( "bye" );
+      stacks.client.connection( id ).outbound_writer().set_error();
+      stacks.client.push( id, StackPair::transmit_into( stacks.to_server ) );
+      stacks.deliver();
+      expect( not stacks.server.connection( reversed( id ) ).active(), "reset reached the server" );
+
+      stacks.tick( 100 * TCPConfig::TIMEOUT_DFLT );
+      const auto accepted = stacks.server.accept();
+      expect( accepted == reversed( id ), "dead connection accepted" );
+      expect( not stacks.server.connection( accepted.value() ).active(), "accepted connection can be inspected" );
+
+      // and it is forgotten once it has been accepted
+      stacks.tick( TCPConfig::TIMEOUT_DFLT );
+      expect( not stacks.server.has_connection( reversed( id ) ), "accepted dead connection forgotten" );
+    }
+
+    {
+      // half-open entries expire
+      StackPair stacks;
+      stacks.server.listen( server_address.port() );
+      stacks.open( 5000 );
+      stacks.deliver_to_server();
+      expect( stacks.server.half_open_count() == 1, "SYN queued" );
+      stacks.server.tick( TCPStack::SYN_RCVD_TIMEOUT_MS, StackPair::transmit_into( stacks.to_client ) );
+      expect( stacks.server.half_open_count() == 0, "half-open entry expired" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
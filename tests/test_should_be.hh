@@ -27,3 +27,11 @@ static void test_should_be_helper( const T& actual,
     throw std::runtime_error( ss.str() );
   }
 }
+
+// Throw (failing the test) unless `condition` holds; `what` names the expectation
+inline void expect( bool condition, const std::string& what )
+{
+  if ( not condition ) {
+    throw std::runtime_error( "expectation failed: " + what );
+  }
+}
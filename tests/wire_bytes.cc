@@ -0,0 +1,124 @@
+#include "ipv4_datagram.hh"
+#include "ipv4_header.hh"
+#include "parser.hh"
+#include "tcp_config.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_peer.hh"
+#include "test_should_be.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+const Address server_address { "10.0.0.1", 1234 };
+const Address client_address { "10.0.0.2", 5678 };
+
+TCPOverIPv4Adapter adapter( const Address& source, const Address& destination )
+{
+  TCPOverIPv4Adapter ret;
+  ret.config_mut().source = source;
+  ret.config_mut().destination = destination;
+  return ret;
+}
+
+template<class Buffers>
+string concatenate( const Buffers& buffers )
+{
+  string ret;
+  for ( const auto& buf : buffers ) {
+    ret.append( buf );
+  }
+  return ret;
+}
+
+// Parse the bytes of a datagram, as TCPOverIPv4OverTunFdAdapter::read does
+optional<TCPMessage> unwrap( TCPOverIPv4Adapter& receiver, const string& bytes )
+{
+  InternetDatagram ip_dgram;
+  if ( parse( ip_dgram, vector { bytes.substr( 0, IPv4Header::LENGTH ), bytes.substr( IPv4Header::LENGTH ) } ) ) {
+    return receiver.unwrap_tcp_in_ip( std::move( ip_dgram ) );
+  }
+  return {};
+}
+} // namespace
+
+int main()
+{
+  try {
+    TCPOverIPv4Adapter client_side = adapter( client_address, server_address );
+    TCPOverIPv4Adapter server_side = adapter( server_address, client_address );
+    TCPConfig config;
+    config.ack_delay_ms = 0;
+    TCPPeer client { config };
+    TCPPeer server { config };
+
+    vector<TCPMessage> sent;
+    const auto to_server = [&]( TCPMessage msg ) { sent.push_back( std::move( msg ) ); };
+    vector<TCPMessage> replies;
+    const auto to_client = [&]( TCPMessage msg ) { replies.push_back( std::move( msg ) ); };
+
+    // Every segment goes through wire_bytes() to the server, and every reply through wrap_tcp_in_ip() back.
+    const auto exchange = [&] {
+      for ( const auto& msg : sent ) {
+        const string bytes = concatenate( client_side.wire_bytes( msg ) );
+        expect( bytes == concatenate( serialize( client_side.wrap_tcp_in_ip( msg ) ) ), "same bytes as before" );
+        auto received = unwrap( server_side, bytes );
+        expect( received.has_value(), "segment accepted (checksums correct)" );
+        server.receive( std::move( received.value() ), to_client );
+      }
+      sent.clear();
+      for ( const auto& msg : replies ) {
+        auto received = unwrap( client_side, concatenate( serialize( server_side.wrap_tcp_in_ip( msg ) ) ) );
+        expect( received.has_value(), "reply accepted" );
+        client.receive( std::move( received.value() ), to_server );
+      }
+      replies.clear();
+    };
+
+    // handshake
+    client.push( to_server );
+    exchange();
+    exchange();
+    expect( client.has_ackno() and server.has_ackno(), "connection established" );
+
+    // payloads are sent from the sender's buffer, not copied
+    client.outbound_writer().push( string( 3000, 'x' ) + string( 3000, 'y' ) );
+    client.push( to_server );
+    const auto in_flight = sent;
+    for ( const auto& msg : in_flight ) {
+      const auto& wire = client_side.wire_bytes( msg );
+      expect( wire.back().data() == msg.sender.payload.data(), "payload sent from the sender's buffer" );
+    }
+    expect( in_flight.size() > 1, "several segments in flight" );
+
+    // a retransmission (lost, like the first transmission) is serialized the same way
+    sent.clear();
+    client.tick( TCPConfig::TIMEOUT_DFLT, to_server );
+    expect( sent.size() == 1 and sent.back().sender.seqno == in_flight.front().sender.seqno, "retransmitted" );
+    sent.insert( sent.begin(), in_flight.begin() + 1, in_flight.end() ); // (older timestamps first)
+    exchange();
+    expect( server.inbound_reader().bytes_buffered() == 6000, "data delivered" );
+
+    // the prebuilt headers follow a change of addresses
+    client_side.config_mut().destination = Address { "10.0.0.3", 4321 };
+    client.outbound_writer().push( "z" );
+    client.push( to_server );
+    expect( not sent.empty(), "sent" );
+    for ( const auto& msg : sent ) {
+      const string bytes = concatenate( client_side.wire_bytes( msg ) );
+      expect( bytes == concatenate( serialize( client_side.wrap_tcp_in_ip( msg ) ) ), "headers for the new peer" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
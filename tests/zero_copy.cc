@@ -0,0 +1,141 @@
+#include "byte_stream.hh"
+#include "tcp_minnow_socket.hh"
+#include "tcp_over_udp.hh"
+#include "tcp_peer.hh"
+#include "test_should_be.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+namespace {
+string patterned( size_t size )
+{
+  string ret( size, 0 );
+  for ( size_t i = 0; i < size; ++i ) {
+    ret[i] = static_cast<char>( 'a' + i % 23 );
+  }
+  return ret;
+}
+
+UDPSocket bound_socket()
+{
+  UDPSocket socket;
+  socket.bind( Address { "127.0.0.1", 0 } );
+  return socket;
+}
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // an adopted buffer keeps its place in the stream, outside the capacity
+      ByteStream stream { 10 };
+      auto shared = make_shared<const string>( "0123456789abcdefghij" );
+      stream.writer().push( "head" );
+      stream.writer().push_shared( shared );
+      stream.writer().push( "tail" );
+      expect( stream.writer().available_capacity() == 2, "only the copied bytes count against the capacity" );
+      expect( stream.reader().bytes_buffered() == 28, "all the bytes are buffered" );
+      expect( stream.reader().peek() == "head", "the copied bytes first" );
+      stream.reader().pop( 6 );
+      expect( stream.reader().peek().data() == shared->data() + 2, "then the adopted buffer itself" );
+
+      string out;
+      read( stream.reader(), 100, out );
+      expect( out == "23456789abcdefghijtail", "in order" );
+      expect( stream.writer().available_capacity() == 10 and stream.reader().bytes_popped() == 28, "all popped" );
+    }
+
+    {
+      // a TCPPeer sends a buffer without copying it into its stream, and reports when it has been acknowledged
+      TCPPeer client { TCPConfig {} };
+      TCPPeer server { TCPConfig {} };
+      deque<TCPMessage> to_server;
+      deque<TCPMessage> to_client;
+      const auto send_to_server = [&]( const TCPMessage& msg ) { to_server.push_back( msg ); };
+      const auto send_to_client = [&]( const TCPMessage& msg ) { to_client.push_back( msg ); };
+
+      const auto object = make_shared<const string>( patterned( 1'000'000 ) );
+      bool acked = false;
+      client.outbound_writer().push( "header:" );
+      client.send_zero_copy( object, [&] { acked = true; } );
+      client.push( send_to_server );
+
+      string received;
+      for ( int round = 0; round < 100'000 and not acked; ++round ) {
+        while ( not to_server.empty() ) {
+          server.receive( std::move( to_server.front() ), send_to_client );
+          to_server.pop_front();
+        }
+        Reader& inbound = server.inbound_reader();
+        received += inbound.peek();
+        inbound.pop( inbound.bytes_buffered() );
+        server.tick( 1, send_to_client );
+
+        while ( not to_client.empty() ) {
+          client.receive( std::move( to_client.front() ), send_to_server );
+          to_client.pop_front();
+          expect( not acked or received.size() == 7 + object->size(), "reported only once all was acknowledged" );
+        }
+        client.tick( 1, send_to_server );
+      }
+      expect( acked, "completion reported" );
+      expect( received == "header:" + *object, "data delivered" );
+      expect( client.outbound_writer().available_capacity() == TCPConfig::DEFAULT_CAPACITY, "nothing copied" );
+    }
+
+    {
+      // through a TCPMinnowSocket, in order with what is written to it
+      UDPSocket server_udp = bound_socket();
+      UDPSocket client_udp = bound_socket();
+      FdAdapterConfig server_config;
+      server_config.source = server_udp.local_address();
+      FdAdapterConfig client_config;
+      client_config.source = client_udp.local_address();
+      client_config.destination = server_udp.local_address();
+
+      TCPOverUDPMinnowSocket server { TCPOverUDPAdapter { std::move( server_udp ) } };
+      TCPOverUDPMinnowSocket client { TCPOverUDPAdapter { std::move( client_udp ) } };
+      thread accept_thread( [&] { server.listen_and_accept( TCPConfig {}, server_config ); } );
+      client.connect( TCPConfig {}, client_config );
+      accept_thread.join();
+
+      const auto object = make_shared<const string>( patterned( 300'000 ) );
+      atomic<bool> acked { false };
+      client.write( "before " );
+      client.send_zero_copy( object, [&] { acked = true; } );
+      client.write( " after" );
+
+      const string expected = "before " + *object + " after";
+      string received;
+      const auto deadline = chrono::steady_clock::now() + chrono::seconds( 10 );
+      while ( ( received.size() < expected.size() or not acked ) and chrono::steady_clock::now() < deadline ) {
+        pollfd pfd { server.fd_num(), POLLIN, 0 };
+        CheckSystemCall( "poll", ::poll( &pfd, 1, 10 ) );
+        string chunk;
+        server.read( chunk );
+        received += chunk;
+      }
+      expect( received == expected, "data delivered in order (got " + to_string( received.size() ) + " bytes)" );
+      expect( acked, "completion reported" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
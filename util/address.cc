@@ -126,6 +126,22 @@ pair<string, uint16_t> Address::ip_port() const
   return { ip.data(), stoi( port.data() ) };
 }
 
+uint16_t Address::port() const
+{
+  // (read straight from the sockaddr, rather than formatted and parsed back by getnameinfo)
+  if ( _address.storage.ss_family == AF_INET and _size == sizeof( sockaddr_in ) ) {
+    sockaddr_in ipv4_addr {};
+    memcpy( &ipv4_addr, &_address.storage, _size );
+    return be16toh( ipv4_addr.sin_port );
+  }
+  if ( _address.storage.ss_family == AF_INET6 and _size == sizeof( sockaddr_in6 ) ) {
+    sockaddr_in6 ipv6_addr {};
+    memcpy( &ipv6_addr, &_address.storage, _size );
+    return be16toh( ipv6_addr.sin6_port );
+  }
+  return ip_port().second;
+}
+
 string Address::to_string() const
 {
   if ( _address.storage.ss_family == AF_INET or _address.storage.ss_family == AF_INET6 ) {
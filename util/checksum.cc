@@ -0,0 +1,190 @@
+#include "checksum.hh"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+uint16_t swap_bytes( uint16_t val )
+{
+  return static_cast<uint16_t>( ( val >> 8 ) | ( val << 8 ) );
+}
+
+// Fold a sum of 16-bit words to 16 bits, with end-around carry
+uint16_t fold( uint64_t sum )
+{
+  while ( sum > 0xffff ) {
+    sum = ( sum >> 16 ) + ( sum & 0xffff );
+  }
+  return static_cast<uint16_t>( sum );
+}
+
+// The folded sum of native-endian 16-bit words, as the sum of big-endian words
+uint16_t from_native( uint64_t sum )
+{
+  const uint16_t ret = fold( sum );
+  return endian::native == endian::little ? swap_bytes( ret ) : ret;
+}
+
+uint16_t sum_bytewise( string_view data )
+{
+  uint64_t sum = 0;
+  bool parity = false;
+  for ( const uint8_t byte : data ) {
+    sum += parity ? byte : byte << 8U;
+    parity = not parity;
+  }
+  return fold( sum );
+}
+
+// Sum of the native-endian 16-bit words of `size` bytes, 64 bits at a time
+// (ones' complement addition doesn't care how the words are grouped: each 32-bit half adds as two 16-bit words)
+uint64_t sum_words( const char* data, size_t size )
+{
+  uint64_t sum = 0;
+  for ( ; size >= sizeof( uint64_t ); data += sizeof( uint64_t ), size -= sizeof( uint64_t ) ) { // NOLINT
+    uint64_t word {};
+    memcpy( &word, data, sizeof( word ) );
+    sum += ( word & 0xffff'ffff ) + ( word >> 32 );
+  }
+
+  // the tail (the last byte of an odd length is padded with zero, as the first byte of a big-endian word)
+  uint64_t word {};
+  if ( size > 0 ) {
+    memcpy( &word, data, size );
+  }
+  return sum + ( word & 0xffff'ffff ) + ( word >> 32 );
+}
+
+uint16_t sum_word64( string_view data )
+{
+  return from_native( sum_words( data.data(), data.size() ) );
+}
+
+#if defined( __x86_64__ )
+// Each pass adds at most 2 * 0xffff to every 32-bit lane per vector, so the lanes are emptied often enough
+constexpr size_t VECTORS_PER_PASS = 0x4000;
+
+uint16_t sum_sse2( string_view data )
+{
+  const char* next = data.data();
+  size_t vectors = data.size() / sizeof( __m128i );
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t sum = 0;
+  while ( vectors > 0 ) {
+    __m128i lanes = zero;
+    for ( size_t i = 0; i < VECTORS_PER_PASS and vectors > 0; ++i, --vectors ) {
+      const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( next ) ); // NOLINT
+      lanes = _mm_add_epi32( lanes, _mm_unpacklo_epi16( v, zero ) );
+      lanes = _mm_add_epi32( lanes, _mm_unpackhi_epi16( v, zero ) );
+      next += sizeof( __m128i ); // NOLINT(*-pointer-arithmetic)
+    }
+    alignas( __m128i ) array<uint32_t, 4> out {};
+    _mm_store_si128( reinterpret_cast<__m128i*>( out.data() ), lanes ); // NOLINT
+    for ( const uint32_t lane : out ) {
+      sum += lane;
+    }
+  }
+  return from_native( sum + sum_words( next, data.size() % sizeof( __m128i ) ) );
+}
+
+__attribute__( ( target( "avx2" ) ) ) uint16_t sum_avx2( string_view data )
+{
+  const char* next = data.data();
+  size_t vectors = data.size() / sizeof( __m256i );
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t sum = 0;
+  while ( vectors > 0 ) {
+    __m256i lanes = zero;
+    for ( size_t i = 0; i < VECTORS_PER_PASS and vectors > 0; ++i, --vectors ) {
+      const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( next ) ); // NOLINT
+      lanes = _mm256_add_epi32( lanes, _mm256_unpacklo_epi16( v, zero ) );
+      lanes = _mm256_add_epi32( lanes, _mm256_unpackhi_epi16( v, zero ) );
+      next += sizeof( __m256i ); // NOLINT(*-pointer-arithmetic)
+    }
+    alignas( __m256i ) array<uint32_t, 8> out {};
+    _mm256_store_si256( reinterpret_cast<__m256i*>( out.data() ), lanes ); // NOLINT
+    for ( const uint32_t lane : out ) {
+      sum += lane;
+    }
+  }
+  return from_native( sum + sum_words( next, data.size() % sizeof( __m256i ) ) );
+}
+#endif
+
+} // namespace
+
+bool InternetChecksum::supported( const Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Bytewise:
+    case Kernel::Word64:
+      return true;
+#if defined( __x86_64__ )
+    case Kernel::SSE2:
+      return true;
+    case Kernel::AVX2:
+      return __builtin_cpu_supports( "avx2" );
+#endif
+    default:
+      return false;
+  }
+}
+
+InternetChecksum::Kernel InternetChecksum::fastest_kernel()
+{
+  static const Kernel fastest = [] {
+    for ( const auto kernel : { Kernel::AVX2, Kernel::SSE2 } ) {
+      if ( supported( kernel ) ) {
+        return kernel;
+      }
+    }
+    return Kernel::Word64;
+  }();
+  return fastest;
+}
+
+uint16_t InternetChecksum::partial_sum( const string_view data, const Kernel kernel )
+{
+  switch ( kernel ) {
+    case Kernel::Bytewise:
+      return sum_bytewise( data );
+    case Kernel::Word64:
+      return sum_word64( data );
+#if defined( __x86_64__ )
+    case Kernel::SSE2:
+      return sum_sse2( data );
+    case Kernel::AVX2:
+      if ( supported( kernel ) ) {
+        return sum_avx2( data );
+      }
+      break;
+#endif
+    default:
+      break;
+  }
+  throw runtime_error( "InternetChecksum: kernel not supported by this CPU" );
+}
+
+void InternetChecksum::add( const string_view data )
+{
+  // Data that starts at an odd offset has its words straddle those of the kernel: the same sum, byte-swapped.
+  uint16_t sum = partial_sum( data, fastest_kernel() );
+  if ( parity_ ) {
+    sum = swap_bytes( sum );
+  }
+
+  // (with the end-around carry, so that any number of buffers can be added)
+  const uint64_t total = uint64_t { sum_ } + sum;
+  sum_ = static_cast<uint32_t>( ( total & 0xffff'ffff ) + ( total >> 32 ) );
+  parity_ = parity_ != ( data.size() % 2 == 1 );
+}
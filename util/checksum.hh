@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 //! The internet checksum algorithm
@@ -12,18 +13,28 @@ private:
   bool parity_ {};
 
 public:
-  explicit InternetChecksum( const uint32_t sum = 0 ) : sum_( sum ) {}
-  void add( std::string_view data )
+  //! Ways of summing a buffer: add() uses the fastest that the CPU supports
+  enum class Kernel : uint8_t
   {
-    for ( const uint8_t i : data ) {
-      uint16_t val = i;
-      if ( not parity_ ) {
-        val <<= 8;
-      }
-      sum_ += val;
-      parity_ = !parity_;
-    }
-  }
+    Bytewise, //!< one byte at a time
+    Word64,   //!< 64 bits at a time
+    SSE2,     //!< 128 bits at a time (x86-64 only)
+    AVX2      //!< 256 bits at a time (x86-64 CPUs with AVX2 only)
+  };
+
+  //! Can this CPU run `kernel`?
+  static bool supported( Kernel kernel );
+
+  //! The kernel that add() uses
+  static Kernel fastest_kernel();
+
+  //! Ones' complement sum of `data` as big-endian 16-bit words (the last one padded with zero), folded to 16 bits
+  static uint16_t partial_sum( std::string_view data, Kernel kernel );
+
+  explicit InternetChecksum( const uint32_t sum = 0 ) : sum_( sum ) {}
+
+  //! Add the bytes of `data`, which continue those added before (even after an odd number of bytes)
+  void add( std::string_view data );
 
   uint16_t value() const
   {
@@ -36,6 +47,27 @@ public:
     return ~ret;
   }
 
+  //! \name Incremental update (RFC 1624)
+  //! The checksum of data whose checksum was `checksum`, after one of its fields changed from `old_val` to
+  //! `new_val`: a few arithmetic operations instead of summing the data again.
+  //!@{
+  static uint16_t replace_u16( const uint16_t checksum, const uint16_t old_val, const uint16_t new_val )
+  {
+    // HC' = ~( ~HC + ~m + m' ) (RFC 1624, equation 3)
+    uint32_t sum = static_cast<uint16_t>( ~checksum ) + static_cast<uint16_t>( ~old_val ) + uint32_t { new_val };
+    sum = ( sum >> 16 ) + ( sum & 0xffff );
+    sum += sum >> 16;
+    return ~static_cast<uint16_t>( sum );
+  }
+
+  static uint16_t replace_u32( const uint16_t checksum, const uint32_t old_val, const uint32_t new_val )
+  {
+    const uint16_t high
+      = replace_u16( checksum, static_cast<uint16_t>( old_val >> 16 ), static_cast<uint16_t>( new_val >> 16 ) );
+    return replace_u16( high, static_cast<uint16_t>( old_val ), static_cast<uint16_t>( new_val ) );
+  }
+  //!@}
+
   void add( const std::vector<std::string>& data )
   {
     for ( const auto& x : data ) {
@@ -0,0 +1,180 @@
+#include "coroutine.hh"
+
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+Scheduler::Scheduler( const EventLoop::Backend backend )
+  : loop_( backend )
+  , read_category_( loop_.add_category( "task waiting to read" ) )
+  , write_category_( loop_.add_category( "task waiting to write" ) )
+  , sleep_category_( loop_.add_category( "task sleeping" ) )
+{
+  loop_.set_dispatch( EventLoop::Dispatch::AllReady );
+  loop_.add_rule( "resume ready tasks", [this] { resume_ready(); }, [this] { return not ready_.empty(); } );
+}
+
+void Scheduler::FdAwaiter::await_suspend( const coroutine_handle<> awaiting )
+{
+  scheduler_.park( fd_, direction_, awaiting );
+}
+
+void Scheduler::park( FileDescriptor& fd, const Direction direction, const coroutine_handle<> awaiting )
+{
+  auto it = fd_waiters_.find( fd.fd_num() );
+  if ( it != fd_waiters_.end() and it->second.fd.closed() ) {
+    forget( it ); // (the number was closed, and now belongs to another fd)
+    it = fd_waiters_.end();
+  }
+  if ( it == fd_waiters_.end() ) {
+    it = fd_waiters_.emplace( fd.fd_num(), FdWaiters { .fd = fd.duplicate(), .id = next_waiters_id_++ } ).first;
+  }
+
+  FdWaiters& waiters = it->second;
+  const size_t index = direction == Direction::In ? 0 : 1;
+  if ( waiters.parked.at( index ) ) {
+    throw runtime_error( "Scheduler: two tasks waiting for the same fd" );
+  }
+  waiters.parked.at( index ) = awaiting;
+  if ( waiters.rules.at( index ).has_value() ) {
+    return; // (the rule now resumes this coroutine)
+  }
+
+  // the first of readiness, hangup or error schedules the parked coroutine; the rule stays for the next one
+  const int fd_num = fd.fd_num();
+  const uint64_t id = waiters.id;
+  waiters.rules.at( index ).emplace( loop_.add_rule(
+    direction == Direction::In ? read_category_ : write_category_,
+    waiters.fd,
+    direction,
+    [this, fd_num, id, index] { unpark( fd_num, id, index ); },
+    [this, fd_num, id, index] {
+      const auto entry = fd_waiters_.find( fd_num );
+      return entry != fd_waiters_.end() and entry->second.id == id and entry->second.parked.at( index );
+    },
+    [this, fd_num, id, index] {
+      // (the rule is gone: at EOF, on a hangup or error, or with the fd closed)
+      unpark( fd_num, id, index );
+      const auto entry = fd_waiters_.find( fd_num );
+      if ( entry != fd_waiters_.end() and entry->second.id == id ) {
+        entry->second.rules.at( index ).reset();
+      }
+    } ) );
+}
+
+void Scheduler::unpark( const int fd_num, const uint64_t id, const size_t direction )
+{
+  const auto it = fd_waiters_.find( fd_num );
+  if ( it == fd_waiters_.end() or it->second.id != id or not it->second.parked.at( direction ) ) {
+    return;
+  }
+  ready_.push_back( exchange( it->second.parked.at( direction ), nullptr ) );
+  resumed_fds_.push_back( fd_num );
+}
+
+void Scheduler::forget( const unordered_map<int, FdWaiters>::iterator it )
+{
+  for ( auto& parked : it->second.parked ) {
+    if ( parked ) {
+      ready_.push_back( exchange( parked, nullptr ) );
+    }
+  }
+  for ( auto& rule : it->second.rules ) {
+    if ( rule.has_value() ) {
+      rule->cancel();
+    }
+  }
+  fd_waiters_.erase( it );
+}
+
+void Scheduler::SleepAwaiter::await_suspend( const coroutine_handle<> awaiting )
+{
+  Scheduler& scheduler = scheduler_;
+  scheduler_.loop_.add_timer(
+    scheduler_.sleep_category_, delay_, [&scheduler, awaiting] { scheduler.ready_.push_back( awaiting ); } );
+}
+
+void Scheduler::spawn( Task<void> task )
+{
+  ready_.push_back( task.handle_ );
+  tasks_.push_back( std::move( task ) );
+}
+
+void Scheduler::resume_ready()
+{
+  // (including the coroutines that these make ready, e.g. by spawning tasks)
+  while ( not ready_.empty() ) {
+    const auto next = ready_.front();
+    ready_.pop_front();
+    next.resume();
+  }
+
+  // an fd that no task parked on again lets go of its rules (and of the fd)
+  for ( const int fd_num : resumed_fds_ ) {
+    const auto it = fd_waiters_.find( fd_num );
+    if ( it != fd_waiters_.end() and not it->second.parked[0] and not it->second.parked[1] ) {
+      forget( it );
+    }
+  }
+  resumed_fds_.clear();
+
+  // retire the spawned tasks that have finished
+  for ( auto it = tasks_.begin(); it != tasks_.end(); ) {
+    if ( not it->done() ) {
+      ++it;
+      continue;
+    }
+    const exception_ptr failure = it->handle_.promise().exception;
+    it = tasks_.erase( it );
+    if ( failure ) {
+      rethrow_exception( failure );
+    }
+  }
+}
+
+void Scheduler::run()
+{
+  while ( not tasks_.empty() ) {
+    if ( loop_.wait_next_event( -1 ) == EventLoop::Result::Exit ) {
+      throw runtime_error( "Scheduler: " + to_string( tasks_.size() ) + " task(s) waiting for nothing" );
+    }
+  }
+}
+
+Task<string> async_read( Scheduler& scheduler, FileDescriptor& fd, const size_t max_size )
+{
+  if ( max_size == 0 ) {
+    throw runtime_error( "async_read: max_size must be positive" ); // (an empty read would look like EOF)
+  }
+
+  // readiness can be spurious (e.g. another reader drained the fd first): a read that finds nothing waits again
+  string data;
+  do {
+    co_await scheduler.readable( fd );
+    data.resize( max_size );
+    fd.read( data );
+  } while ( data.empty() and not fd.eof() );
+  co_return data;
+}
+
+Task<void> async_write( Scheduler& scheduler, FileDescriptor& fd, string_view data )
+{
+  while ( not data.empty() ) {
+    co_await scheduler.writable( fd );
+    data.remove_prefix( fd.write( data ) );
+  }
+}
+
+Task<void> async_connect( Scheduler& scheduler, TCPSocket& socket, const Address& address )
+{
+  socket.connect( address ); // (in progress, on a non-blocking socket)
+  co_await scheduler.writable( socket );
+  socket.throw_if_error();
+}
+
+Task<TCPSocket> async_accept( Scheduler& scheduler, TCPSocket& listener )
+{
+  co_await scheduler.readable( listener );
+  co_return listener.accept();
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "socket.hh"
+
+#include <array>
+#include <coroutine>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+template<class T>
+class Task;
+
+//! \cond internal
+namespace task_detail {
+
+//! What every Task's promise holds: who awaits it, and how it failed
+struct PromiseBase
+{
+  std::coroutine_handle<> continuation {};
+  std::exception_ptr exception {};
+
+  //! On finishing, resume the awaiting coroutine (if any) in place of this one
+  struct FinalAwaiter
+  {
+    bool await_ready() const noexcept { return false; }
+    template<class Promise>
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> done ) noexcept
+    {
+      const auto next = done.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template<class T>
+struct Promise : PromiseBase
+{
+  std::optional<T> value {};
+
+  Task<T> get_return_object();
+  void return_value( T v ) { value.emplace( std::move( v ) ); }
+};
+
+template<>
+struct Promise<void> : PromiseBase
+{
+  Task<void> get_return_object();
+  void return_void() const {}
+};
+
+} // namespace task_detail
+//! \endcond
+
+//! \brief A coroutine that produces a `T` (or nothing), run by a Scheduler
+//! \details A Task starts when it is awaited (`co_await task`) or spawned on a Scheduler, and the awaiting
+//! coroutine resumes when it finishes, receiving its value or exception. The Task owns the coroutine.
+template<class T = void>
+class Task
+{
+public:
+  using promise_type = task_detail::Promise<T>;
+
+  explicit Task( std::coroutine_handle<promise_type> handle ) : handle_( handle ) {}
+
+  Task( Task&& other ) noexcept : handle_( std::exchange( other.handle_, nullptr ) ) {}
+  Task& operator=( Task&& other ) noexcept
+  {
+    if ( this != &other ) {
+      destroy();
+      handle_ = std::exchange( other.handle_, nullptr );
+    }
+    return *this;
+  }
+  Task( const Task& other ) = delete;
+  Task& operator=( const Task& other ) = delete;
+  ~Task() { destroy(); }
+
+  bool done() const { return not handle_ or handle_.done(); }
+
+  //! Start the task, and resume the awaiting coroutine with its result when it finishes
+  auto operator co_await() && noexcept
+  {
+    struct Awaiter
+    {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() const noexcept { return handle.done(); }
+      std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) noexcept
+      {
+        handle.promise().continuation = awaiting;
+        return handle;
+      }
+      T await_resume()
+      {
+        if ( handle.promise().exception ) {
+          std::rethrow_exception( handle.promise().exception );
+        }
+        if constexpr ( not std::is_void_v<T> ) {
+          return std::move( handle.promise().value.value() );
+        }
+      }
+    };
+    return Awaiter { handle_ };
+  }
+
+private:
+  friend class Scheduler;
+
+  std::coroutine_handle<promise_type> handle_;
+
+  void destroy()
+  {
+    if ( handle_ ) {
+      handle_.destroy();
+      handle_ = nullptr;
+    }
+  }
+};
+
+//! \cond internal
+template<class T>
+Task<T> task_detail::Promise<T>::get_return_object()
+{
+  return Task<T> { std::coroutine_handle<Promise<T>>::from_promise( *this ) };
+}
+
+inline Task<void> task_detail::Promise<void>::get_return_object()
+{
+  return Task<void> { std::coroutine_handle<Promise<void>>::from_promise( *this ) };
+}
+//! \endcond
+
+//! \brief Runs Task%s on one thread, resuming each when the fd or timer it waits for is ready
+//! \details The Scheduler's EventLoop (see loop()) waits for what the suspended tasks wait for, alongside any
+//! rules added to it directly. An fd that tasks wait on gets one EventLoop rule per direction, which resumes
+//! whichever task is parked on it and stays as long as a task parks there again each time, so one thread can
+//! serve thousands of connections without a rule being added or removed on every `co_await`.
+class Scheduler
+{
+public:
+  //! Resumes the awaiting coroutine once `fd` is readable (or writable), hung up or in error
+  //! \details At most one task may wait for each fd and direction at a time.
+  class FdAwaiter
+  {
+  public:
+    FdAwaiter( Scheduler& scheduler, FileDescriptor& fd, Direction direction )
+      : scheduler_( scheduler ), fd_( fd ), direction_( direction )
+    {}
+
+    bool await_ready() const { return false; }
+    void await_suspend( std::coroutine_handle<> awaiting );
+    void await_resume() const {}
+
+  private:
+    Scheduler& scheduler_;
+    FileDescriptor& fd_;
+    Direction direction_;
+  };
+
+  //! Resumes the awaiting coroutine after a delay
+  class SleepAwaiter
+  {
+  public:
+    SleepAwaiter( Scheduler& scheduler, EventLoop::Clock::duration delay ) : scheduler_( scheduler ), delay_( delay )
+    {}
+
+    bool await_ready() const { return delay_ <= EventLoop::Clock::duration::zero(); }
+    void await_suspend( std::coroutine_handle<> awaiting );
+    void await_resume() const {}
+
+  private:
+    Scheduler& scheduler_;
+    EventLoop::Clock::duration delay_;
+  };
+
+  explicit Scheduler( EventLoop::Backend backend = EventLoop::Backend::Epoll );
+
+  //! Run `task` concurrently with the others, starting on the next turn of the loop
+  void spawn( Task<void> task );
+
+  //! Resume `awaiting` on the next turn of the loop (for awaitables that wait for other kinds of events)
+  void schedule( std::coroutine_handle<> awaiting ) { ready_.push_back( awaiting ); }
+
+  //! Run until every spawned task has finished (rethrows the first exception that escapes a task)
+  void run();
+
+  //! Spawned tasks that haven't finished
+  size_t task_count() const { return tasks_.size(); }
+
+  //! \name Awaitables
+  //!@{
+  FdAwaiter readable( FileDescriptor& fd ) { return { *this, fd, Direction::In }; }
+  FdAwaiter writable( FileDescriptor& fd ) { return { *this, fd, Direction::Out }; }
+  SleepAwaiter sleep_for( EventLoop::Clock::duration delay ) { return { *this, delay }; }
+  //!@}
+
+  //! The EventLoop that drives the tasks
+  EventLoop& loop() { return loop_; }
+
+private:
+  EventLoop loop_; // (declared first, so that it outlives the tasks its rules resume)
+  size_t read_category_;
+  size_t write_category_;
+  size_t sleep_category_;
+
+  std::deque<std::coroutine_handle<>> ready_ {}; //!< Coroutines to resume on the next turn of the loop
+  std::list<Task<void>> tasks_ {};               //!< Spawned tasks
+
+  //! The coroutines parked on one fd number (one per direction), and the rules that resume them
+  struct FdWaiters
+  {
+    FileDescriptor fd; //!< (tells the fd apart from a later one with the same number, once it is closed)
+    uint64_t id;       //!< (tells the rules of this entry apart from those of an earlier one for the number)
+    std::array<std::coroutine_handle<>, 2> parked {};             //!< by direction: In, Out
+    std::array<std::optional<EventLoop::RuleHandle>, 2> rules {}; //!< by direction
+  };
+  std::unordered_map<int, FdWaiters> fd_waiters_ {}; //!< by fd number
+  uint64_t next_waiters_id_ {};
+  std::vector<int> resumed_fds_ {}; //!< fds whose waiter was resumed on this turn
+
+  //! Park `awaiting` on `fd` until it is ready in `direction` (adding the rule, unless it is still there)
+  void park( FileDescriptor& fd, Direction direction, std::coroutine_handle<> awaiting );
+
+  //! Schedule the coroutine parked on an fd (if the entry is still `id`)
+  void unpark( int fd_num, uint64_t id, size_t direction );
+
+  //! Drop the entry of an fd, scheduling the coroutines parked on it
+  void forget( std::unordered_map<int, FdWaiters>::iterator it );
+
+  void resume_ready();
+};
+
+//! \name Asynchronous I/O
+//! Each of these is a Task that suspends the awaiting coroutine, instead of its thread, until it can proceed.
+//!@{
+
+//! Read what is available on `fd`, once something is (at most `max_size` bytes, which must be positive; empty
+//! only at EOF)
+Task<std::string> async_read( Scheduler& scheduler, FileDescriptor& fd, size_t max_size = 65536 );
+
+//! Write all of `data` to `fd` (which should be non-blocking, so that it takes what fits each time it is writable)
+//! \note `data` must stay valid until the task finishes, as it does in `co_await async_write( s, fd, data )`
+Task<void> async_write( Scheduler& scheduler, FileDescriptor& fd, std::string_view data );
+
+//! Connect a non-blocking TCPSocket to `address` (throws if the connection fails)
+Task<void> async_connect( Scheduler& scheduler, TCPSocket& socket, const Address& address );
+
+//! Accept a connection on a listening TCPSocket
+Task<TCPSocket> async_accept( Scheduler& scheduler, TCPSocket& listener );
+
+//!@}
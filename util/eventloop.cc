@@ -2,17 +2,72 @@
 #include "exception.hh"
 #include "socket.hh"
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <span>
+#include <sys/epoll.h>
 
 using namespace std;
 
+namespace {
+// Timeout argument of ppoll and epoll_pwait2 (nanosecond resolution; empty waits forever)
+optional<timespec> to_timespec( const optional<EventLoop::Clock::duration> timeout )
+{
+  if ( not timeout.has_value() ) {
+    return {};
+  }
+  const auto ns = chrono::duration_cast<chrono::nanoseconds>( timeout.value() ).count();
+  return timespec { .tv_sec = ns / 1'000'000'000, .tv_nsec = ns % 1'000'000'000 };
+}
+
+// Call `wait` (ppoll or epoll_pwait2) with what is left of `timeout`, until it isn't interrupted by a signal
+// (neither is ever restarted by the kernel, whatever SA_RESTART says)
+template<class WaitT>
+int wait_until_done( const optional<EventLoop::Clock::duration> timeout, const WaitT& wait )
+{
+  const auto start = EventLoop::Clock::now();
+  while ( true ) {
+    optional<timespec> ts;
+    if ( timeout.has_value() ) {
+      ts = to_timespec( max( EventLoop::Clock::duration::zero(), start + timeout.value() - EventLoop::Clock::now() ) );
+    }
+    const int ret = wait( ts ? &ts.value() : nullptr );
+    if ( ret >= 0 or errno != EINTR ) {
+      return ret;
+    }
+  }
+}
+
+// Heap order of the timers: the earliest deadline on top
+constexpr auto later_deadline = []( const auto& a, const auto& b ) { return a->deadline > b->deadline; };
+} // namespace
+
 unsigned int EventLoop::FDRule::service_count() const
 {
   return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
+EventLoop::EventLoop( const Backend backend ) : _backend( backend )
+{
+  _rule_categories.reserve( 64 );
+  if ( _backend == Backend::Epoll ) {
+    _epoll_fd.emplace( CheckSystemCall( "epoll_create1", ::epoll_create1( EPOLL_CLOEXEC ) ) );
+  }
+}
+
+void EventLoop::set_dispatch( const Dispatch mode, const unsigned max_callbacks_per_rule )
+{
+  if ( max_callbacks_per_rule == 0 ) {
+    throw runtime_error( "EventLoop: max_callbacks_per_rule must be positive" );
+  }
+  _dispatch = mode;
+  _max_callbacks_per_rule = max_callbacks_per_rule;
+}
+
 size_t EventLoop::add_category( const string& name )
 {
   if ( _rule_categories.size() >= _rule_categories.capacity() ) {
@@ -54,9 +109,44 @@ EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
   _fd_rules.emplace_back( make_shared<FDRule>(
     BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, error ) );
 
+  if ( _backend != Backend::Poll ) {
+    FDRule& rule = *_fd_rules.back();
+    const int fd_num = rule.fd.fd_num();
+    FDSlot& slot = _slots.try_emplace( fd_num, FDSlot { .fd_num = fd_num } ).first->second;
+    slot.rules.push_back( &rule );
+    rule.slot = &slot;
+    _mark_dirty( slot );
+  }
+
   return RuleHandle { _fd_rules.back() };
 }
 
+EventLoop::TimerRule::TimerRule( BasicRule&& base,
+                                 Clock::time_point s_deadline,
+                                 optional<Clock::duration> s_period )
+  : BasicRule( base ), deadline( s_deadline ), period( s_period )
+{}
+
+EventLoop::RuleHandle EventLoop::add_timer( const size_t category_id,
+                                            const Clock::duration delay,
+                                            const CallbackT& callback,
+                                            const optional<Clock::duration> period )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+  if ( period.has_value() and period.value() <= Clock::duration::zero() ) {
+    throw runtime_error( "EventLoop: timer period must be positive" );
+  }
+
+  auto timer = make_shared<TimerRule>(
+    BasicRule { category_id, [] { return true; }, callback }, Clock::now() + delay, period );
+  _timers.push_back( timer );
+  ranges::push_heap( _timers, later_deadline );
+
+  return RuleHandle { timer };
+}
+
 EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
                                            const CallbackT& callback,
                                            const InterestT& interest )
@@ -82,43 +172,150 @@ void EventLoop::RuleHandle::cancel()
 // NOLINTBEGIN(*-signed-bitwise)
 EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 {
+  const bool all_ready = _dispatch == Dispatch::AllReady;
+  bool work_done = false;
+
   // first, handle the non-file-descriptor-related rules
   {
     for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
       auto& this_rule = **it;
-      bool rule_fired = false;
 
       if ( this_rule.cancel_requested ) {
         it = _non_fd_rules.erase( it );
         continue;
       }
 
-      uint8_t iterations = 0;
-      while ( this_rule.interest() ) {
-        if ( iterations++ >= 128 ) {
+      // (in AllReady mode, a rule that is still interested after its share waits for the next call)
+      unsigned calls = 0;
+      bool interested = this_rule.interest();
+      while ( interested and not( all_ready and calls >= _max_callbacks_per_rule ) ) {
+        if ( ++this_rule.busy_iterations > 128 ) {
           throw runtime_error( "EventLoop: busy wait detected: rule \""
                                + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
-                               + to_string( iterations ) + " iterations" );
+                               + to_string( this_rule.busy_iterations ) + " iterations" );
         }
 
-        rule_fired = true;
+        ++calls;
         this_rule.callback();
+        interested = this_rule.interest();
+      }
+      if ( not interested ) {
+        this_rule.busy_iterations = 0;
       }
 
-      if ( rule_fired ) {
-        return Result::Success; /* only serve one rule on each iteration */
+      if ( calls > 0 ) {
+        if ( not all_ready ) {
+          return Result::Success; /* only serve one rule on each iteration */
+        }
+        work_done = true;
       }
 
       ++it;
     }
   }
 
-  // now the file-descriptor-related rules. poll any "interested" file descriptors
-  vector<pollfd> pollfds {};
-  pollfds.reserve( _fd_rules.size() );
+  // next, the timers that are due
+  if ( _fire_timers( all_ready ) ) {
+    if ( not all_ready ) {
+      return Result::Success;
+    }
+    work_done = true;
+  }
+
+  // now the file-descriptor-related rules. quit if there is nothing left to poll or wait for
+  const bool something_to_poll = _prepare_fd_rules();
+  const auto next_timer = _next_timer_deadline();
+  if ( not something_to_poll and not next_timer.has_value() ) {
+    return work_done ? Result::Success : Result::Exit;
+  }
+
+  // wait until one of the fds satisfies one of the rules (writeable/readable), or the next timer is due
+  // (having already done some work, only collect the fds that are ready now)
+  optional<Clock::duration> timeout;
+  if ( work_done ) {
+    timeout = Clock::duration::zero();
+  } else {
+    if ( timeout_ms >= 0 ) {
+      timeout = chrono::milliseconds( timeout_ms );
+    }
+    if ( next_timer.has_value() ) {
+      const auto until_timer = max( Clock::duration::zero(), next_timer.value() - Clock::now() );
+      timeout = min( timeout.value_or( until_timer ), until_timer );
+    }
+  }
+
+  bool ready = false;
+  switch ( _backend ) {
+    case Backend::Poll:
+      ready = _wait_poll( timeout );
+      break;
+    case Backend::Epoll:
+      ready = _wait_epoll( timeout );
+      break;
+  }
+  if ( ready ) {
+    _dispatch_fd_rules( all_ready );
+    return Result::Success;
+  }
+
+  if ( _fire_timers( all_ready ) ) {
+    return Result::Success;
+  }
+  return work_done ? Result::Success : Result::Timeout;
+}
+
+bool EventLoop::_fire_timers( const bool all_due )
+{
+  const auto now = Clock::now();
+
+  bool fired = false;
+  while ( not _timers.empty() ) {
+    const shared_ptr<TimerRule> timer = _timers.front();
+    if ( not timer->cancel_requested and timer->deadline > now ) {
+      break;
+    }
+    ranges::pop_heap( _timers, later_deadline );
+    _timers.pop_back();
+    if ( timer->cancel_requested ) {
+      continue;
+    }
+
+    // reschedule a periodic timer before its callback runs (which may cancel it); missed periods are skipped
+    if ( timer->period.has_value() ) {
+      timer->deadline += timer->period.value();
+      if ( timer->deadline <= now ) {
+        timer->deadline = now + timer->period.value();
+      }
+      _timers.push_back( timer );
+      ranges::push_heap( _timers, later_deadline );
+    }
+
+    timer->callback();
+    fired = true;
+    if ( not all_due ) {
+      break;
+    }
+  }
+  return fired;
+}
+
+optional<EventLoop::Clock::time_point> EventLoop::_next_timer_deadline()
+{
+  while ( not _timers.empty() and _timers.front()->cancel_requested ) {
+    ranges::pop_heap( _timers, later_deadline );
+    _timers.pop_back();
+  }
+  if ( _timers.empty() ) {
+    return {};
+  }
+  return _timers.front()->deadline;
+}
+
+bool EventLoop::_prepare_fd_rules()
+{
   bool something_to_poll = false;
 
-  // set up the pollfd for each rule
+  // set up the events for each rule (its interest can only be known by asking it)
   for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
     auto& this_rule = **it;
 
@@ -126,101 +323,242 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
       //      this_rule.cancel();
       //      if rule is cancelled externally, no need to call the cancellation callback
       //      this makes it easier to cancel rules and delete captured objects right away
-      it = _fd_rules.erase( it );
+      it = _erase_fd_rule( it );
       continue;
     }
 
     if ( this_rule.direction == Direction::In && this_rule.fd.eof() ) {
       // no more reading on this rule, it's reached eof
       this_rule.cancel();
-      it = _fd_rules.erase( it );
+      it = _erase_fd_rule( it );
       continue;
     }
 
     if ( this_rule.fd.closed() ) {
       this_rule.cancel();
-      it = _fd_rules.erase( it );
+      it = _erase_fd_rule( it );
       continue;
     }
 
-    if ( this_rule.interest() ) {
-      pollfds.push_back( { this_rule.fd.fd_num(), static_cast<int16_t>( this_rule.direction ), 0 } );
-      something_to_poll = true;
-    } else {
-      pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
+    // (an uninterested rule waits for no events, but we still want errors)
+    const int16_t events = this_rule.interest() ? static_cast<int16_t>( this_rule.direction ) : int16_t { 0 };
+    if ( this_rule.slot != nullptr and events != this_rule.events ) {
+      _mark_dirty( *this_rule.slot );
     }
+    this_rule.events = events;
+    something_to_poll |= events != 0;
     ++it;
   }
 
-  // quit if there is nothing left to poll
-  if ( not something_to_poll ) {
-    return Result::Exit;
+  // hand the kernel the interests that changed (several rules may share an fd number: it gets their union)
+  for ( FDSlot* const slot : _dirty_slots ) {
+    uint32_t events = 0;
+    for ( const FDRule* const rule : slot->rules ) {
+      events |= static_cast<uint16_t>( rule->events );
+    }
+    slot->dirty = false;
+    _epoll_update( *slot, events );
+  }
+  _dirty_slots.clear();
+
+  return something_to_poll;
+}
+
+void EventLoop::_mark_dirty( FDSlot& slot )
+{
+  if ( not slot.dirty ) {
+    slot.dirty = true;
+    _dirty_slots.push_back( &slot );
+  }
+}
+
+bool EventLoop::_wait_poll( const optional<Clock::duration> timeout )
+{
+  vector<pollfd> pollfds {};
+  pollfds.reserve( _fd_rules.size() );
+  for ( const auto& rule : _fd_rules ) {
+    pollfds.push_back( { rule->fd.fd_num(), rule->events, 0 } );
   }
 
   // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-  if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
-    return Result::Timeout;
+  const int count = CheckSystemCall( "ppoll", wait_until_done( timeout, [&]( const timespec* ts ) {
+                                       return ::ppoll( pollfds.data(), pollfds.size(), ts, nullptr );
+                                     } ) );
+  if ( count == 0 ) {
+    return false;
   }
 
-  // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) ); it != _fd_rules.end(); ++idx ) {
-    const auto& this_pollfd = pollfds.at( idx );
-    auto& this_rule = **it;
+  auto this_pollfd = pollfds.begin();
+  for ( const auto& rule : _fd_rules ) {
+    rule->revents = ( this_pollfd++ )->revents;
+  }
+  return true;
+}
 
-    const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
-    if ( poll_error ) {
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\"\n";
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\": " << strerror( socket_error ) << "\n";
-      }
+bool EventLoop::_wait_epoll( const optional<Clock::duration> timeout )
+{
+  // retrieve only the ready fds (their registrations are up to date: see _prepare_fd_rules)
+  array<epoll_event, 64> ready {};
+  const int count = CheckSystemCall( "epoll_pwait2", wait_until_done( timeout, [&]( const timespec* ts ) {
+                                       return ::epoll_pwait2(
+                                         _epoll_fd->fd_num(), ready.data(), ready.size(), ts, nullptr );
+                                     } ) );
+  if ( count == 0 ) {
+    return false;
+  }
 
-      this_rule.error();
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+  _ready_slots.clear();
+  for ( const auto& event : span( ready.data(), count ) ) {
+    FDSlot* const slot = static_cast<FDSlot*>( event.data.ptr );
+    slot->ready = static_cast<int16_t>( event.events ); // EPOLLIN == POLLIN, etc.
+    _ready_slots.push_back( slot );
+  }
+  return true;
+}
+
+EventLoop::FDRuleList::iterator EventLoop::_erase_fd_rule( FDRuleList::iterator it )
+{
+  FDRule& rule = **it;
+  FDSlot* const slot = rule.slot;
+  if ( slot == nullptr ) {
+    return _fd_rules.erase( it );
+  }
+
+  erase( slot->rules, &rule );
+  if ( not slot->rules.empty() ) {
+    _mark_dirty( *slot ); // (the other rules may want less)
+    return _fd_rules.erase( it );
+  }
+
+  // Deregister the fd number while it still refers to this rule's fd: once the rule lets go of it, it may
+  // be closed and the number reused.
+  bool forget = true;
+  if ( slot->registered.has_value() ) {
+    if ( rule.fd.closed() ) {
+      // (the registration can't be removed; if another descriptor keeps the file open, a late event still
+      // finds the slot, with no rules on it)
+      forget = false;
+    } else if ( ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_DEL, slot->fd_num, nullptr ) == -1
+                and errno != ENOENT ) {
+      throw unix_error( "epoll_ctl" );
     }
+  }
+  slot->registered.reset();
+  if ( slot->dirty ) {
+    slot->dirty = false;
+    erase( _dirty_slots, slot );
+  }
+  if ( forget ) {
+    _slots.erase( slot->fd_num );
+  }
+  return _fd_rules.erase( it );
+}
 
-    const auto poll_ready = static_cast<bool>( this_pollfd.revents & this_pollfd.events );
-    const auto poll_hup = static_cast<bool>( this_pollfd.revents & POLLHUP );
-    if ( poll_hup && ( ( this_pollfd.events && !poll_ready ) or ( this_rule.direction == Direction::Out ) ) ) {
-      // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
-      //   - if it was POLLIN and nothing is readable, no more will ever be readable
-      //   - if it was POLLOUT, it will not be writable again
-      // additionally, consider FD defunct if rule will only query for Direction::Out
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+void EventLoop::_epoll_update( FDSlot& slot, const uint32_t events )
+{
+  if ( slot.registered == events ) {
+    return;
+  }
+
+  epoll_event event {};
+  event.events = events;
+  event.data.ptr = &slot;
+
+  if ( slot.registered.has_value() ) {
+    if ( ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_MOD, slot.fd_num, &event ) == 0 ) {
+      slot.registered = events;
+      return;
+    }
+    if ( errno != ENOENT ) {
+      throw unix_error( "epoll_ctl" );
     }
+    // the fd number was closed and reused since it was registered
+  }
 
-    if ( poll_ready ) {
-      // we only want to call callback if revents includes the event we asked for
-      const auto count_before = this_rule.service_count();
-      this_rule.callback();
+  CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_ADD, slot.fd_num, &event ) );
+  slot.registered = events;
+}
 
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
+void EventLoop::_dispatch_fd_rules( const bool all_ready )
+{
+  if ( _backend == Backend::Poll ) {
+    for ( const auto& rule : _fd_rules ) {
+      if ( _serve_fd_rule( *rule, rule->revents, all_ready ) and not all_ready ) {
+        return; /* only serve one rule on each iteration */
       }
+    }
+    return;
+  }
 
-      return Result::Success; /* only serve one rule on each iteration */
+  // straight to the rules on the fds that are ready (rules added by a callback wait for the next call)
+  for ( FDSlot* const slot : _ready_slots ) {
+    for ( size_t i = 0, count = slot->rules.size(); i < count; ++i ) {
+      FDRule& rule = *slot->rules[i];
+      // report the events the rule asked for (as poll would), plus errors and hangups
+      const auto revents = static_cast<int16_t>( slot->ready & ( rule.events | POLLERR | POLLHUP ) );
+      if ( _serve_fd_rule( rule, revents, all_ready ) and not all_ready ) {
+        return; /* only serve one rule on each iteration */
+      }
     }
+  }
+}
 
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+bool EventLoop::_serve_fd_rule( FDRule& this_rule, const int16_t revents, const bool all_ready )
+{
+  const int16_t events = this_rule.events;
+
+  const auto poll_error = static_cast<bool>( revents & ( POLLERR | POLLNVAL ) );
+  if ( poll_error ) {
+    /* see if fd is a socket */
+    int socket_error = 0;
+    socklen_t optlen = sizeof( socket_error );
+    const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+    if ( ret == -1 and ( errno == ENOTSOCK or errno == EBADF ) ) {
+      cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
+           << "\"\n";
+    } else if ( ret == -1 ) {
+      throw unix_error( "getsockopt" );
+    } else if ( optlen != sizeof( socket_error ) ) {
+      throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+    } else if ( socket_error ) {
+      cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
+           << "\": " << strerror( socket_error ) << "\n";
+    }
+
+    this_rule.error();
+    this_rule.cancel();
+    this_rule.cancel_requested = true; // (erased before the next wait)
+    return false;
+  }
+
+  const auto poll_ready = static_cast<bool>( revents & events );
+  const auto poll_hup = static_cast<bool>( revents & POLLHUP );
+  if ( poll_hup && ( ( events && !poll_ready ) or ( this_rule.direction == Direction::Out ) ) ) {
+    // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
+    //   - if it was POLLIN and nothing is readable, no more will ever be readable
+    //   - if it was POLLOUT, it will not be writable again
+    // additionally, consider FD defunct if rule will only query for Direction::Out
+    this_rule.cancel();
+    this_rule.cancel_requested = true;
+    return false;
   }
 
-  return Result::Success;
+  // in AllReady mode, an earlier callback may have cancelled this rule, closed its fd or satisfied its interest
+  const bool still_wanted
+    = not all_ready or ( not this_rule.cancel_requested and not this_rule.fd.closed() and this_rule.interest() );
+  if ( not poll_ready or not still_wanted ) {
+    return false;
+  }
+
+  // we only want to call callback if revents includes the event we asked for
+  const auto count_before = this_rule.service_count();
+  this_rule.callback();
+
+  if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
+    throw runtime_error( "EventLoop: busy wait detected: rule \"" + _rule_categories.at( this_rule.category_id ).name
+                         + "\" did not read/write fd and is still interested" );
+  }
+  return true;
 }
 // NOLINTEND(*-signed-bitwise)
 // NOLINTEND(*-cognitive-complexity)
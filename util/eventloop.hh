@@ -1,11 +1,15 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <list>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <poll.h>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "file_descriptor.hh"
 
@@ -20,6 +24,26 @@ public:
     Out = POLLOUT //!< Callback will be triggered when Rule::fd is writable.
   };
 
+  //! How the EventLoop waits for its file descriptors.
+  enum class Backend
+  {
+    Poll, //!< [poll(2)](\ref man2::poll) on every interested fd, on every call (portable).
+    Epoll //!< [epoll(7)](\ref man7::epoll): fds stay registered, and only changes in interest are syscalls.
+  };
+
+  //! How many rules EventLoop::wait_next_event serves before returning.
+  enum class Dispatch
+  {
+    OneRule, //!< The first interested non-fd rule, or else the first ready fd rule.
+    AllReady //!< Every interested non-fd rule and every ready fd rule, from a single wait.
+  };
+
+  //! In Dispatch::AllReady mode, the most times a non-fd rule's callback runs per call (fd rules run once).
+  static constexpr unsigned DEFAULT_MAX_CALLBACKS_PER_RULE = 16;
+
+  //! Clock of the timer rules
+  using Clock = std::chrono::steady_clock;
+
 private:
   using CallbackT = std::function<void( void )>;
   using InterestT = std::function<bool( void )>;
@@ -35,18 +59,26 @@ private:
     InterestT interest;
     CallbackT callback;
     bool cancel_requested {};
+    unsigned busy_iterations {}; //!< callbacks since the rule was last found uninterested
 
     BasicRule( size_t s_category_id, InterestT s_interest, CallbackT s_callback );
   };
 
+  struct FDSlot;
+
   struct FDRule : public BasicRule
   {
     FileDescriptor fd;   //!< FileDescriptor to monitor for activity.
     Direction direction; //!< Direction::In for reading from fd, Direction::Out for writing to fd.
     CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on EOF or hangup)
     CallbackT error;     //!< A callback that is called when the fd has an error before cancellation
+    int16_t events {};   //!< The events the rule waits for on this call (0 if uninterested)
+    int16_t revents {};  //!< Poll backend: what happened to them
+    FDSlot* slot {};     //!< Epoll backend: the state of the rule's fd number
 
     FDRule( BasicRule&& base, FileDescriptor&& s_fd, Direction s_direction, CallbackT s_cancel, CallbackT s_error );
+    FDRule( const FDRule& other ) = delete; //!< (its slot refers to it)
+    FDRule& operator=( const FDRule& other ) = delete;
 
     //! Returns the number of times fd has been read or written, depending on the value of Rule::direction.
     //! \details This function is used internally by EventLoop; you will not need to call it
@@ -54,11 +86,73 @@ private:
   };
 
   std::vector<RuleCategory> _rule_categories {};
-  std::list<std::shared_ptr<FDRule>> _fd_rules {};
+  struct TimerRule : public BasicRule
+  {
+    Clock::time_point deadline;          //!< When the callback is next due.
+    std::optional<Clock::duration> period; //!< Interval of a periodic timer (empty for a one-shot timer).
+
+    TimerRule( BasicRule&& base, Clock::time_point s_deadline, std::optional<Clock::duration> s_period );
+  };
+
+  using FDRuleList = std::list<std::shared_ptr<FDRule>>;
+  FDRuleList _fd_rules {};
   std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
 
+  //! Timers, as a min-heap on their deadlines (cancelled timers are dropped when they reach the top)
+  std::vector<std::shared_ptr<TimerRule>> _timers {};
+
+  Backend _backend;
+  Dispatch _dispatch { Dispatch::OneRule };
+  unsigned _max_callbacks_per_rule { DEFAULT_MAX_CALLBACKS_PER_RULE };
+
+  //! Epoll backend: what the kernel knows about one fd number, kept from one wait to the next so that only a
+  //! change in the interest of its rules costs a system call, and each event leads straight to them
+  struct FDSlot
+  {
+    int fd_num;
+    std::vector<FDRule*> rules {};         //!< the rules on the fd number
+    std::optional<uint32_t> registered {}; //!< the events epoll waits for
+    int16_t ready {};                      //!< what happened on this wait
+    bool dirty {};                         //!< did a rule's interest change since the last wait?
+  };
+  std::unordered_map<int, FDSlot> _slots {}; //!< by fd number (the references stay valid while it grows)
+  std::vector<FDSlot*> _dirty_slots {};
+  std::vector<FDSlot*> _ready_slots {};
+
+  //! Epoll backend: the epoll instance
+  std::optional<FileDescriptor> _epoll_fd {};
+
+  //! Drop cancelled or defunct fd rules, and record what the others are interested in (false if nothing)
+  bool _prepare_fd_rules();
+
+  //! Wait for the recorded events, at most `timeout` (if any), noting what happened (false on timeout)
+  bool _wait_poll( std::optional<Clock::duration> timeout );
+  bool _wait_epoll( std::optional<Clock::duration> timeout );
+
+  //! Mark a slot for the union of its rules' interests to be handed to the kernel before the next wait
+  void _mark_dirty( FDSlot& slot );
+
+  //! Run the first (or every) timer that is due; false if none was
+  bool _fire_timers( bool all_due );
+
+  //! Deadline of the earliest timer that hasn't been cancelled
+  std::optional<Clock::time_point> _next_timer_deadline();
+
+  //! Bring the epoll registration of a slot up to date with its rules
+  void _epoll_update( FDSlot& slot, uint32_t events );
+
+  //! Remove an fd rule (and, with the last rule on its fd number, the epoll registration)
+  FDRuleList::iterator _erase_fd_rule( FDRuleList::iterator it );
+
+  //! Run the callback of the first (or every) ready fd rule
+  void _dispatch_fd_rules( bool all_ready );
+
+  //! Serve one fd rule given what happened on its fd: run its callback if it is ready (true), or retire it on an
+  //! error or hangup (it is erased before the next wait)
+  bool _serve_fd_rule( FDRule& rule, int16_t revents, bool all_ready );
+
 public:
-  EventLoop() { _rule_categories.reserve( 64 ); }
+  explicit EventLoop( Backend backend = Backend::Poll );
 
   //! Returned by each call to EventLoop::wait_next_event.
   enum class Result
@@ -97,15 +191,32 @@ public:
     const CallbackT& callback,
     const InterestT& interest = [] { return true; } );
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  //! Run `callback` once, `delay` from now. With a `period`, run it again every `period` until cancelled.
+  RuleHandle add_timer( size_t category_id,
+                        Clock::duration delay,
+                        const CallbackT& callback,
+                        std::optional<Clock::duration> period = std::nullopt );
+
+  //! Waits for the interested fds (with the selected backend), but no longer than until the next timer,
+  //! and then executes the callback of a ready rule or due timer.
   Result wait_next_event( int timeout_ms );
 
+  //! Serve every ready rule on each wakeup (with at most `max_callbacks_per_rule` callbacks of a non-fd
+  //! rule, so that one rule cannot starve the others), or only one rule as by default.
+  void set_dispatch( Dispatch mode, unsigned max_callbacks_per_rule = DEFAULT_MAX_CALLBACKS_PER_RULE );
+
   // convenience function to add category and rule at the same time
   template<typename... Targs>
   auto add_rule( const std::string& name, Targs&&... Fargs )
   {
     return add_rule( add_category( name ), std::forward<Targs>( Fargs )... );
   }
+
+  template<typename... Targs>
+  auto add_timer( const std::string& name, Targs&&... Fargs )
+  {
+    return add_timer( add_category( name ), std::forward<Targs>( Fargs )... );
+  }
 };
 
 using Direction = EventLoop::Direction;
@@ -39,4 +39,10 @@ public:
 
   //! Called periodically when time elapses
   void tick( const size_t unused [[maybe_unused]] ) {}
+
+  //! Send any datagrams held back to be written in a batch (called before the owner waits for events)
+  void flush() {}
+
+  //! Has read() already received more datagrams than it returned? (then they are read without the fd being readable)
+  bool has_buffered() const { return false; }
 };
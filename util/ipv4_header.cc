@@ -116,6 +116,14 @@ void IPv4Header::compute_checksum()
   cksum = check.value();
 }
 
+// (the TTL is the high byte of the header's fifth 16-bit word, and the protocol its low byte)
+void IPv4Header::decrement_ttl()
+{
+  const auto old_word = static_cast<uint16_t>( ( ttl << 8 ) | proto );
+  --ttl;
+  cksum = InternetChecksum::replace_u16( cksum, old_word, static_cast<uint16_t>( ( ttl << 8 ) | proto ) );
+}
+
 std::string IPv4Header::to_string() const
 {
   stringstream ss {};
@@ -0,0 +1,121 @@
+#include "link_emulator.hh"
+
+#include "ipv4_header.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+// Size of a datagram on the wire, as if it were carried in IPv4
+size_t wire_size( const TCPMessage& msg )
+{
+  const TCPSegment seg { .message = msg };
+  return IPv4Header::LENGTH + seg.header_length() + msg.sender.payload.size();
+}
+
+// Heap order of the datagrams in flight: the earliest arrival on top
+constexpr auto later_arrival = []( const auto& a, const auto& b ) {
+  return a.arrival_us != b.arrival_us ? a.arrival_us > b.arrival_us : a.order > b.order;
+};
+} // namespace
+
+LinkDirection::LinkDirection( const LinkConfig& config ) : config_( config ), rng_( config.seed )
+{
+  for ( const double p : { config_.reorder_rate,
+                           config_.duplicate_rate,
+                           config_.good_to_bad,
+                           config_.bad_to_good,
+                           config_.loss_good,
+                           config_.loss_bad } ) {
+    if ( p < 0 or p > 1 ) {
+      throw runtime_error( "LinkConfig: probabilities must be between 0 and 1" );
+    }
+  }
+}
+
+bool LinkDirection::chance( const double probability )
+{
+  return probability > 0 and uniform_real_distribution<double> { 0, 1 }( rng_ ) < probability;
+}
+
+void LinkDirection::send( TCPMessage msg, const uint64_t now_us )
+{
+  ++stats_.sent;
+
+  // the path's loss comes in bursts, while the Markov chain is in its bad state
+  bad_state_ = bad_state_ ? not chance( config_.bad_to_good ) : chance( config_.good_to_bad );
+  if ( chance( bad_state_ ? config_.loss_bad : config_.loss_good ) ) {
+    ++stats_.lost;
+    return;
+  }
+
+  // the bottleneck queue holds whatever the transmitter hasn't finished sending
+  const uint64_t now_ns = now_us * 1'000;
+  while ( not transmitting_.empty() and transmitting_.front().first <= now_ns ) {
+    queued_bytes_ -= transmitting_.front().second;
+    transmitting_.pop_front();
+  }
+  const size_t size = wire_size( msg );
+  if ( config_.queue_limit > 0 and queued_bytes_ + size > config_.queue_limit ) {
+    ++stats_.tail_dropped;
+    return;
+  }
+
+  // serialization at the bottleneck rate, after what is already queued (timed in nanoseconds, so that a rate
+  // that doesn't take a whole number of microseconds per datagram isn't rounded up from one datagram to the next)
+  const uint64_t start_ns = max( now_ns, transmitter_free_ns_ );
+  const uint64_t serialization_ns = config_.rate_bps > 0 ? size * 8 * 1'000'000'000 / config_.rate_bps : 0;
+  transmitter_free_ns_ = start_ns + serialization_ns;
+  transmitting_.emplace_back( transmitter_free_ns_, size );
+  queued_bytes_ += size;
+  stats_.max_queued = max( stats_.max_queued, queued_bytes_ );
+
+  // then propagation (from the first microsecond after the last bit), with jitter, and perhaps held back or duplicated
+  uint64_t arrival_us = ( transmitter_free_ns_ + 999 ) / 1'000 + config_.delay_us;
+  if ( config_.jitter_us > 0 ) {
+    arrival_us += uniform_int_distribution<uint64_t> { 0, config_.jitter_us }( rng_ );
+  }
+  if ( chance( config_.reorder_rate ) ) {
+    ++stats_.reordered;
+    arrival_us += config_.reorder_delay_us;
+  }
+  if ( chance( config_.duplicate_rate ) ) {
+    ++stats_.duplicated;
+    enqueue_arrival( arrival_us, msg );
+  }
+  enqueue_arrival( arrival_us, std::move( msg ) );
+}
+
+void LinkDirection::enqueue_arrival( const uint64_t arrival_us, TCPMessage msg )
+{
+  in_flight_.push_back( { arrival_us, next_order_++, std::move( msg ) } );
+  ranges::push_heap( in_flight_, later_arrival );
+}
+
+optional<TCPMessage> LinkDirection::receive( const uint64_t now_us )
+{
+  if ( in_flight_.empty() or in_flight_.front().arrival_us > now_us ) {
+    return {};
+  }
+
+  ranges::pop_heap( in_flight_, later_arrival );
+  TCPMessage msg = std::move( in_flight_.back().msg );
+  in_flight_.pop_back();
+  ++stats_.delivered;
+  return msg;
+}
+
+EmulatedLink::EmulatedLink( const LinkConfig& a_to_b, const LinkConfig& b_to_a ) : a_to_b_( a_to_b ), b_to_a_( b_to_a )
+{}
+
+optional<TCPMessage> EmulatedLink::Endpoint::read()
+{
+  return inbound_->receive( link_->now_us() );
+}
+
+void EmulatedLink::Endpoint::write( const TCPMessage& seg )
+{
+  outbound_->send( seg, link_->now_us() );
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "fd_adapter.hh"
+#include "tcp_segment.hh"
+#include "tuntap_adapter.hh"
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <random>
+#include <utility>
+#include <vector>
+
+//! Conditions on one direction of an EmulatedLink
+struct LinkConfig
+{
+  uint64_t rate_bps = 0;         //!< Bottleneck rate, in bits per second (0 for no serialization delay)
+  uint64_t delay_us = 0;         //!< One-way propagation delay, in microseconds
+  uint64_t jitter_us = 0;        //!< Extra delay, uniform in [0, jitter_us] for each datagram (may reorder them)
+  size_t queue_limit = 0;        //!< Bytes the bottleneck queue holds before it drops at the tail (0: unbounded)
+  double reorder_rate = 0;       //!< Probability that a datagram is held back by reorder_delay_us
+  uint64_t reorder_delay_us = 0; //!< How long a reordered datagram is held back
+  double duplicate_rate = 0;     //!< Probability that a datagram is delivered twice
+
+  //! Gilbert-Elliott burst loss: a two-state (good/bad) Markov chain, stepped once per datagram
+  double good_to_bad = 0; //!< Probability of entering the bad state
+  double bad_to_good = 1; //!< Probability of leaving the bad state
+  double loss_good = 0;   //!< Loss probability in the good state
+  double loss_bad = 0;    //!< Loss probability in the bad state
+
+  uint64_t seed = 1; //!< Seed of this direction's random numbers (the same seed reproduces the same run)
+};
+
+//! What happened to the datagrams sent in one direction of an EmulatedLink
+struct LinkStats
+{
+  uint64_t sent {};         //!< Datagrams written into the link
+  uint64_t lost {};         //!< Lost (Gilbert-Elliott)
+  uint64_t tail_dropped {}; //!< Dropped because the bottleneck queue was full
+  uint64_t duplicated {};   //!< Delivered twice
+  uint64_t reordered {};    //!< Held back by LinkConfig::reorder_delay_us
+  uint64_t delivered {};    //!< Read out of the link (including duplicates)
+  size_t max_queued {};     //!< Most bytes ever waiting in the bottleneck queue
+};
+
+//! \brief One direction of an EmulatedLink: a bottleneck queue and transmitter, followed by a lossy, delaying path
+class LinkDirection
+{
+public:
+  explicit LinkDirection( const LinkConfig& config );
+
+  //! Accept a datagram at time `now_us`
+  void send( TCPMessage msg, uint64_t now_us );
+
+  //! The next datagram that has arrived by `now_us`, if any
+  std::optional<TCPMessage> receive( uint64_t now_us );
+
+  const LinkConfig& config() const { return config_; }
+  const LinkStats& stats() const { return stats_; }
+
+private:
+  struct InFlight
+  {
+    uint64_t arrival_us;
+    uint64_t order; // ties in arrival time are delivered in the order sent
+    TCPMessage msg;
+  };
+
+  LinkConfig config_;
+  LinkStats stats_ {};
+  std::mt19937_64 rng_;
+  bool bad_state_ {};
+
+  uint64_t transmitter_free_ns_ {};                         // when the bottleneck finishes what is queued
+  std::deque<std::pair<uint64_t, size_t>> transmitting_ {}; // (finish time in ns, size) of each queued datagram
+  size_t queued_bytes_ {};
+
+  std::vector<InFlight> in_flight_ {}; // min-heap on (arrival_us, order)
+  uint64_t next_order_ {};
+
+  bool chance( double probability );
+  void enqueue_arrival( uint64_t arrival_us, TCPMessage msg );
+};
+
+//! \brief An in-memory link with independently configured directions, on its own clock
+//! \details The link's time only moves on tick(), so a run over an EmulatedLink is reproducible (and as fast as
+//! the CPU allows). Its endpoints are TCPDatagramAdapter%s; the link must outlive them.
+class EmulatedLink
+{
+public:
+  //! One end of the link
+  class Endpoint : public FdAdapterBase
+  {
+  public:
+    //! The next datagram that has arrived at this end, if any
+    std::optional<TCPMessage> read();
+
+    //! Send a datagram to the other end
+    void write( const TCPMessage& seg );
+
+  private:
+    friend class EmulatedLink;
+    Endpoint( EmulatedLink& link, LinkDirection& outbound, LinkDirection& inbound )
+      : link_( &link ), outbound_( &outbound ), inbound_( &inbound )
+    {}
+
+    EmulatedLink* link_;
+    LinkDirection* outbound_;
+    LinkDirection* inbound_;
+  };
+
+  EmulatedLink( const LinkConfig& a_to_b, const LinkConfig& b_to_a );
+
+  //! Advance the link's clock
+  void tick( uint64_t ms ) { now_us_ += ms * 1000; }
+  void tick_us( uint64_t us ) { now_us_ += us; }
+
+  uint64_t now_us() const { return now_us_; }
+
+  Endpoint a() { return { *this, a_to_b_, b_to_a_ }; }
+  Endpoint b() { return { *this, b_to_a_, a_to_b_ }; }
+
+  const LinkDirection& a_to_b() const { return a_to_b_; }
+  const LinkDirection& b_to_a() const { return b_to_a_; }
+
+  // The endpoints refer to the link
+  EmulatedLink( const EmulatedLink& other ) = delete;
+  EmulatedLink& operator=( const EmulatedLink& other ) = delete;
+  EmulatedLink( EmulatedLink&& other ) = delete;
+  EmulatedLink& operator=( EmulatedLink&& other ) = delete;
+  ~EmulatedLink() = default;
+
+private:
+  uint64_t now_us_ {};
+  LinkDirection a_to_b_;
+  LinkDirection b_to_a_;
+};
+
+static_assert( TCPDatagramAdapter<EmulatedLink::Endpoint> );
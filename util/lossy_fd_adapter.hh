@@ -5,9 +5,13 @@
 #include "tcp_config.hh"
 #include "tcp_segment.hh"
 
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
 #include <optional>
 #include <random>
 #include <utility>
+#include <vector>
 
 //! An adapter class that adds random dropping behavior to an FD adapter
 template<typename AdapterT>
@@ -59,6 +63,31 @@ public:
     return _adapter.write( seg );
   }
 
+  //! \brief Read a batch from the underlying AdapterT instance, potentially dropping each of its datagrams
+  //! \note Only for an AdapterT that reads batches itself (see BatchTCPDatagramAdapter)
+  void read_batch( std::vector<TCPMessage>& segs, const size_t max_count )
+    requires requires( AdapterT a, std::vector<TCPMessage>& in, size_t n ) { a.read_batch( in, n ); }
+  {
+    const auto first = static_cast<std::ptrdiff_t>( segs.size() );
+    _adapter.read_batch( segs, max_count );
+    segs.erase( std::remove_if( segs.begin() + first, segs.end(), [&]( const TCPMessage& ) {
+                  return _should_drop( false );
+                } ),
+                segs.end() );
+  }
+
+  //! \brief Write the datagrams of a batch that aren't dropped to the underlying AdapterT instance
+  //! \note Only for an AdapterT that writes batches itself (see BatchTCPDatagramAdapter)
+  void write_batch( const std::vector<TCPMessage>& segs )
+    requires requires( AdapterT a, const std::vector<TCPMessage>& out ) { a.write_batch( out ); }
+  {
+    std::vector<TCPMessage> kept;
+    std::copy_if( segs.begin(), segs.end(), std::back_inserter( kept ), [&]( const TCPMessage& ) {
+      return not _should_drop( true );
+    } );
+    _adapter.write_batch( kept );
+  }
+
   //! \name
   //! Passthrough functions to the underlying AdapterT instance
 
@@ -66,4 +95,6 @@ public:
   const FdAdapterConfig& config() const { return _adapter.config(); } //!< FdAdapterBase::config passthrough
   FdAdapterConfig& config_mut() { return _adapter.config_mut(); }     //!< FdAdapterBase::config_mut passthrough
   void tick( const size_t ms_since_last_tick ) { _adapter.tick( ms_since_last_tick ); }
+  void flush() { _adapter.flush(); }                                  //!< FdAdapterBase::flush passthrough
+  bool has_buffered() const { return _adapter.has_buffered(); }       //!< FdAdapterBase::has_buffered passthrough
 };
@@ -10,6 +10,7 @@
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 class Parser
@@ -28,6 +29,14 @@ class Parser
       }
     }
 
+    // Take ownership of the buffers (so that dump_all can hand them on without copying)
+    explicit BufferList( std::vector<std::string>&& buffers )
+    {
+      for ( auto& x : buffers ) {
+        append( std::move( x ) );
+      }
+    }
+
     uint64_t size() const { return size_; }
     uint64_t serialized_length() const { return size(); }
     bool empty() const { return size_ == 0; }
@@ -62,7 +71,7 @@ class Parser
       }
       std::string first_str = std::move( buffer_.front() );
       if ( skip_ ) {
-        first_str = first_str.substr( skip_ );
+        first_str.erase( 0, skip_ ); // shift in place rather than allocating a copy
       }
       out.emplace_back( std::move( first_str ) );
       buffer_.pop_front();
@@ -120,6 +129,7 @@ class Parser
 
 public:
   explicit Parser( const std::vector<std::string>& input ) : input_( input ) {}
+  explicit Parser( std::vector<std::string>&& input ) : input_( std::move( input ) ) {}
 
   const BufferList& input() const { return input_; }
 
@@ -219,6 +229,20 @@ public:
   }
 };
 
+// Overwrite the big-endian integer at offset `pos` of an already serialized buffer
+template<std::unsigned_integral T>
+void put_integer( std::string& out, const size_t pos, const T val )
+{
+  constexpr size_t len = sizeof( T );
+  if ( pos + len > out.size() ) {
+    throw std::out_of_range( "put_integer past the end of the buffer" );
+  }
+
+  for ( size_t i = 0; i < len; ++i ) {
+    out[pos + i] = static_cast<char>( val >> ( ( len - i - 1 ) * 8 ) );
+  }
+}
+
 // Helper to serialize any object (without constructing a Serializer of the caller's own)
 template<class T>
 std::vector<std::string> serialize( const T& obj )
@@ -236,3 +260,12 @@ bool parse( T& obj, const std::vector<std::string>& buffers, Targs&&... Fargs )
   obj.parse( p, std::forward<Targs>( Fargs )... );
   return not p.has_error();
 }
+
+// As above, but the parsed object may take over the buffers (e.g., as its payload) instead of copying them
+template<class T, typename... Targs>
+bool parse( T& obj, std::vector<std::string>&& buffers, Targs&&... Fargs )
+{
+  Parser p { std::move( buffers ) };
+  obj.parse( p, std::forward<Targs>( Fargs )... );
+  return not p.has_error();
+}
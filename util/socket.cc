@@ -7,6 +7,7 @@
 #include <net/if.h>
 #include <stdexcept>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 using namespace std;
@@ -151,6 +152,97 @@ void DatagramSocket::send( const string_view payload )
   register_write();
 }
 
+size_t DatagramSocket::recv_batch( vector<string>& payloads,
+                                   vector<Address>& source_addresses,
+                                   size_t max_count,
+                                   BatchScratch& scratch )
+{
+  // refill only the slots that received data (or were moved from) since the last call
+  if ( payloads.size() < max_count ) {
+    payloads.resize( max_count );
+  }
+  for ( size_t i = 0; i < max_count; ++i ) {
+    if ( payloads[i].size() != kReadBufferSize ) {
+      payloads[i].resize( kReadBufferSize );
+    }
+  }
+
+  auto& [sources, iovecs, msgs] = scratch;
+  if ( msgs.size() < max_count ) {
+    sources.resize( max_count );
+    iovecs.resize( max_count );
+    msgs.resize( max_count );
+  }
+  for ( size_t i = 0; i < max_count; ++i ) {
+    iovecs[i] = { payloads[i].data(), payloads[i].size() };
+    msgs[i].msg_hdr = { .msg_name = static_cast<sockaddr*>( sources[i] ),
+                        .msg_namelen = sizeof( sources[i].storage ),
+                        .msg_iov = &iovecs[i],
+                        .msg_iovlen = 1,
+                        .msg_control = nullptr,
+                        .msg_controllen = 0,
+                        .msg_flags = 0 };
+  }
+
+  // (a batch never blocks, so the socket need not be non-blocking)
+  register_read();
+  source_addresses.clear();
+  const int count = ::recvmmsg( fd_num(), msgs.data(), max_count, MSG_DONTWAIT, nullptr );
+  if ( count < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) {
+    return 0;
+  }
+  CheckSystemCall( "recvmmsg", count );
+
+  size_t kept = 0;
+  for ( size_t i = 0; i < static_cast<size_t>( count ); ++i ) {
+    if ( msgs[i].msg_hdr.msg_flags & MSG_TRUNC ) { // NOLINT(*-signed-bitwise)
+      continue;
+    }
+    payloads[i].resize( msgs[i].msg_len );
+    if ( kept != i ) {
+      swap( payloads[kept], payloads[i] ); // (the dropped datagram's slot stays full size)
+    }
+    source_addresses.emplace_back( sources[i], msgs[i].msg_hdr.msg_namelen );
+    ++kept;
+  }
+  return kept;
+}
+
+void DatagramSocket::sendto_batch( const Address& destination,
+                                   const vector<vector<string>>& datagrams,
+                                   BatchScratch& scratch )
+{
+  vector<iovec>& iovecs = scratch.iovecs;
+  vector<mmsghdr>& msgs = scratch.msgs;
+  iovecs.clear();
+  for ( const auto& buffers : datagrams ) {
+    for ( const auto& buffer : buffers ) {
+      iovecs.push_back( { const_cast<char*>( buffer.data() ), buffer.size() } ); // NOLINT(*-const-cast)
+    }
+  }
+
+  if ( msgs.size() < datagrams.size() ) {
+    msgs.resize( datagrams.size() );
+  }
+  size_t first_iovec = 0;
+  for ( size_t i = 0; i < datagrams.size(); ++i ) {
+    msgs[i].msg_hdr = { .msg_name = const_cast<sockaddr*>( destination.raw() ), // NOLINT(*-const-cast)
+                        .msg_namelen = destination.size(),
+                        .msg_iov = iovecs.data() + first_iovec, // NOLINT(*-pointer-arithmetic)
+                        .msg_iovlen = datagrams[i].size(),
+                        .msg_control = nullptr,
+                        .msg_controllen = 0,
+                        .msg_flags = 0 };
+    first_iovec += datagrams[i].size();
+  }
+
+  // (sendmmsg may stop early, e.g. when the socket buffer fills)
+  for ( size_t sent = 0; sent < datagrams.size(); ) {
+    sent += CheckSystemCall( "sendmmsg", ::sendmmsg( fd_num(), msgs.data() + sent, datagrams.size() - sent, 0 ) );
+    register_write();
+  }
+}
+
 // mark the socket as listening for incoming connections
 //! \param[in] backlog is the number of waiting connections to queue (see [listen(2)](\ref man2::listen))
 void TCPSocket::listen( const int backlog )
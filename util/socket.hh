@@ -5,7 +5,10 @@
 
 #include <cstdint>
 #include <functional>
+#include <string>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
 
 //! \brief Base class for network sockets (TCP, UDP, etc.)
 //! \details Socket is generally used via a subclass. See TCPSocket and UDPSocket for usage examples.
@@ -71,6 +74,31 @@ public:
 
   //! Send datagram to the socket's connected address (must call connect() first)
   void send( std::string_view payload );
+
+  //! The message headers (and sender addresses) of a batch, kept by the caller so that they are allocated once
+  //! rather than on every recv_batch() or sendto_batch()
+  struct BatchScratch
+  {
+    std::vector<Address::Raw> sources {};
+    std::vector<iovec> iovecs {};
+    std::vector<mmsghdr> msgs {};
+  };
+
+  //! Receive up to `max_count` datagrams that are already waiting, with one [recvmmsg(2)](\ref man2::recvmmsg)
+  //! \details Returns the number received, n (0 if none was waiting): they are in the first n slots of
+  //! `payloads`, and their senders replace the contents of `source_addresses`. Datagrams too large for a buffer
+  //! are dropped. `payloads` keeps (at least) `max_count` slots from one call to the next, and only the slots
+  //! that received data are refilled: pass the same vector each time, and move out only the payloads to keep.
+  size_t recv_batch( std::vector<std::string>& payloads,
+                     std::vector<Address>& source_addresses,
+                     size_t max_count,
+                     BatchScratch& scratch );
+
+  //! Send datagrams (each gathered from its buffers) to `destination`, with as few
+  //! [sendmmsg(2)](\ref man2::sendmmsg) calls as possible
+  void sendto_batch( const Address& destination,
+                     const std::vector<std::vector<std::string>>& datagrams,
+                     BatchScratch& scratch );
 };
 
 //! A wrapper around [UDP sockets](\ref man7::udp)
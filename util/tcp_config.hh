@@ -6,6 +6,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <optional>
+#include <string>
 
 //! Config for TCP sender and receiver
 class TCPConfig
@@ -15,11 +16,20 @@ public:
   static constexpr size_t MAX_PAYLOAD_SIZE = 1000;  //!< Conservative max payload size for real Internet
   static constexpr uint16_t TIMEOUT_DFLT = 1000;    //!< Default re-transmit timeout is 1 second
   static constexpr unsigned MAX_RETX_ATTEMPTS = 8;  //!< Maximum re-transmit attempts before giving up
+  static constexpr uint8_t MAX_WINDOW_SCALE = 14;   //!< Largest window shift count allowed by RFC 7323
+  static constexpr uint64_t MIN_RTO_MS = 200;      //!< Lower bound on the RTO computed from RTT samples
+  static constexpr uint16_t ACK_DELAY_DFLT = 40;   //!< Default maximum delay of an acknowledgment
+  static constexpr uint64_t RECV_IDLE_MS = 1000;   //!< Idle time after which an auto-tuned buffer shrinks
 
   uint16_t rt_timeout = TIMEOUT_DFLT;      //!< Initial value of the retransmission timeout, in milliseconds
+  uint16_t ack_delay_ms = ACK_DELAY_DFLT;  //!< Maximum time to delay an ACK, in milliseconds (0 disables)
   size_t recv_capacity = DEFAULT_CAPACITY; //!< Receive capacity, in bytes
+  size_t recv_capacity_max = 0;            //!< Auto-tune the receive capacity up to this many bytes (if larger)
   size_t send_capacity = DEFAULT_CAPACITY; //!< Sender capacity, in bytes
   Wrap32 isn { 137 };                      //!< Default initial sequence number
+
+  //! TCP Fast Open cookie for an active open: empty requests one, a cookie lets the SYN carry data
+  std::optional<std::string> fast_open_cookie {};
 };
 
 //! Config for classes derived from FdAdapter
@@ -32,3 +42,14 @@ public:
   uint16_t loss_rate_dn = 0; //!< Downlink loss rate (for LossyFdAdapter)
   uint16_t loss_rate_up = 0; //!< Uplink loss rate (for LossyFdAdapter)
 };
+
+//! Config for the TCPPeer thread of a TCPMinnowSocket
+class TCPThreadConfig
+{
+public:
+  //! Low-latency mode: before sleeping, spin this long checking the network and the owner for work (0: sleep
+  //! at once). Best with the TCPPeer thread pinned to a CPU of its own.
+  uint64_t busy_poll_us = 0;
+
+  std::optional<int> tcp_thread_cpu {}; //!< CPU to pin the TCPPeer thread to
+};
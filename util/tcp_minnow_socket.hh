@@ -2,18 +2,41 @@
 
 #include "byte_stream.hh"
 #include "eventloop.hh"
+#include "exception.hh"
 #include "file_descriptor.hh"
 #include "socket.hh"
 #include "tcp_config.hh"
 #include "tcp_peer.hh"
+#include "tcp_over_udp.hh"
+#include "tcp_stats.hh"
 #include "tuntap_adapter.hh"
 
 #include <atomic>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+//! Pin a thread (e.g. `pthread_self()`) to one CPU
+inline void pin_thread_to_cpu( pthread_t thread, int cpu )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( cpu, &cpus ); // NOLINT(*-signed-bitwise)
+  if ( const int err = ::pthread_setaffinity_np( thread, sizeof( cpus ), &cpus ) ) {
+    throw unix_error( "pthread_setaffinity_np", err );
+  }
+}
+
 //! Multithreaded wrapper around TCPPeer that approximates the Unix sockets API
 template<TCPDatagramAdapter AdaptT>
 class TCPMinnowSocket : public LocalStreamSocket
@@ -27,12 +50,28 @@ public:
   //! or else may wait foreever for remote peer to close the TCP connection.
   void wait_until_closed();
 
+  //! Set how the TCPPeer thread runs (before connecting or listening)
+  void set_thread_config( const TCPThreadConfig& config ) { _thread_config = config; }
+
   //! Connect using the specified configurations; blocks until connect succeeds or fails
   void connect( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad );
 
+  //! Connect and send `data`, like connect() followed by write(), but without waiting for the handshake
+  //! to send it: with a TCP Fast Open cookie in `c_tcp`, the data rides on the SYN. Blocks until the
+  //! server answers the SYN.
+  void connect_with_data( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad, std::string_view data );
+
+  //! TCP Fast Open cookie granted by the server during connect_with_data(), to be cached by the caller
+  const std::optional<std::string>& fast_open_cookie() const { return _fast_open_cookie; }
+
   //! Listen and accept using the specified configurations; blocks until accept succeeds or fails
   void listen_and_accept( const TCPConfig& c_tcp, const FdAdapterConfig& c_ad );
 
+  //! Zero-copy write: queue `data` after everything written to the socket so far, without copying it through
+  //! the socket. The TCPPeer thread cuts segments from it directly, and calls `on_acked` (on that thread) once
+  //! the peer has acknowledged its last byte. `data` must not change until then.
+  void send_zero_copy( std::shared_ptr<const std::string> data, std::function<void()> on_acked = {} );
+
   //! When a connected socket is destructed, it will send a RST
   ~TCPMinnowSocket();
 
@@ -58,6 +97,10 @@ public:
   // Return peer address from underlying datagram adapter
   const Address& peer_address() const { return _datagram_adapter.config().destination; }
 
+  //! Snapshot of the connection's statistics, as last published by the TCPPeer thread
+  //! \note Safe to call from the owner thread while the connection is running
+  TCPStats stats() const;
+
 protected:
   //! Adapter to underlying datagram socket (e.g., UDP or IP)
   AdaptT _datagram_adapter;
@@ -66,6 +109,26 @@ private:
   //! Stream socket for reads and writes between owner and TCP thread
   LocalStreamSocket _thread_data;
 
+  //! eventfd the owner writes to wake the TCPPeer thread, which otherwise sleeps until its next deadline
+  FileDescriptor _wakeup;
+
+  //! Zero-copy writes waiting for the TCPPeer thread to read up to their place in the stream
+  struct ZeroCopyWrite
+  {
+    uint64_t offset; //!< bytes the owner had written to the socket before it
+    std::shared_ptr<const std::string> data;
+    std::function<void()> on_acked;
+  };
+  std::mutex _zero_copy_mutex {}; //!< guards the queue, and the read count against the owner's snapshot of it
+  std::deque<ZeroCopyWrite> _zero_copy_writes {};
+  uint64_t _bytes_from_owner {}; //!< bytes the TCPPeer thread has read from the owner
+
+  //! Hand the zero-copy writes whose place in the stream has been reached to the TCPPeer (holding the mutex)
+  void _adopt_zero_copy_writes();
+
+  //! Wake the TCPPeer thread up
+  void _wake_tcp_thread();
+
   //! Set up the TCPPeer and the event loop
   void _initialize_TCP( const TCPConfig& config );
 
@@ -73,11 +136,34 @@ private:
   std::optional<TCPPeer> _tcp {};
 
   //! eventloop that handles all the events (new inbound datagram, new outbound bytes, new inbound bytes)
-  EventLoop _eventloop {};
+  EventLoop _eventloop { EventLoop::Backend::Epoll };
 
   //! Process events while specified condition is true
   void _tcp_loop( const std::function<bool()>& condition );
 
+  //! Segments sent by the TCPPeer since the last flush, for an adapter that writes them as one batch
+  std::vector<TCPMessage> _outbound_batch {};
+
+  //! Hand a segment sent by the TCPPeer to the adapter (or to the next batch)
+  void _send( TCPMessage&& seg );
+
+  //! Make the adapter send what it holds
+  void _flush_datagrams();
+
+  //! Read the datagrams waiting on the adapter (up to TCP_RX_BATCH of them, in one system call if it can)
+  std::vector<TCPMessage> _read_datagrams();
+
+  //! How the TCPPeer thread runs
+  TCPThreadConfig _thread_config {};
+
+  //! Start the TCPPeer thread running `main` (pinned to its CPU, if it has one)
+  template<class Main>
+  void _start_tcp_thread( Main&& main );
+
+  //! Spin until the network or the owner has something for the TCPPeer thread, or the owner has room for what the
+  //! TCPPeer has received (true), or `budget_us` is up
+  bool _busy_poll( uint64_t budget_us );
+
   //! Main loop of TCPPeer thread
   void _tcp_main();
 
@@ -94,10 +180,20 @@ private:
   bool _outbound_shutdown { false }; //!< Has the owner shut down the outbound data to the TCP connection?
 
   bool _fully_acked { false }; //!< Has the outbound data been fully acknowledged by the peer?
+
+  std::optional<std::string> _fast_open_cookie {}; //!< Cookie granted by the server's SYN-ACK
+
+  //! Statistics snapshot shared with the owner thread; the TCPPeer thread never waits for the lock
+  mutable std::mutex _stats_mutex {};
+  TCPStats _stats {};
+
+  //! Copy the TCPPeer's statistics into the shared snapshot (skipped if the owner holds the lock)
+  void _publish_stats();
 };
 
 using TCPOverIPv4MinnowSocket = TCPMinnowSocket<TCPOverIPv4OverTunFdAdapter>;
 using LossyTCPOverIPv4MinnowSocket = TCPMinnowSocket<LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>>;
+using TCPOverUDPMinnowSocket = TCPMinnowSocket<TCPOverUDPAdapter>;
 
 //! \class TCPMinnowSocket
 //! This class involves the simultaneous operation of two threads.
@@ -135,4 +231,24 @@ public:
 
     TCPOverIPv4MinnowSocket::connect( tcp_config, multiplexer_config );
   }
+
+  //! Connect and send `data`, using TCP Fast Open once the server has granted this process a cookie
+  void connect_with_data( const Address& address, std::string_view data )
+  {
+    static std::unordered_map<std::string, std::string> cookies; // by server IP address
+
+    TCPConfig tcp_config;
+    tcp_config.rt_timeout = 1000;
+    const auto cached = cookies.find( address.ip() );
+    tcp_config.fast_open_cookie = cached != cookies.end() ? cached->second : std::string {};
+
+    FdAdapterConfig multiplexer_config;
+    multiplexer_config.source = { "169.254.144.9", std::to_string( uint16_t( std::random_device()() ) ) };
+    multiplexer_config.destination = address;
+
+    TCPOverIPv4MinnowSocket::connect_with_data( tcp_config, multiplexer_config, data );
+    if ( fast_open_cookie().has_value() ) {
+      cookies[address.ip()] = fast_open_cookie().value();
+    }
+  }
 };
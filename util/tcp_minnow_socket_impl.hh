@@ -4,18 +4,24 @@
 #include "parser.hh"
 #include "tun.hh"
 
+#include <array>
+#include <climits>
 #include <cstddef>
 #include <exception>
 #include <iostream>
+#include <poll.h>
 #include <stdexcept>
 #include <string>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
-static constexpr size_t TCP_TICK_MS = 10;
+static constexpr size_t TCP_RX_BATCH = 32; // most datagrams read in one go (and coalesced by TCPPeer)
 
 inline uint64_t timestamp_ms()
 {
@@ -30,7 +36,25 @@ void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition
 {
   auto base_time = timestamp_ms();
   while ( condition() ) {
-    auto ret = _eventloop.wait_next_event( TCP_TICK_MS );
+    // send what the last round of events (or the caller) wrote, before going to sleep
+    _flush_datagrams();
+
+    // Sleep until something happens, or until the TCPPeer's next deadline: an idle connection doesn't wake up.
+    int timeout_ms = -1;
+    if ( _tcp.has_value() ) {
+      if ( const auto deadline = _tcp->next_deadline() ) {
+        const uint64_t elapsed = timestamp_ms() - base_time;
+        timeout_ms = static_cast<int>(
+          std::min<uint64_t>( deadline.value() > elapsed ? deadline.value() - elapsed : 0, INT_MAX ) );
+      }
+    }
+
+    // In busy-poll mode, serve what is ready now; if nothing is, spin on the fds for a while before sleeping
+    const bool busy_poll = _thread_config.busy_poll_us > 0 and timeout_ms != 0;
+    auto ret = _eventloop.wait_next_event( busy_poll ? 0 : timeout_ms );
+    if ( busy_poll and ret == EventLoop::Result::Timeout ) {
+      ret = _eventloop.wait_next_event( _busy_poll( _thread_config.busy_poll_us ) ? 0 : timeout_ms );
+    }
     if ( ret == EventLoop::Result::Exit or _abort ) {
       break;
     }
@@ -41,11 +65,133 @@ void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition
 
     if ( _tcp.value().active() ) {
       const auto next_time = timestamp_ms();
-      _tcp.value().tick( next_time - base_time, [&]( auto x ) { _datagram_adapter.write( x ); } );
+      _tcp.value().tick( next_time - base_time, [&]( auto x ) { _send( std::move( x ) ); } );
       _datagram_adapter.tick( next_time - base_time );
       base_time = next_time;
     }
+
+    _publish_stats();
   }
+  _flush_datagrams();
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_send( TCPMessage&& seg )
+{
+  if constexpr ( BatchTCPDatagramAdapter<AdaptT> ) {
+    _outbound_batch.push_back( std::move( seg ) );
+  } else {
+    _datagram_adapter.write( seg );
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_flush_datagrams()
+{
+  if constexpr ( BatchTCPDatagramAdapter<AdaptT> ) {
+    if ( not _outbound_batch.empty() ) {
+      _datagram_adapter.write_batch( _outbound_batch );
+      _outbound_batch.clear();
+    }
+  }
+  _datagram_adapter.flush();
+}
+
+template<TCPDatagramAdapter AdaptT>
+std::vector<TCPMessage> TCPMinnowSocket<AdaptT>::_read_datagrams()
+{
+  std::vector<TCPMessage> batch;
+  if constexpr ( BatchTCPDatagramAdapter<AdaptT> ) {
+    _datagram_adapter.read_batch( batch, TCP_RX_BATCH );
+  } else {
+    // one datagram per (non-blocking) read(), until a read finds none waiting: it reads nothing, where a
+    // datagram the adapter rejects still counts as a read
+    const FileDescriptor& fd = _datagram_adapter.fd();
+    for ( size_t reads = 0; reads < TCP_RX_BATCH or _datagram_adapter.has_buffered(); ++reads ) {
+      const unsigned read_count = fd.read_count();
+      if ( auto seg = _datagram_adapter.read() ) {
+        batch.push_back( std::move( seg.value() ) );
+      } else if ( fd.read_count() == read_count and not _datagram_adapter.has_buffered() ) {
+        break;
+      }
+    }
+  }
+  return batch;
+}
+
+template<TCPDatagramAdapter AdaptT>
+bool TCPMinnowSocket<AdaptT>::_busy_poll( const uint64_t budget_us )
+{
+  // the fds whose rules are interested, in the same directions (poll ignores the negative ones)
+  const bool active = _tcp.has_value() and _tcp->active();
+  const bool pushing = active and not _outbound_shutdown and _tcp->outbound_writer().available_capacity() > 0;
+  const bool delivering = _tcp.has_value()
+                          and ( _tcp->inbound_reader().bytes_buffered()
+                                or ( ( _tcp->inbound_reader().is_finished() or _tcp->inbound_reader().has_error() )
+                                     and not _inbound_shutdown ) );
+  const auto owner_events = static_cast<int16_t>( ( pushing ? POLLIN : 0 ) | ( delivering ? POLLOUT : 0 ) );
+  std::array<pollfd, 3> pfds { { { active ? _datagram_adapter.fd().fd_num() : -1, POLLIN, 0 },
+                                 { owner_events ? _thread_data.fd_num() : -1, owner_events, 0 },
+                                 { active ? _wakeup.fd_num() : -1, POLLIN, 0 } } };
+
+  const auto give_up = std::chrono::steady_clock::now() + std::chrono::microseconds( budget_us );
+  do {
+    if ( _datagram_adapter.has_buffered() or CheckSystemCall( "poll", ::poll( pfds.data(), pfds.size(), 0 ) ) > 0 ) {
+      return true;
+    }
+    std::this_thread::yield(); // (if another thread shares the CPU, let it run)
+  } while ( std::chrono::steady_clock::now() < give_up and not _abort );
+  return false;
+}
+
+template<TCPDatagramAdapter AdaptT>
+template<class Main>
+void TCPMinnowSocket<AdaptT>::_start_tcp_thread( Main&& main )
+{
+  _tcp_thread = std::thread( std::forward<Main>( main ) );
+  if ( _thread_config.tcp_thread_cpu.has_value() ) {
+    pin_thread_to_cpu( _tcp_thread.native_handle(), _thread_config.tcp_thread_cpu.value() );
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::send_zero_copy( std::shared_ptr<const std::string> data,
+                                              std::function<void()> on_acked )
+{
+  {
+    // everything written so far has either been read by the TCPPeer thread, or is still in the socket
+    const std::lock_guard lock { _zero_copy_mutex };
+    int unread = 0;
+    CheckSystemCall( "ioctl(FIONREAD)", ::ioctl( _thread_data.fd_num(), FIONREAD, &unread ) );
+    _zero_copy_writes.push_back( { _bytes_from_owner + unread, std::move( data ), std::move( on_acked ) } );
+  }
+  _wake_tcp_thread();
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_adopt_zero_copy_writes()
+{
+  while ( not _zero_copy_writes.empty() and _zero_copy_writes.front().offset == _bytes_from_owner ) {
+    auto& write = _zero_copy_writes.front();
+    _tcp->send_zero_copy( std::move( write.data ), std::move( write.on_acked ) );
+    _zero_copy_writes.pop_front();
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_publish_stats()
+{
+  const std::unique_lock lock { _stats_mutex, std::try_to_lock };
+  if ( lock.owns_lock() and _tcp.has_value() ) {
+    _stats = _tcp->stats();
+  }
+}
+
+template<TCPDatagramAdapter AdaptT>
+TCPStats TCPMinnowSocket<AdaptT>::stats() const
+{
+  const std::lock_guard lock { _stats_mutex };
+  return _stats;
 }
 
 //! \param[in] data_socket_pair is a pair of connected AF_UNIX SOCK_STREAM sockets
@@ -56,9 +202,16 @@ TCPMinnowSocket<AdaptT>::TCPMinnowSocket( std::pair<FileDescriptor, FileDescript
   : LocalStreamSocket( std::move( data_socket_pair.first ) )
   , _datagram_adapter( std::move( datagram_interface ) )
   , _thread_data( std::move( data_socket_pair.second ) )
+  , _wakeup( CheckSystemCall( "eventfd", ::eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) )
 {
   _thread_data.set_blocking( false );
+  _wakeup.set_blocking( false );
   set_blocking( false );
+
+  // (an adapter that reads one datagram at a time is read until it has none left: see _read_datagrams)
+  if constexpr ( not BatchTCPDatagramAdapter<AdaptT> ) {
+    _datagram_adapter.fd().set_blocking( false );
+  }
 }
 
 template<TCPDatagramAdapter AdaptT>
@@ -66,7 +219,25 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
 {
   _tcp.emplace( config );
 
-  // Set up the event loop
+  // Set up the event loop, serving every ready rule on each wakeup
+
+  _eventloop.set_dispatch( EventLoop::Dispatch::AllReady );
+
+  // rule 0: the owner wants the TCPPeer thread to notice something (e.g. the abort flag)
+  _eventloop.add_rule(
+    "wake up TCPPeer thread",
+    _wakeup,
+    Direction::In,
+    [&] {
+      std::string count( sizeof( uint64_t ), 0 );
+      _wakeup.read( count );
+
+      // (e.g. a zero-copy write, which needs no more bytes from the socket before it)
+      const std::lock_guard lock { _zero_copy_mutex };
+      _adopt_zero_copy_writes();
+      _tcp->push( [&]( auto x ) { _send( std::move( x ) ); } );
+    },
+    [&] { return _tcp->active(); } );
 
   // There are three events to handle:
   //
@@ -86,8 +257,10 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
     _datagram_adapter.fd(),
     Direction::In,
     [&] {
-      if ( auto seg = _datagram_adapter.read() ) {
-        _tcp->receive( std::move( seg.value() ), [&]( auto x ) { _datagram_adapter.write( x ); } );
+      // Drain the datagrams that are already waiting, so TCPPeer can coalesce them and reply once.
+      auto batch = _read_datagrams();
+      if ( not batch.empty() ) {
+        _tcp->receive_batch( std::move( batch ), [&]( auto x ) { _send( std::move( x ) ); } );
       }
 
       // debugging output:
@@ -105,10 +278,20 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
     _thread_data,
     Direction::In,
     [&] {
+      // read no further than the next zero-copy write, which goes in between
+      const std::lock_guard lock { _zero_copy_mutex };
+      _adopt_zero_copy_writes();
+      uint64_t limit = _tcp->outbound_writer().available_capacity();
+      if ( not _zero_copy_writes.empty() ) {
+        limit = std::min( limit, _zero_copy_writes.front().offset - _bytes_from_owner );
+      }
+
       std::string data;
-      data.resize( _tcp->outbound_writer().available_capacity() );
+      data.resize( limit );
       _thread_data.read( data );
+      _bytes_from_owner += data.size();
       _tcp->outbound_writer().push( move( data ) );
+      _adopt_zero_copy_writes();
 
       if ( _thread_data.eof() ) {
         _tcp->outbound_writer().close();
@@ -121,7 +304,7 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
                   << " still in flight).\n";
       }
 
-      _tcp->push( [&]( auto x ) { _datagram_adapter.write( x ); } );
+      _tcp->push( [&]( auto x ) { _send( std::move( x ) ); } );
     },
     [&] {
       return ( _tcp->active() ) and ( not _outbound_shutdown )
@@ -199,6 +382,7 @@ TCPMinnowSocket<AdaptT>::~TCPMinnowSocket()
       std::cerr << "Warning: unclean shutdown of TCPMinnowSocket\n";
       // force the other side to exit
       _abort.store( true );
+      _wake_tcp_thread();
       _tcp_thread.join();
     }
   } catch ( const std::exception& e ) {
@@ -206,6 +390,14 @@ TCPMinnowSocket<AdaptT>::~TCPMinnowSocket()
   }
 }
 
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_wake_tcp_thread()
+{
+  // (bypassing the FileDescriptor's write count, which the TCPPeer thread's reads update without a lock)
+  const uint64_t one = 1;
+  CheckSystemCall( "write", static_cast<int>( ::write( _wakeup.fd_num(), &one, sizeof( one ) ) ) );
+}
+
 template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::wait_until_closed()
 {
@@ -236,7 +428,7 @@ void TCPMinnowSocket<AdaptT>::connect( const TCPConfig& c_tcp, const FdAdapterCo
     throw std::runtime_error( "TCPPeer not successfully initialized" );
   }
 
-  _tcp->push( [&]( auto x ) { _datagram_adapter.write( x ); } );
+  _tcp->push( [&]( auto x ) { _send( std::move( x ) ); } );
 
   if ( _tcp->sender().sequence_numbers_in_flight() != 1 ) {
     throw std::runtime_error( "After TCPConnection::connect(), expected sequence_numbers_in_flight() == 1" );
@@ -249,7 +441,44 @@ void TCPMinnowSocket<AdaptT>::connect( const TCPConfig& c_tcp, const FdAdapterCo
     std::cerr << "DEBUG: minnow successfully connected to " << c_ad.destination.to_string() << ".\n";
   }
 
-  _tcp_thread = std::thread( &TCPMinnowSocket::_tcp_main, this );
+  _start_tcp_thread( [this] { _tcp_main(); } );
+}
+
+//! \param[in] c_tcp is the TCPConfig for the TCPConnection (with the server's Fast Open cookie, if known)
+//! \param[in] c_ad is the FdAdapterConfig for the FdAdapter
+//! \param[in] data is the first data to send on the connection
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::connect_with_data( const TCPConfig& c_tcp,
+                                                 const FdAdapterConfig& c_ad,
+                                                 std::string_view data )
+{
+  if ( _tcp ) {
+    throw std::runtime_error( "connect_with_data() with TCPConnection already initialized" );
+  }
+
+  _initialize_TCP( c_tcp );
+
+  _datagram_adapter.config_mut() = c_ad;
+
+  std::cerr << "DEBUG: minnow connecting to " << c_ad.destination.to_string() << " with data...\n";
+
+  if ( not _tcp.has_value() ) {
+    throw std::runtime_error( "TCPPeer not successfully initialized" );
+  }
+
+  // queue the data before the SYN goes out, so that it can ride on the SYN
+  _tcp->outbound_writer().push( std::string { data } );
+  _tcp->push( [&]( auto x ) { _send( std::move( x ) ); } );
+
+  _tcp_loop( [&] { return not _tcp->has_ackno() and _tcp->active(); } );
+  if ( _tcp->inbound_reader().has_error() ) {
+    std::cerr << "DEBUG: minnow error on connecting to " << c_ad.destination.to_string() << ".\n";
+  } else {
+    std::cerr << "DEBUG: minnow successfully connected to " << c_ad.destination.to_string() << ".\n";
+  }
+  _fast_open_cookie = _tcp->fast_open_cookie();
+
+  _start_tcp_thread( [this] { _tcp_main(); } );
 }
 
 //! \param[in] c_tcp is the TCPConfig for the TCPConnection
@@ -270,7 +499,7 @@ void TCPMinnowSocket<AdaptT>::listen_and_accept( const TCPConfig& c_tcp, const F
   _tcp_loop( [&] { return ( not _tcp->has_ackno() ) or ( _tcp->sender().sequence_numbers_in_flight() ); } );
   std::cerr << "DEBUG: minnow new connection from " << _datagram_adapter.config().destination.to_string() << ".\n";
 
-  _tcp_thread = std::thread( &TCPMinnowSocket::_tcp_main, this );
+  _start_tcp_thread( [this] { _tcp_main(); } );
 }
 
 template<TCPDatagramAdapter AdaptT>
@@ -286,6 +515,10 @@ void TCPMinnowSocket<AdaptT>::_tcp_main()
       std::cerr << "DEBUG: minnow TCP connection finished "
                 << ( _tcp->inbound_reader().has_error() ? "uncleanly.\n" : "cleanly.\n" );
     }
+    {
+      const std::lock_guard lock { _stats_mutex };
+      _stats = _tcp->stats();
+    }
     _tcp.reset();
   } catch ( const std::exception& e ) {
     std::cerr << "Exception in TCPConnection runner thread: " << e.what() << "\n";
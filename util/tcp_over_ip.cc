@@ -1,10 +1,12 @@
 #include "tcp_over_ip.hh"
 
+#include "checksum.hh"
 #include "ipv4_datagram.hh"
 #include "ipv4_header.hh"
 #include "parser.hh"
 
 #include <arpa/inet.h>
+#include <cstdint>
 #include <stdexcept>
 #include <unistd.h>
 #include <utility>
@@ -23,7 +25,7 @@ using namespace std;
 //! `_listen` flag and records the source and destination addresses and port numbers
 //! from the TCP header; it uses this information to filter future reads.
 //! \returns a std::optional<TCPSegment> that is empty if the segment was invalid or unrelated
-optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagram& ip_dgram )
+optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( InternetDatagram ip_dgram )
 {
   // is the IPv4 datagram for us?
   // Note: it's valid to bind to address "0" (INADDR_ANY) and reply from actual address contacted
@@ -43,7 +45,7 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagra
 
   // is the payload a valid TCP segment?
   TCPSegment tcp_seg;
-  if ( not parse( tcp_seg, ip_dgram.payload, ip_dgram.header.pseudo_checksum() ) ) {
+  if ( not parse( tcp_seg, std::move( ip_dgram.payload ), ip_dgram.header.pseudo_checksum() ) ) {
     return {};
   }
 
@@ -69,7 +71,7 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagra
     return {};
   }
 
-  return tcp_seg.message;
+  return std::move( tcp_seg.message );
 }
 
 //! Takes a TCP segment, sets port numbers as necessary, and wraps it in an IPv4 datagram
@@ -85,7 +87,7 @@ InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
   InternetDatagram ip_dgram;
   ip_dgram.header.src = config().source.ipv4_numeric();
   ip_dgram.header.dst = config().destination.ipv4_numeric();
-  ip_dgram.header.len = ip_dgram.header.hlen * 4 + 20 /* tcp header len */ + seg.message.sender.payload.size();
+  ip_dgram.header.len = ip_dgram.header.hlen * 4 + seg.header_length() + seg.message.sender.payload.size();
 
   // set payload, calculating TCP checksum using information from IP header
   seg.compute_checksum( ip_dgram.header.pseudo_checksum() );
@@ -94,3 +96,65 @@ InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
 
   return ip_dgram;
 }
+
+//! \details Between two segments, the IPv4 header only differs in its length (and so its checksum). The TCP
+//! header keeps its ports, and the pseudo-header its addresses and protocol.
+const vector<string_view>& TCPOverIPv4Adapter::wire_bytes( const TCPMessage& msg )
+{
+  const HeaderTemplate& header_template = _current_template();
+  _tcp_header = header_template.tcp_ports;
+  TCPSegment::patch_header( _tcp_header, msg );
+
+  const string_view payload = msg.sender.payload;
+
+  const auto tcp_length = static_cast<uint16_t>( _tcp_header.size() + payload.size() );
+  const auto total_length = static_cast<uint16_t>( IPv4Header::LENGTH + tcp_length );
+  _ip_header = header_template.ip_header;
+  put_integer( _ip_header, 2, total_length );
+  put_integer( _ip_header, 10, InternetChecksum { header_template.ip_sum + total_length }.value() );
+
+  InternetChecksum check { header_template.pseudo_sum + tcp_length };
+  check.add( _tcp_header );
+  check.add( payload );
+  put_integer( _tcp_header, 16, check.value() );
+
+  _wire = { _ip_header, _tcp_header };
+  if ( not payload.empty() ) {
+    _wire.push_back( payload );
+  }
+  return _wire;
+}
+
+const TCPOverIPv4Adapter::HeaderTemplate& TCPOverIPv4Adapter::_current_template()
+{
+  const uint32_t source_ip = config().source.ipv4_numeric();
+  const uint32_t destination_ip = config().destination.ipv4_numeric();
+  const uint16_t source_port = config().source.port();
+  const uint16_t destination_port = config().destination.port();
+  if ( _header_template.has_value() and _header_template->source_ip == source_ip
+       and _header_template->destination_ip == destination_ip and _header_template->source_port == source_port
+       and _header_template->destination_port == destination_port ) {
+    return _header_template.value();
+  }
+
+  IPv4Header ip_header;
+  ip_header.src = source_ip;
+  ip_header.dst = destination_ip;
+  ip_header.len = ip_header.hlen * 4;
+
+  HeaderTemplate& ret = _header_template.emplace( HeaderTemplate { .source_ip = source_ip,
+                                                                   .destination_ip = destination_ip,
+                                                                   .source_port = source_port,
+                                                                   .destination_port = destination_port,
+                                                                   .ip_header = serialize( ip_header ).front(),
+                                                                   .tcp_ports = string( 4, 0 ),
+                                                                   .ip_sum = 0,
+                                                                   .pseudo_sum = ip_header.pseudo_checksum() } );
+  put_integer( ret.ip_header, 2, uint16_t { 0 } );
+  InternetChecksum ip_sum;
+  ip_sum.add( ret.ip_header );
+  ret.ip_sum = static_cast<uint16_t>( ~ip_sum.value() );
+  put_integer( ret.tcp_ports, 0, source_port );
+  put_integer( ret.tcp_ports, 2, destination_port );
+  return ret;
+}
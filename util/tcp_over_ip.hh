@@ -1,16 +1,52 @@
 #pragma once
 
+#include "address.hh"
 #include "fd_adapter.hh"
 #include "ipv4_datagram.hh"
 #include "tcp_segment.hh"
 
+#include <cstddef>
+#include <cstdint>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 //! \brief A converter from TCP segments to serialized IPv4 datagrams
 class TCPOverIPv4Adapter : public FdAdapterBase
 {
 public:
-  std::optional<TCPMessage> unwrap_tcp_in_ip( const InternetDatagram& ip_dgram );
+  std::optional<TCPMessage> unwrap_tcp_in_ip( InternetDatagram ip_dgram );
 
   InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg );
+
+  //! \brief Serialize a TCP segment wrapped in an IPv4 datagram, as buffers for one gather write
+  //! \details The headers are copied from templates prebuilt for the connection, with only the fields that
+  //! change between segments patched in.
+  //! \returns views of the IPv4 header, TCP header and payload (which is `msg`'s own), valid until the next
+  //! call and while `msg` lives
+  const std::vector<std::string_view>& wire_bytes( const TCPMessage& msg );
+
+private:
+  //! Headers with what stays the same for every segment between two addresses, and their partial checksums
+  struct HeaderTemplate
+  {
+    uint32_t source_ip;
+    uint32_t destination_ip;
+    uint16_t source_port;
+    uint16_t destination_port;
+    std::string ip_header; //!< with zero length and checksum
+    std::string tcp_ports; //!< the start of the TCP header
+    uint32_t ip_sum;       //!< sum of the IPv4 header template
+    uint32_t pseudo_sum;   //!< sum of the pseudo-header, but for the TCP length
+  };
+  std::optional<HeaderTemplate> _header_template {};
+
+  //! The template for the current addresses (rebuilt when they change, e.g. when a listening adapter connects)
+  const HeaderTemplate& _current_template();
+
+  //! Scratch space for wire_bytes()
+  std::string _ip_header {};
+  std::string _tcp_header {};
+  std::vector<std::string_view> _wire {};
 };
@@ -0,0 +1,121 @@
+#include "tcp_over_udp.hh"
+
+#include "parser.hh"
+
+#include <utility>
+
+using namespace std;
+
+// (there is no IP header: the UDP checksum covers the addresses, so the TCP checksum covers just the segment)
+static constexpr uint32_t NO_PSEUDO_HEADER = 0;
+
+TCPOverUDPAdapter::TCPOverUDPAdapter( UDPSocket&& socket, const size_t batch_size )
+  : _socket( std::move( socket ) ), _batch_size( batch_size )
+{
+  if ( _batch_size == 0 ) {
+    throw runtime_error( "TCPOverUDPAdapter: batch size must be positive" );
+  }
+}
+
+optional<TCPMessage> TCPOverUDPAdapter::read()
+{
+  if ( _received.empty() ) {
+    const size_t count = _socket.recv_batch( _payloads, _sources, _batch_size, _scratch );
+    for ( size_t i = 0; i < count; ++i ) {
+      _received.push_back( std::move( _payloads[i] ) );
+      _received_from.push_back( std::move( _sources[i] ) );
+    }
+    if ( _received.empty() ) {
+      return {};
+    }
+  }
+
+  string payload = std::move( _received.front() );
+  const Address source = std::move( _received_from.front() );
+  _received.pop_front();
+  _received_from.pop_front();
+  return _unwrap( std::move( payload ), source );
+}
+
+optional<TCPMessage> TCPOverUDPAdapter::_unwrap( string&& payload, const Address& source )
+{
+  // is the datagram from our peer?
+  if ( not listening() and source != config().destination ) {
+    return {};
+  }
+
+  // is the payload a valid TCP segment?
+  TCPSegment tcp_seg;
+  if ( not parse( tcp_seg, vector { std::move( payload ) }, NO_PSEUDO_HEADER ) ) {
+    return {};
+  }
+
+  // is the TCP segment for us?
+  if ( tcp_seg.udinfo.dst_port != config().source.port() ) {
+    return {};
+  }
+
+  // should we reply to this sender?
+  if ( listening() ) {
+    if ( tcp_seg.message.sender.SYN and not tcp_seg.message.sender.RST ) {
+      config_mutable().destination = source;
+      set_listening( false );
+    } else {
+      return {};
+    }
+  }
+
+  return std::move( tcp_seg.message );
+}
+
+void TCPOverUDPAdapter::read_batch( vector<TCPMessage>& segs, size_t max_count )
+{
+  for ( ; max_count > 0 and not _received.empty(); --max_count ) {
+    if ( auto seg = read() ) {
+      segs.push_back( std::move( seg.value() ) );
+    }
+  }
+  if ( max_count == 0 ) {
+    return;
+  }
+
+  const size_t count = _socket.recv_batch( _payloads, _sources, max_count, _scratch );
+  for ( size_t i = 0; i < count; ++i ) {
+    if ( auto seg = _unwrap( std::move( _payloads[i] ), _sources[i] ) ) {
+      segs.push_back( std::move( seg.value() ) );
+    }
+  }
+}
+
+vector<string> TCPOverUDPAdapter::_wrap( const TCPMessage& seg ) const
+{
+  TCPSegment tcp_seg { .message = seg };
+  tcp_seg.udinfo.src_port = config().source.port();
+  tcp_seg.udinfo.dst_port = config().destination.port();
+  tcp_seg.compute_checksum( NO_PSEUDO_HEADER );
+  return serialize( tcp_seg );
+}
+
+void TCPOverUDPAdapter::write( const TCPMessage& seg )
+{
+  _outbound.push_back( _wrap( seg ) );
+  if ( _outbound.size() >= _batch_size ) {
+    flush();
+  }
+}
+
+void TCPOverUDPAdapter::write_batch( const vector<TCPMessage>& segs )
+{
+  for ( const auto& seg : segs ) {
+    _outbound.push_back( _wrap( seg ) );
+  }
+  flush();
+}
+
+void TCPOverUDPAdapter::flush()
+{
+  if ( not _outbound.empty() ) {
+    _socket.sendto_batch( config().destination, _outbound, _scratch );
+    _outbound.clear();
+  }
+}
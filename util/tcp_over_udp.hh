@@ -0,0 +1,77 @@
+#pragma once
+
+#include "address.hh"
+#include "fd_adapter.hh"
+#include "socket.hh"
+#include "tcp_segment.hh"
+#include "tuntap_adapter.hh"
+
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+//! \brief A FD adapter that carries serialized TCP segments in UDP datagrams (an unprivileged overlay: no TUN device)
+//! \details The UDP socket is bound (and connected, if desired) by the caller. FdAdapterConfig::source's port is
+//! the TCP port of this end, and FdAdapterConfig::destination is the UDP address of the peer, which is where
+//! segments are sent and the only sender whose segments are accepted. A listening adapter takes the sender of
+//! the first SYN as its peer.
+//!
+//! Datagrams move in batches: read() receives up to `batch_size` waiting datagrams with one
+//! [recvmmsg(2)](\ref man2::recvmmsg) and hands them out one by one, and write() holds segments back until
+//! `batch_size` are queued or flush() is called, then sends them with one [sendmmsg(2)](\ref man2::sendmmsg).
+//! read_batch() and write_batch() move a whole batch, of any size, with one system call each.
+class TCPOverUDPAdapter : public FdAdapterBase
+{
+public:
+  static constexpr size_t DEFAULT_BATCH_SIZE = 16;
+
+  //! Construct from a bound UDP socket
+  explicit TCPOverUDPAdapter( UDPSocket&& socket, size_t batch_size = DEFAULT_BATCH_SIZE );
+
+  //! Returns the next TCP segment from the peer (receiving a new batch of datagrams if none is left)
+  std::optional<TCPMessage> read();
+
+  //! Queues a TCP segment to be sent to the peer (sending the queue once it holds a full batch)
+  void write( const TCPMessage& seg );
+
+  //! Sends the queued segments
+  void flush();
+
+  //! Appends up to `max_count` TCP segments from the peer to `segs` (those left by read() first)
+  void read_batch( std::vector<TCPMessage>& segs, size_t max_count );
+
+  //! Sends the queued segments, then `segs`, all together
+  void write_batch( const std::vector<TCPMessage>& segs );
+
+  //! Are datagrams from the last batch still waiting for read()?
+  bool has_buffered() const { return not _received.empty(); }
+
+  //! Access underlying file descriptor
+  FileDescriptor& fd() { return _socket; }
+
+private:
+  UDPSocket _socket;
+  size_t _batch_size;
+
+  //! Datagrams received but not yet read, and their senders
+  std::deque<std::string> _received {};
+  std::deque<Address> _received_from {};
+
+  //! Scratch space for recvmmsg and sendmmsg
+  std::vector<std::string> _payloads {};
+  std::vector<Address> _sources {};
+  DatagramSocket::BatchScratch _scratch {};
+
+  //! Serialized segments waiting for flush()
+  std::vector<std::vector<std::string>> _outbound {};
+
+  //! Parse a datagram, and check that it is from (or, when listening, becomes) the peer
+  std::optional<TCPMessage> _unwrap( std::string&& payload, const Address& source );
+
+  //! Serialize a segment for the peer
+  std::vector<std::string> _wrap( const TCPMessage& seg ) const;
+};
+
+static_assert( BatchTCPDatagramAdapter<TCPOverUDPAdapter> );
+static_assert( BatchTCPDatagramAdapter<LossyFdAdapter<TCPOverUDPAdapter>> );
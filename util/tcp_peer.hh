@@ -6,9 +6,17 @@
 #include "tcp_segment.hh"
 #include "tcp_sender.hh"
 #include "tcp_sender_message.hh"
+#include "tcp_stats.hh"
 
+#include <algorithm>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
 
 class TCPPeer
 {
@@ -18,9 +26,21 @@ class TCPPeer
   }
 
 public:
-  explicit TCPPeer( const TCPConfig& cfg ) : cfg_( cfg ) {}
+  explicit TCPPeer( const TCPConfig& cfg ) : cfg_( cfg )
+  {
+    // with a cookie from an earlier connection, data written before the first push rides on the SYN
+    if ( cfg_.fast_open_cookie.has_value() and not cfg_.fast_open_cookie->empty() ) {
+      sender_.enable_fast_open();
+    }
+  }
 
   Writer& outbound_writer() { return sender_.writer(); }
+
+  // Send `data` without copying it into the outbound stream; `on_acked` runs once the peer has acknowledged it
+  void send_zero_copy( std::shared_ptr<const std::string> data, std::function<void()> on_acked = {} )
+  {
+    sender_.send_zero_copy( std::move( data ), std::move( on_acked ) );
+  }
   Reader& inbound_reader() { return receiver_.reader(); }
 
   /* Type of the `transmit` function that the push and tick methods can use to send messages */
@@ -32,6 +52,19 @@ public:
   {
     cumulative_time_ += t;
     sender_.tick( t, make_send( transmit ) );
+
+    // An inactive peer sends nothing more, so an ACK still delayed is dropped.
+    if ( not active() ) {
+      cancel_delayed_ack();
+      return;
+    }
+    autotune_receive_buffer();
+
+    // Send a delayed ACK whose timer has expired, or tell the peer that the window has opened up.
+    const bool ack_timer_expired = ack_deadline_.has_value() and cumulative_time_ >= ack_deadline_.value();
+    if ( ack_timer_expired or window_update_due() ) {
+      send( sender_.make_empty_message(), transmit );
+    }
   }
   bool has_ackno() const { return receiver_.send().ackno.has_value(); }
 
@@ -47,7 +80,148 @@ public:
     return ( not any_errors ) and ( sender_active or receiver_active or lingering );
   }
 
+  // How many milliseconds until tick() next has something to do (a retransmission, a delayed ACK, the end
+  // of lingering, or receive-buffer tuning)? Empty if nothing is scheduled: only a segment or a write
+  // can change that.
+  std::optional<uint64_t> next_deadline() const
+  {
+    if ( not active() ) {
+      return {};
+    }
+
+    std::optional<uint64_t> deadline = sender_.next_deadline();
+    const auto consider = [&]( uint64_t when ) {
+      const uint64_t remaining = when > cumulative_time_ ? when - cumulative_time_ : 0;
+      deadline = std::min( deadline.value_or( remaining ), remaining );
+    };
+
+    if ( ack_deadline_.has_value() ) {
+      consider( ack_deadline_.value() );
+    }
+    if ( linger_after_streams_finish_ and sender_.reader().is_finished() and not sender_.sequence_numbers_in_flight()
+         and receiver_.writer().is_closed() ) {
+      consider( time_of_last_receipt_ + 10UL * cfg_.rt_timeout );
+    }
+    if ( cfg_.recv_capacity_max > cfg_.recv_capacity and has_ackno() and not receiver_.writer().is_closed() ) {
+      if ( rcv_interval_started_ ) {
+        consider( rcv_interval_start_ + receive_rtt() );
+      }
+      // (the idle shrink only happens once the application has read everything that arrived)
+      const bool grown = receiver_.writer().capacity() > cfg_.recv_capacity;
+      if ( receive_buffer_drained() and ( rcv_interval_started_ or ( grown and not rcv_shrink_pending_ ) ) ) {
+        consider( time_of_last_receipt_ + TCPConfig::RECV_IDLE_MS );
+      }
+    }
+    return deadline;
+  }
+
   void receive( TCPMessage msg, const TransmitFunction& transmit )
+  {
+    absorb( std::move( msg ), 1 );
+    flush( transmit );
+  }
+
+  // Receive a batch of messages read together from the network. Consecutive in-order segments with
+  // identical headers are merged before they reach the TCPReceiver (software GRO), and replies are
+  // only sent once the whole batch has been processed. (A merged segment keeps its payloads apart: the
+  // Reassembler takes them one after the other, so no byte is copied to merge them.)
+  void receive_batch( std::vector<TCPMessage> batch, const TransmitFunction& transmit )
+  {
+    for ( auto it = batch.begin(); it != batch.end(); ) {
+      TCPMessage merged = std::move( *it );
+      size_t length = merged.sender.payload.size();
+      gro_payloads_.clear();
+      for ( ++it; it != batch.end() and can_coalesce( merged, length, *it ); ++it ) {
+        length += it->sender.payload.size();
+        gro_payloads_.push_back( std::move( it->sender.payload ) );
+        merged.sender.FIN = it->sender.FIN;
+      }
+      segments_coalesced_ += gro_payloads_.size();
+      absorb( std::move( merged ), 1 + gro_payloads_.size(), gro_payloads_ );
+    }
+    gro_payloads_.clear();
+    flush( transmit );
+  }
+
+  // How many acknowledgments were folded into a later segment instead of being sent on their own?
+  uint64_t acks_coalesced() const { return acks_coalesced_; }
+
+  // How many received segments were merged into their predecessor by receive_batch?
+  uint64_t segments_coalesced() const { return segments_coalesced_; }
+
+  // Snapshot of the connection's sender and receiver state
+  TCPStats stats() const
+  {
+    TCPStats ret;
+    ret.bytes_sent = sender_.reader().bytes_popped();
+    ret.bytes_acked = sender_.bytes_acked();
+    ret.segments_sent = segments_sent_;
+    ret.segments_retransmitted = sender_.retransmissions();
+    ret.consecutive_retransmissions = sender_.consecutive_retransmissions();
+    ret.bytes_in_flight = sender_.sequence_numbers_in_flight();
+    ret.peer_window = sender_.peer_window();
+    ret.outbound_buffered = sender_.reader().bytes_buffered();
+    ret.srtt_ms = sender_.smoothed_rtt();
+    ret.rto_ms = sender_.current_RTO();
+
+    ret.segments_received = segments_received_;
+    ret.bytes_received = receiver_.writer().bytes_pushed();
+    ret.advertised_window = receiver_.send().window_size;
+    ret.reassembler_bytes_pending = receiver_.reassembler().bytes_pending();
+    ret.inbound_buffered = receiver_.reader().bytes_buffered();
+    ret.acks_coalesced = acks_coalesced_;
+    ret.segments_coalesced = segments_coalesced_;
+    ret.receive_buffer = receiver_.writer().capacity();
+    return ret;
+  }
+
+  // TCP Fast Open cookie granted by the server's SYN-ACK (to be cached for the next connection to it)
+  const std::optional<std::string>& fast_open_cookie() const { return fast_open_cookie_; }
+
+  // Window shift a TCPPeer with this configuration offers in its SYN
+  static uint8_t receive_window_shift( const TCPConfig& cfg )
+  {
+    return window_shift_for( std::max( cfg.recv_capacity, cfg.recv_capacity_max ) );
+  }
+
+  // Testing interface
+  const TCPReceiver& receiver() const { return receiver_; }
+  const TCPSender& sender() const { return sender_; }
+
+private:
+  TCPConfig cfg_;
+  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout };
+  TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
+
+  bool need_send_ {};
+  std::optional<std::string> fast_open_cookie_ {};
+
+  void send( const TCPSenderMessage& sender_message, const TransmitFunction& transmit )
+  {
+    if ( rcv_shrink_pending_ ) {
+      shrink_receive_buffer();
+    }
+    TCPMessage msg { sender_message, receiver_.send() };
+    encode_window( msg );
+    stamp( msg );
+    if ( msg.sender.SYN and not msg.receiver.ackno.has_value() ) {
+      msg.sender.fast_open_cookie = cfg_.fast_open_cookie;
+    }
+    last_window_sent_ = ( msg.sender.SYN or not wscale_ok_ )
+                          ? msg.receiver.window_size
+                          : static_cast<uint64_t>( msg.receiver.window_size ) << rcv_wscale_;
+    last_edge_sent_ = receiver_.writer().bytes_pushed() + last_window_sent_;
+    transmit( std::move( msg ) );
+    receiver_.ack_sent();
+    ++segments_sent_;
+
+    // every segment carries the latest ackno, so any delayed ACK has now been sent
+    cancel_delayed_ack();
+  }
+
+  // Process one incoming message (possibly several coalesced segments, whose payload continues with
+  // `more_payloads`) without sending the reply yet.
+  void absorb( TCPMessage msg, size_t segments, std::span<std::string> more_payloads = {} )
   {
     if ( not active() ) {
       return;
@@ -55,26 +229,75 @@ public:
 
     // Record time in case this peer has to linger after streams finish.
     time_of_last_receipt_ = cumulative_time_;
-
-    // If SenderMessage occupies a sequence number, make sure to reply.
-    need_send_ |= ( msg.sender.sequence_length() > 0 );
+    segments_received_ += segments;
 
     // If SenderMessage is a "keep-alive" (with intentionally invalid seqno), make sure to reply.
     // (N.B. orthodox TCP rules require a reply on any unacceptable segment.)
     const auto our_ackno = receiver_.send().ackno;
     need_send_ |= ( our_ackno.has_value() and msg.sender.seqno + 1 == our_ackno.value() );
 
+    // Remember what we need to decide whether the reply can be delayed.
+    size_t sequence_length = msg.sender.sequence_length();
+    for ( const auto& payload : more_payloads ) {
+      sequence_length += payload.size();
+    }
+    const bool syn_or_fin = msg.sender.SYN or msg.sender.FIN;
+    const bool arrived_in_order = our_ackno.has_value() and msg.sender.seqno == our_ackno.value()
+                                  and receiver_.reassembler().bytes_pending() == 0;
+
     // Did the inbound stream finish before the outbound stream? If so, no need to linger after streams finish.
     if ( receiver_.writer().is_closed() and not sender_.reader().is_finished() ) {
       linger_after_streams_finish_ = false;
     }
 
+    // Convert the peer's advertised window from its on-the-wire (scaled) form.
+    decode_window( msg );
+
+    // Did the peer's SYN agree to the timestamps option?
+    if ( msg.sender.SYN and msg.sender.TSval.has_value() ) {
+      timestamps_ok_ = true;
+    }
+
+    // Did the server grant a Fast Open cookie in answer to our SYN?
+    if ( msg.sender.SYN and msg.receiver.ackno.has_value() and msg.sender.fast_open_cookie.has_value()
+         and not msg.sender.fast_open_cookie->empty() ) {
+      fast_open_cookie_ = msg.sender.fast_open_cookie;
+    }
+
+    // Data echoing one of our timestamps tells us how long the peer took to answer our last segment.
+    if ( timestamps_ok_ and not msg.sender.payload.empty() and msg.receiver.TSecr.has_value() ) {
+      sample_receive_rtt( static_cast<uint32_t>( cumulative_time_ ) - msg.receiver.TSecr.value() );
+    }
+
     // Give incoming TCPSenderMessage to receiver.
-    receiver_.receive( std::move( msg.sender ) );
+    const uint64_t paws_rejected = receiver_.paws_rejected();
+    receiver_.receive( std::move( msg.sender ), more_payloads );
+
+    // A segment that PAWS discards as an old duplicate is acknowledged, and otherwise ignored (RFC 7323 5.3).
+    if ( receiver_.paws_rejected() != paws_rejected ) {
+      need_send_ = true;
+      return;
+    }
 
     // Give incoming TCPReceiverMessage to sender.
     sender_.receive( msg.receiver );
 
+    // If SenderMessage occupies a sequence number, make sure to reply.
+    if ( sequence_length > 0 ) {
+      schedule_ack( syn_or_fin or not arrived_in_order or not advanced_ackno( our_ackno, sequence_length ),
+                    segments );
+    }
+    need_send_ |= window_update_due();
+  }
+
+  // Send whatever the messages absorbed since the last flush call for.
+  void flush( const TransmitFunction& transmit )
+  {
+    if ( not active() ) {
+      cancel_delayed_ack();
+      return;
+    }
+
     // Send reply if needed.
     push( transmit );
     if ( need_send_ ) {
@@ -82,25 +305,233 @@ public:
     }
   }
 
-  // Testing interface
-  const TCPReceiver& receiver() const { return receiver_; }
-  const TCPSender& sender() const { return sender_; }
+  // Software GRO: can `next` be appended to `msg` (carrying `length` bytes of payload so far) without changing
+  // what the receiver and sender see? Like Linux's tcp_gro_receive, only exactly contiguous data segments with
+  // identical headers merge.
+  static bool can_coalesce( const TCPMessage& msg, size_t length, const TCPMessage& next )
+  {
+    const TCPSenderMessage& a = msg.sender;
+    const TCPSenderMessage& b = next.sender;
+    const bool plain_data = not a.SYN and not a.FIN and not a.RST and not b.SYN and not b.RST
+                            and not a.payload.empty() and not b.payload.empty();
+    const bool same_header = a.TSval == b.TSval and msg.receiver.ackno == next.receiver.ackno
+                             and msg.receiver.window_size == next.receiver.window_size
+                             and msg.receiver.RST == next.receiver.RST and msg.receiver.TSecr == next.receiver.TSecr
+                             and not next.receiver.window_scale.has_value();
+    return plain_data and same_header and b.seqno == a.seqno + length;
+  }
 
-private:
-  TCPConfig cfg_;
-  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout };
-  TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
+  // The payloads merged into a segment after its first (kept to reuse their storage from batch to batch)
+  std::vector<std::string> gro_payloads_ {};
 
-  bool need_send_ {};
+  // Delayed ACKs (RFC 1122 4.2.3.2, RFC 5681 4.2): an in-order data segment is acknowledged together
+  // with the next one, or once `ack_delay_ms` has passed, unless a segment is sent in the meantime.
+  size_t segments_unacked_ {};
+  std::optional<uint64_t> ack_deadline_ {};
+  uint64_t acks_coalesced_ {};
+  uint64_t segments_coalesced_ {};
+  uint64_t last_window_sent_ {};
+  uint64_t last_edge_sent_ {}; // right edge of the window last advertised, as an offset in the inbound stream
 
-  void send( const TCPSenderMessage& sender_message, const TransmitFunction& transmit )
+  void cancel_delayed_ack()
   {
-    TCPMessage msg { sender_message, receiver_.send() };
-    transmit( std::move( msg ) );
     need_send_ = false;
+    segments_unacked_ = 0;
+    ack_deadline_.reset();
+  }
+
+  void schedule_ack( bool immediately, size_t segments )
+  {
+    segments_unacked_ += segments;
+    if ( immediately or cfg_.ack_delay_ms == 0 or segments_unacked_ >= 2 ) {
+      need_send_ = true;
+      return;
+    }
+
+    ++acks_coalesced_;
+    if ( not ack_deadline_.has_value() ) {
+      ack_deadline_ = cumulative_time_ + cfg_.ack_delay_ms;
+    }
+  }
+
+  // Did the segment just received extend the in-order stream by exactly its own length?
+  bool advanced_ackno( const std::optional<Wrap32>& old_ackno, size_t sequence_length ) const
+  {
+    const auto new_ackno = receiver_.send().ackno;
+    return old_ackno.has_value() and new_ackno.has_value()
+           and new_ackno.value() == old_ackno.value() + sequence_length
+           and receiver_.reassembler().bytes_pending() == 0;
+  }
+
+  // Has the receive window opened up enough (doubled, and by at least one segment) to be worth announcing?
+  bool window_update_due() const
+  {
+    if ( not active() or not has_ackno() or receiver_.writer().is_closed() ) {
+      return false;
+    }
+    const uint64_t window = receiver_.send().window_size;
+    return window >= 2 * last_window_sent_ and window - last_window_sent_ >= TCPConfig::MAX_PAYLOAD_SIZE;
+  }
+
+  // Window scaling (RFC 7323). TCPSender and TCPReceiver work with windows in bytes; the messages
+  // exchanged through `transmit` and `receive` carry the 16-bit window as it appears on the wire.
+  static uint8_t window_shift_for( uint64_t capacity )
+  {
+    uint8_t shift = 0;
+    while ( shift < TCPConfig::MAX_WINDOW_SCALE and ( capacity >> shift ) > UINT16_MAX ) {
+      ++shift;
+    }
+    return shift;
+  }
+
+  // (the shift is chosen for the largest buffer that auto-tuning may grow to)
+  uint8_t rcv_wscale_ { receive_window_shift( cfg_ ) };
+  uint8_t snd_wscale_ {}; // shift the peer applies to its windows
+  bool wscale_ok_ {};     // did both SYNs carry the option?
+
+  void encode_window( TCPMessage& msg ) const
+  {
+    if ( msg.sender.SYN ) {
+      // The window in a SYN segment is never scaled. Offer the option on an active open,
+      // or in reply to a SYN that offered it.
+      msg.receiver.window_size = std::min<uint32_t>( msg.receiver.window_size, UINT16_MAX );
+      if ( not msg.receiver.ackno.has_value() or wscale_ok_ ) {
+        msg.receiver.window_scale = rcv_wscale_;
+      }
+      return;
+    }
+
+    if ( wscale_ok_ ) {
+      msg.receiver.window_size >>= rcv_wscale_;
+    }
+    msg.receiver.window_size = std::min<uint32_t>( msg.receiver.window_size, UINT16_MAX );
+  }
+
+  // Timestamps option (RFC 7323). Every segment is stamped at the moment it is (re)transmitted, so the
+  // echo in the acknowledgment gives TCPSender an unambiguous RTT sample.
+  bool timestamps_ok_ {}; // did both SYNs carry the option?
+
+  void stamp( TCPMessage& msg ) const
+  {
+    const bool offer = msg.sender.SYN and not msg.receiver.ackno.has_value();
+    if ( offer or timestamps_ok_ ) {
+      msg.sender.TSval = static_cast<uint32_t>( cumulative_time_ );
+    } else {
+      msg.receiver.TSecr.reset();
+    }
+  }
+
+  void decode_window( TCPMessage& msg )
+  {
+    if ( msg.sender.SYN ) {
+      if ( msg.receiver.window_scale.has_value() and not wscale_ok_ ) {
+        wscale_ok_ = true;
+        snd_wscale_ = std::min( msg.receiver.window_scale.value(), TCPConfig::MAX_WINDOW_SCALE );
+        receiver_.set_window_shift( rcv_wscale_ );
+      }
+      return;
+    }
+
+    if ( wscale_ok_ ) {
+      msg.receiver.window_size <<= snd_wscale_;
+    }
+  }
+
+  // Receive-buffer auto-tuning (in the spirit of Linux's tcp_rcv_space_adjust). Once per RTT, estimate
+  // the bandwidth-delay product from how fast the application has been reading; if twice that no longer
+  // fits in the buffer, grow it (up to `recv_capacity_max`). An idle connection gives the memory back,
+  // as fast as the peer uses up the window already advertised to it.
+  std::optional<uint64_t> rcv_rtt_ms_ {};     // receiver-side RTT estimate, from echoed timestamps
+  uint64_t rcv_interval_start_ {};            // when the current measurement interval began
+  uint64_t rcv_interval_popped_ {};           // bytes read by the application when it began
+  bool rcv_interval_started_ {};
+  bool rcv_shrink_pending_ {}; // is the buffer on its way back to `recv_capacity`?
+
+  void sample_receive_rtt( uint32_t sample )
+  {
+    rcv_rtt_ms_ = rcv_rtt_ms_.has_value() ? ( 7 * rcv_rtt_ms_.value() + sample ) / 8 : sample;
+  }
+
+  uint64_t receive_rtt() const
+  {
+    const uint64_t rtt = rcv_rtt_ms_.value_or( sender_.smoothed_rtt().value_or( cfg_.rt_timeout ) );
+    return std::max<uint64_t>( rtt, 1 );
+  }
+
+  bool receive_buffer_drained() const
+  {
+    return receiver_.reader().bytes_buffered() == 0 and receiver_.reassembler().bytes_pending() == 0;
+  }
+
+  void autotune_receive_buffer()
+  {
+    if ( cfg_.recv_capacity_max <= cfg_.recv_capacity or not has_ackno() or receiver_.writer().is_closed() ) {
+      return;
+    }
+
+    const uint64_t capacity = receiver_.writer().capacity();
+    const uint64_t popped = receiver_.reader().bytes_popped();
+
+    // Shrink back to the initial size once the connection has gone quiet and the buffer is empty.
+    const bool idle
+      = cumulative_time_ - time_of_last_receipt_ >= TCPConfig::RECV_IDLE_MS and receive_buffer_drained();
+    if ( idle ) {
+      rcv_shrink_pending_ = capacity > cfg_.recv_capacity;
+      if ( rcv_shrink_pending_ ) {
+        shrink_receive_buffer();
+      }
+      rcv_interval_started_ = false;
+      return;
+    }
+
+    if ( not rcv_interval_started_ ) {
+      rcv_interval_started_ = true;
+      rcv_interval_start_ = cumulative_time_;
+      rcv_interval_popped_ = popped;
+      return;
+    }
+
+    const uint64_t rtt = receive_rtt();
+    const uint64_t elapsed = cumulative_time_ - rcv_interval_start_;
+    if ( elapsed < rtt ) {
+      return;
+    }
+
+    const uint64_t bdp = ( popped - rcv_interval_popped_ ) * rtt / elapsed;
+    if ( 2 * bdp > capacity ) {
+      receiver_.set_capacity( std::min<uint64_t>( 2 * bdp, cfg_.recv_capacity_max ) );
+      rcv_shrink_pending_ = false;
+    }
+    rcv_interval_start_ = cumulative_time_;
+    rcv_interval_popped_ = popped;
+  }
+
+  // Lower the capacity toward `recv_capacity`, but never so far that the right edge of the window already
+  // advertised would move back (RFC 7323 2.4, RFC 9293 3.8.6): the window closes as data arrives.
+  void shrink_receive_buffer()
+  {
+    const Writer& writer = receiver_.writer();
+    const uint64_t capacity = writer.capacity();
+    const uint64_t available = writer.available_capacity();
+    const uint64_t pushed = writer.bytes_pushed();
+    uint64_t promised = last_edge_sent_ > pushed ? last_edge_sent_ - pushed : 0;
+    if ( wscale_ok_ ) {
+      // (a scaled window is rounded down on the wire, so keep enough that it still reaches the edge)
+      const uint64_t unit = uint64_t { 1 } << rcv_wscale_;
+      promised = ( promised + unit - 1 ) / unit * unit;
+    }
+    const uint64_t floor = capacity - available + std::min( available, promised );
+    const uint64_t target = std::max( cfg_.recv_capacity, floor );
+    if ( target < capacity ) {
+      receiver_.set_capacity( target );
+    }
+    rcv_shrink_pending_ = writer.capacity() > cfg_.recv_capacity;
   }
 
   bool linger_after_streams_finish_ { true }; // one peer may need to linger to make sure all closure conditions met
   uint64_t cumulative_time_ {};
   uint64_t time_of_last_receipt_ {};
+
+  uint64_t segments_sent_ {};
+  uint64_t segments_received_ {};
 };
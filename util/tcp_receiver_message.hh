@@ -2,26 +2,37 @@
 
 #include "wrapping_integers.hh"
 
+#include <cstdint>
 #include <optional>
 
 /*
  * The TCPReceiverMessage structure contains the information sent from a TCP receiver to its sender.
  *
- * It contains three fields:
+ * It contains five fields:
  *
  * 1) The acknowledgment number (ackno): the *next* sequence number needed by the TCP Receiver.
  *    This is an optional field that is empty if the TCPReceiver hasn't yet received the Initial Sequence Number.
  *
  * 2) The window size. This is the number of sequence numbers that the TCP receiver is interested
- *    to receive, starting from the ackno if present. The maximum value is 65,535 (UINT16_MAX from
- *    the <cstdint> header).
+ *    to receive, starting from the ackno if present. Without window scaling the maximum value is
+ *    65,535 (UINT16_MAX from the <cstdint> header); once both peers have agreed on a window scale
+ *    (RFC 7323), it can be as large as UINT16_MAX << 14.
  *
  * 3) The RST (reset) flag. If set, the stream has suffered an error and the connection should be aborted.
+ *
+ * 4) The window scale option. Only carried on SYN segments: the shift count that this receiver will
+ *    apply to every window it advertises after the handshake.
+ *
+ * 5) The timestamp echo reply (TSecr) of the timestamps option (RFC 7323): the most recent TSval received
+ *    from the peer's sender, which the peer uses to measure the round-trip time.
  */
 
 struct TCPReceiverMessage
 {
   std::optional<Wrap32> ackno {};
-  uint16_t window_size {};
+  uint32_t window_size {};
   bool RST {};
+
+  std::optional<uint8_t> window_scale {};
+  std::optional<uint32_t> TSecr {};
 };
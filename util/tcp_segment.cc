@@ -2,12 +2,135 @@
 #include "checksum.hh"
 #include "wrapping_integers.hh"
 
+#include <algorithm>
 #include <cstddef>
+#include <string>
+#include <string_view>
 
 static constexpr uint32_t TCPHeaderMinLen = 5; // 32-bit words
 
+// TCP option kinds (RFC 9293, RFC 7323, RFC 7413)
+static constexpr uint8_t TCPOptionEnd = 0;
+static constexpr uint8_t TCPOptionNop = 1;
+static constexpr uint8_t TCPOptionWindowScale = 3;
+static constexpr uint8_t TCPOptionTimestamps = 8;
+static constexpr uint8_t TCPOptionFastOpen = 34;
+
+static constexpr size_t FastOpenCookieMinLen = 4;
+static constexpr size_t FastOpenCookieMaxLen = 16;
+
 using namespace std;
 
+namespace {
+
+uint32_t read_u32( string_view bytes )
+{
+  uint32_t ret = 0;
+  for ( const char c : bytes ) {
+    ret = ( ret << 8 ) | static_cast<uint8_t>( c );
+  }
+  return ret;
+}
+
+void write_u32( string& out, uint32_t val )
+{
+  for ( int shift = 24; shift >= 0; shift -= 8 ) {
+    out.push_back( static_cast<char>( val >> shift ) );
+  }
+}
+
+// The flags byte of the header carrying `message`
+uint8_t flags_of( const TCPMessage& message )
+{
+  const bool reset = message.sender.RST or message.receiver.RST;
+  return ( message.receiver.ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
+         | ( message.sender.SYN ? 0b0000'0010U : 0 ) | ( message.sender.FIN ? 0b0000'0001U : 0 );
+}
+
+// Parse the options area of the TCP header, ignoring any option kinds we don't understand
+void parse_options( Parser& parser, string_view options, TCPMessage& message )
+{
+  while ( not options.empty() ) {
+    const uint8_t kind = options.front();
+    if ( kind == TCPOptionEnd ) {
+      return;
+    }
+    if ( kind == TCPOptionNop ) {
+      options.remove_prefix( 1 );
+      continue;
+    }
+
+    if ( options.size() < 2 ) {
+      parser.set_error();
+      return;
+    }
+    const uint8_t len = options.at( 1 );
+    if ( len < 2 or len > options.size() ) {
+      parser.set_error();
+      return;
+    }
+    const string_view value = options.substr( 2, len - 2 );
+
+    switch ( kind ) {
+      case TCPOptionWindowScale:
+        if ( value.size() == 1 ) {
+          message.receiver.window_scale = static_cast<uint8_t>( value.front() );
+        }
+        break;
+      case TCPOptionTimestamps:
+        if ( value.size() == 8 ) {
+          message.sender.TSval = read_u32( value.substr( 0, 4 ) );
+          // the echo reply is only meaningful when the ACK bit is set
+          if ( message.receiver.ackno.has_value() ) {
+            message.receiver.TSecr = read_u32( value.substr( 4, 4 ) );
+          }
+        }
+        break;
+      case TCPOptionFastOpen:
+        // an empty cookie is a request; otherwise it must be 4 to 16 bytes long
+        if ( value.empty() or ( value.size() >= FastOpenCookieMinLen and value.size() <= FastOpenCookieMaxLen ) ) {
+          message.sender.fast_open_cookie = string { value };
+        }
+        break;
+      default:
+        break;
+    }
+
+    options.remove_prefix( len );
+  }
+}
+
+// Serialize the options carried by a TCPMessage, padded to a multiple of 32 bits
+string serialize_options( const TCPMessage& message )
+{
+  string options;
+  if ( message.receiver.window_scale.has_value() ) {
+    options.push_back( TCPOptionNop );
+    options.push_back( TCPOptionWindowScale );
+    options.push_back( 3 );
+    options.push_back( static_cast<char>( message.receiver.window_scale.value() ) );
+  }
+  if ( message.sender.TSval.has_value() ) {
+    options.push_back( TCPOptionNop );
+    options.push_back( TCPOptionNop );
+    options.push_back( TCPOptionTimestamps );
+    options.push_back( 10 );
+    write_u32( options, message.sender.TSval.value() );
+    write_u32( options, message.receiver.TSecr.value_or( 0 ) );
+  }
+  if ( message.sender.fast_open_cookie.has_value() ) {
+    const string& cookie = message.sender.fast_open_cookie.value();
+    options.push_back( TCPOptionFastOpen );
+    options.push_back( static_cast<char>( 2 + min( cookie.size(), FastOpenCookieMaxLen ) ) );
+    options.append( cookie, 0, FastOpenCookieMaxLen );
+  }
+
+  options.resize( ( options.size() + 3 ) / 4 * 4, TCPOptionEnd );
+  return options;
+}
+
+} // namespace
+
 void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum )
 {
   /* verify checksum */
@@ -43,15 +166,22 @@ void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum
   message.sender.SYN = octet & 0b0000'0010;
   message.sender.FIN = octet & 0b0000'0001;
 
-  parser.integer( message.receiver.window_size );
+  parser.integer( raw16 );
+  message.receiver.window_size = raw16;
   parser.integer( udinfo.cksum );
   parser.integer( raw16 ); // urgent pointer
 
-  // skip any options or anything extra in the header
+  // parse any options in the header
   if ( data_offset < TCPHeaderMinLen ) {
     parser.set_error();
+    return;
   }
-  parser.remove_prefix( data_offset * 4 - TCPHeaderMinLen * 4 );
+  string options( data_offset * 4 - TCPHeaderMinLen * 4, 0 );
+  parser.string( options );
+  if ( parser.has_error() ) {
+    return;
+  }
+  parse_options( parser, options, message );
 
   parser.all_remaining( message.sender.payload );
 }
@@ -64,19 +194,42 @@ public:
 
 void TCPSegment::serialize( Serializer& serializer ) const
 {
+  serialize_header( serializer, message, udinfo );
+  serializer.buffer( message.sender.payload );
+}
+
+void TCPSegment::serialize_header( Serializer& serializer,
+                                   const TCPMessage& message,
+                                   const UserDatagramInfo& udinfo )
+{
+  const string options = serialize_options( message );
+
   serializer.integer( udinfo.src_port );
   serializer.integer( udinfo.dst_port );
   serializer.integer( Wrap32Serializable { message.sender.seqno }.raw_value() );
   serializer.integer( Wrap32Serializable { message.receiver.ackno.value_or( Wrap32 { 0 } ) }.raw_value() );
-  serializer.integer( uint8_t { TCPHeaderMinLen << 4 } ); // data offset
-  const bool reset = message.sender.RST or message.receiver.RST;
-  const uint8_t flags = ( message.receiver.ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
-                        | ( message.sender.SYN ? 0b0000'0010U : 0 ) | ( message.sender.FIN ? 0b0000'0001U : 0 );
-  serializer.integer( flags );
-  serializer.integer( message.receiver.window_size );
+  serializer.integer( static_cast<uint8_t>( ( TCPHeaderMinLen + options.size() / 4 ) << 4 ) ); // data offset
+  serializer.integer( flags_of( message ) );
+  serializer.integer( static_cast<uint16_t>( min<uint32_t>( message.receiver.window_size, UINT16_MAX ) ) );
   serializer.integer( udinfo.cksum );
   serializer.integer( uint16_t { 0 } ); // urgent pointer
-  serializer.buffer( message.sender.payload );
+  for ( const char c : options ) {
+    serializer.integer( static_cast<uint8_t>( c ) );
+  }
+}
+
+void TCPSegment::patch_header( string& header, const TCPMessage& message )
+{
+  const string options = serialize_options( message );
+
+  header.resize( TCPHeaderMinLen * 4 );
+  put_integer( header, 4, Wrap32Serializable { message.sender.seqno }.raw_value() );
+  put_integer( header, 8, Wrap32Serializable { message.receiver.ackno.value_or( Wrap32 { 0 } ) }.raw_value() );
+  header[12] = static_cast<char>( ( TCPHeaderMinLen + options.size() / 4 ) << 4 ); // data offset
+  header[13] = static_cast<char>( flags_of( message ) );
+  put_integer( header, 14, static_cast<uint16_t>( min<uint32_t>( message.receiver.window_size, UINT16_MAX ) ) );
+  put_integer( header, 16, uint32_t { 0 } ); // checksum and urgent pointer
+  header.append( options );
 }
 
 void TCPSegment::compute_checksum( uint32_t datagram_layer_pseudo_checksum )
@@ -89,3 +242,8 @@ void TCPSegment::compute_checksum( uint32_t datagram_layer_pseudo_checksum )
   check.add( s.output() );
   udinfo.cksum = check.value();
 }
+
+size_t TCPSegment::header_length() const
+{
+  return TCPHeaderMinLen * 4 + serialize_options( message ).size();
+}
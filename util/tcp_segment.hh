@@ -20,4 +20,14 @@ struct TCPSegment
   void serialize( Serializer& serializer ) const;
 
   void compute_checksum( uint32_t datagram_layer_pseudo_checksum );
+
+  // Serialize just the header (including options) that would carry `message` with `udinfo`
+  static void serialize_header( Serializer& serializer, const TCPMessage& message, const UserDatagramInfo& udinfo );
+
+  // Fill in the header that carries `message` after the ports already at the start of `header` (the checksum
+  // is left zero). Bytes are written in place: this is the transmit path's alternative to serialize_header.
+  static void patch_header( std::string& header, const TCPMessage& message );
+
+  // Length of the TCP header (including options), in bytes
+  size_t header_length() const;
 };
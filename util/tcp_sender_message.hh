@@ -2,12 +2,14 @@
 
 #include "wrapping_integers.hh"
 
+#include <cstdint>
+#include <optional>
 #include <string>
 
 /*
  * The TCPSenderMessage structure contains the information sent from a TCP sender to its receiver.
  *
- * It contains five fields:
+ * It contains seven fields:
  *
  * 1) The sequence number (seqno) of the beginning of the segment. If the SYN flag is set, this is the
  *    sequence number of the SYN flag. Otherwise, it's the sequence number of the beginning of the payload.
@@ -20,6 +22,12 @@
  * 4) The FIN flag. If set, the payload represents the ending of the byte stream.
  *
  * 5) The RST (reset) flag. If set, the stream has suffered an error and the connection should be aborted.
+ *
+ * 6) The timestamp value (TSval) of the timestamps option (RFC 7323): the sender's clock, in milliseconds,
+ *    when this segment was (re)transmitted. Empty unless both peers agreed on the option.
+ *
+ * 7) The TCP Fast Open cookie option (RFC 7413), only meaningful on a SYN. An empty string in a SYN asks
+ *    the server for a cookie; a SYN-ACK grants one; a SYN carrying a valid cookie may carry data too.
  */
 
 struct TCPSenderMessage
@@ -32,6 +40,10 @@ struct TCPSenderMessage
 
   bool RST {};
 
+  std::optional<uint32_t> TSval {};
+
+  std::optional<std::string> fast_open_cookie {};
+
   // How many sequence numbers does this segment use?
   size_t sequence_length() const { return SYN + payload.size() + FIN; }
 };
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+// A snapshot of the state of one TCP connection (in the spirit of Linux's `struct tcp_info`)
+struct TCPStats
+{
+  // Outbound direction
+  uint64_t bytes_sent {};                  // payload bytes sent at least once
+  uint64_t bytes_acked {};                 // payload bytes cumulatively acknowledged by the peer
+  uint64_t segments_sent {};               // segments transmitted, including retransmissions and bare ACKs
+  uint64_t segments_retransmitted {};      // segments retransmitted after a timeout
+  uint64_t consecutive_retransmissions {}; // retransmissions since the last acknowledgment of new data
+  uint64_t bytes_in_flight {};             // sequence numbers sent but not yet acknowledged
+  uint64_t peer_window {};                 // window most recently advertised by the peer, in bytes
+  uint64_t outbound_buffered {};           // bytes written by the application and not yet sent
+  std::optional<uint64_t> srtt_ms {};      // smoothed RTT, once it has been measured
+  uint64_t rto_ms {};                      // retransmission timeout (before backoff)
+
+  // Inbound direction
+  uint64_t segments_received {};         // segments handed to the peer
+  uint64_t bytes_received {};            // payload bytes reassembled into the inbound stream
+  uint64_t advertised_window {};         // window we currently advertise, in bytes
+  uint64_t reassembler_bytes_pending {}; // out-of-order bytes held by the Reassembler
+  uint64_t inbound_buffered {};          // reassembled bytes not yet read by the application
+  uint64_t acks_coalesced {};            // ACKs folded into later segments (delayed ACK)
+  uint64_t segments_coalesced {};        // segments merged into their predecessor before reassembly (GRO)
+  uint64_t receive_buffer {};            // current capacity of the inbound stream (grows with auto-tuning)
+};
@@ -1,6 +1,8 @@
 #include "tuntap_adapter.hh"
 #include "parser.hh"
 
+#include <utility>
+
 using namespace std;
 
 optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
@@ -10,9 +12,8 @@ optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
   _tun.read( strs );
 
   InternetDatagram ip_dgram;
-  const vector<string> buffers = { strs.at( 0 ), strs.at( 1 ) };
-  if ( parse( ip_dgram, buffers ) ) {
-    return unwrap_tcp_in_ip( ip_dgram );
+  if ( parse( ip_dgram, std::move( strs ) ) ) {
+    return unwrap_tcp_in_ip( std::move( ip_dgram ) );
   }
   return {};
 }
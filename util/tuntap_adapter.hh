@@ -7,6 +7,7 @@
 #include <optional>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 template<class T>
 concept TCPDatagramAdapter = requires( T a, TCPMessage seg ) {
@@ -19,6 +20,22 @@ concept TCPDatagramAdapter = requires( T a, TCPMessage seg ) {
   } -> std::same_as<std::optional<TCPMessage>>;
 };
 
+//! \brief A TCPDatagramAdapter that can also move several segments at a time
+//! \details read_batch() appends up to `max_count` of the segments waiting to be read (none if there are none),
+//! and write_batch() sends a whole batch of segments, each with as few system calls as the adapter can manage.
+template<class T>
+concept BatchTCPDatagramAdapter
+  = TCPDatagramAdapter<T>
+    and requires( T a, std::vector<TCPMessage>& in, const std::vector<TCPMessage>& out, size_t max_count ) {
+          {
+            a.read_batch( in, max_count )
+          } -> std::same_as<void>;
+
+          {
+            a.write_batch( out )
+          } -> std::same_as<void>;
+        };
+
 //! \brief A FD adapter for IPv4 datagrams read from and written to a TUN device
 class TCPOverIPv4OverTunFdAdapter : public TCPOverIPv4Adapter
 {
@@ -33,7 +50,7 @@ public:
   std::optional<TCPMessage> read();
 
   //! Creates an IPv4 datagram from a TCP segment and writes it to the TUN device
-  void write( const TCPMessage& seg ) { _tun.write( serialize( wrap_tcp_in_ip( seg ) ) ); }
+  void write( const TCPMessage& seg ) { _tun.write( wire_bytes( seg ) ); }
 
   //! Access the underlying TUN device
   explicit operator TunFD&() { return _tun; }